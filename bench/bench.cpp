@@ -0,0 +1,427 @@
+// benchmarks for the editing core, without GTK
+// runs every case against generated text from 1 KB up to --max-size and prints
+// one JSON object per case (throughput, p50 & p99 latency, peak RSS) so results
+// can be compared between releases, e.g.
+//   make bench BENCH_ARGS="--max-size 64M --output bench.json"
+
+#include "document.h"
+#include "encoding.h"
+#include "search.h"
+#include "stats.h"
+#include "undo.h"
+
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+// a case is repeated until it has run this long & this many times, whichever is later,
+// but never more than BENCH_MAX_SAMPLES times or past BENCH_MAX_TIME
+#define BENCH_MIN_TIME_NS (200 * 1000 * 1000LL)
+#define BENCH_MAX_TIME_NS (5 * 1000 * 1000 * 1000LL)
+#define BENCH_MIN_SAMPLES 5
+#define BENCH_MAX_SAMPLES 1000
+
+// keystrokes timed one at a time by the undo & typing cases
+#define BENCH_EDITS 10000
+
+// same as loading & saving in the editor
+#define BENCH_CHUNK_SIZE (1024 * 1024)
+
+// text is generated this much at a time & repeated up to the size wanted
+#define BENCH_BLOCK_SIZE (4 * 1024 * 1024)
+
+static const gsize corpus_sizes[] = {
+    1024,
+    64 * 1024,
+    1024 * 1024,
+    16 * 1024 * 1024,
+    256 * 1024 * 1024,
+    1024 * 1024 * 1024,
+};
+
+// "the" is common & "zebra crossing" never comes up, for many & no match cases
+static const gchar *vocabulary[] = {
+    "the", "The", "of", "and", "a", "to", "in", "is", "you", "that", "it", "he",
+    "was", "for", "on", "are", "as", "with", "his", "they", "at", "be", "this",
+    "have", "from", "or", "one", "had", "by", "word", "but", "not", "what", "all",
+    "were", "we", "when", "your", "can", "said", "there", "use", "an", "each",
+    "which", "she", "do", "how", "their", "if", "will", "up", "other", "about",
+    "café", "naïve", "Straße", "über", "résumé", "coöperate",
+};
+
+typedef struct {
+    const gchar *text;
+    gsize len;
+} Corpus;
+
+typedef void (*BenchFunc)(Corpus *corpus, gpointer data);
+
+static GString *output;
+static gchar *temp_dir;
+
+static gint64 now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+// the peak is reset before every case so each reports its own, through linux's
+// clear_refs (5 puts VmHWM back to the current rss), elsewhere it's the process' peak
+static void reset_peak_rss() {
+    gint fd = g_open("/proc/self/clear_refs", O_WRONLY, 0);
+    if (fd < 0) return;
+
+    if (write(fd, "5", 1) != 1)
+        g_printerr("can't reset the peak rss, cases will report the peak so far\n");
+
+    close(fd);
+}
+
+static glong peak_rss_kb() {
+    gchar *status;
+
+    if (g_file_get_contents("/proc/self/status", &status, NULL, NULL)) {
+        const gchar *hwm = strstr(status, "VmHWM:");
+        glong kb = hwm ? g_ascii_strtoll(hwm + strlen("VmHWM:"), NULL, 10) : 0;
+        g_free(status);
+
+        if (kb > 0) return kb;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// words & line breaks, the same text for every run
+static Corpus corpus_new(gsize size) {
+    gsize block_len = MIN(size, BENCH_BLOCK_SIZE);
+    GString *block = g_string_sized_new(block_len + 32);
+    GRand *rand = g_rand_new_with_seed(1);
+
+    while (block->len < block_len) {
+        g_string_append(block, vocabulary[g_rand_int_range(rand, 0, G_N_ELEMENTS(vocabulary))]);
+        g_string_append_c(block, g_rand_int_range(rand, 0, 12) == 0 ? '\n' : ' ');
+    }
+
+    // back to the end of a word so repeating the block can't split a character
+    gsize cut = block_len;
+    while (cut > 0 && block->str[cut - 1] != ' ' && block->str[cut - 1] != '\n')
+        cut--;
+    g_string_truncate(block, cut);
+
+    gchar *text = (gchar *)g_malloc(size + 1);
+    gsize len = 0;
+
+    while (block->len > 0 && len + block->len <= size) {
+        memcpy(text + len, block->str, block->len);
+        len += block->len;
+    }
+
+    // fill the rest with spaces to get the exact size
+    memset(text + len, ' ', size - len);
+    text[size] = '\0';
+
+    g_rand_free(rand);
+    g_string_free(block, TRUE);
+
+    Corpus corpus = { text, size };
+    return corpus;
+}
+
+static gint compare_gint64(gconstpointer a, gconstpointer b) {
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+static gint64 percentile(GArray *samples, gdouble p) {
+    return g_array_index(samples, gint64, (guint)((samples->len - 1) * p + 0.5));
+}
+
+// bytes is what one sample processes, samples are in nanoseconds & get sorted
+static void report(const gchar *name, gsize size, gsize bytes, GArray *samples, glong peak_kb) {
+    g_array_sort(samples, compare_gint64);
+
+    gint64 p50 = percentile(samples, 0.5);
+    gint64 p99 = percentile(samples, 0.99);
+    gdouble mb_per_s = p50 > 0 ? bytes / (p50 / 1e9) / (1024 * 1024) : 0;
+
+    if (output->len > 0) g_string_append(output, ",\n");
+    g_string_append_printf(output,
+        "  {\"name\": \"%s\", \"size\": %" G_GSIZE_FORMAT ", \"samples\": %u, "
+        "\"p50_ns\": %" G_GINT64_FORMAT ", \"p99_ns\": %" G_GINT64_FORMAT ", "
+        "\"throughput_mb_s\": %.1f, \"ops_per_s\": %.1f, \"peak_rss_kb\": %ld}",
+        name, size, samples->len, p50, p99, mb_per_s, p50 > 0 ? 1e9 / p50 : 0, peak_kb);
+
+    g_printerr("%-32s %10" G_GSIZE_FORMAT " B  p50 %12.3f ms  p99 %12.3f ms  %10.1f MB/s\n",
+               name, size, p50 / 1e6, p99 / 1e6, mb_per_s);
+}
+
+// time whole runs of func over the corpus
+static void run_case(const gchar *name, Corpus *corpus, BenchFunc func, gpointer data) {
+    GArray *samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    gint64 total = 0;
+
+    reset_peak_rss();
+
+    while (samples->len < BENCH_MAX_SAMPLES && total < BENCH_MAX_TIME_NS &&
+           (total < BENCH_MIN_TIME_NS || samples->len < BENCH_MIN_SAMPLES)) {
+        gint64 start = now_ns();
+        func(corpus, data);
+        gint64 elapsed = now_ns() - start;
+
+        g_array_append_val(samples, elapsed);
+        total += elapsed;
+    }
+
+    report(name, corpus->len, corpus->len, samples, peak_rss_kb());
+    g_array_free(samples, TRUE);
+}
+
+// searching
+
+static void bench_search(Corpus *corpus, gpointer data) {
+    GArray *ranges = g_array_new(FALSE, FALSE, sizeof(gsize));
+    search_pattern_find_all((SearchPattern *)data, corpus->text, corpus->len, ranges, NULL);
+    g_array_free(ranges, TRUE);
+}
+
+static void bench_replace_all(Corpus *corpus, gpointer data) {
+    SearchPattern *pattern = (SearchPattern *)data;
+    GArray *ranges = g_array_new(FALSE, FALSE, sizeof(gsize));
+
+    search_pattern_find_all(pattern, corpus->text, corpus->len, ranges, NULL);
+    GString *result = search_replace_ranges(pattern, corpus->text, corpus->len, ranges, "a", NULL);
+
+    g_string_free(result, TRUE);
+    g_array_free(ranges, TRUE);
+}
+
+static void search_cases(Corpus *corpus) {
+    struct {
+        const gchar *name;
+        const gchar *needle;
+        gboolean case_sensitive;
+    } cases[] = {
+        { "search/sensitive/many", "the", TRUE },
+        { "search/sensitive/none", "zebra crossing", TRUE },
+        { "search/insensitive/many", "THE", FALSE },
+        { "search/insensitive/none", "ZEBRA CROSSING", FALSE },
+        { "search/insensitive-unicode/many", "ÜBER", FALSE },
+    };
+
+    for (guint i = 0; i < G_N_ELEMENTS(cases); i++) {
+        SearchPattern *pattern = search_pattern_new(cases[i].needle, cases[i].case_sensitive);
+        run_case(cases[i].name, corpus, bench_search, pattern);
+        search_pattern_free(pattern);
+    }
+
+    SearchPattern *pattern = search_pattern_new("the", TRUE);
+    run_case("replace-all/many", corpus, bench_replace_all, pattern);
+    search_pattern_free(pattern);
+}
+
+// opening & saving, through a file like the editor does
+
+static void add_decoded_text(const gchar *text, gsize len, gpointer user_data) {
+    Document *doc = (Document *)user_data;
+    document_insert(doc, document_get_chars(doc), text, len);
+}
+
+static void bench_open(Corpus *corpus, gpointer data) {
+    const gchar *path = (const gchar *)data;
+    gint fd = g_open(path, O_RDONLY, 0);
+    gchar *chunk = (gchar *)g_malloc(BENCH_CHUNK_SIZE);
+    Document *doc = document_new();
+    TextDecoder decoder;
+    gssize n;
+
+    text_decoder_init(&decoder);
+
+    while ((n = read(fd, chunk, BENCH_CHUNK_SIZE)) > 0)
+        text_decoder_feed(&decoder, chunk, n, add_decoded_text, doc);
+    text_decoder_finish(&decoder, add_decoded_text, doc);
+
+    document_free(doc);
+    g_free(chunk);
+    close(fd);
+}
+
+static gboolean write_piece(const gchar *text, gsize len, gpointer user_data) {
+    return write(GPOINTER_TO_INT(user_data), text, len) == (gssize)len;
+}
+
+// temp file, sync & rename, the same steps as saving in the editor
+static void bench_save(Corpus *corpus, gpointer data) {
+    DocSnapshot *snapshot = document_snapshot((Document *)data);
+    gchar *path = g_build_filename(temp_dir, "save", NULL);
+    gchar *temp = g_build_filename(temp_dir, "save.XXXXXX", NULL);
+    gint fd = g_mkstemp_full(temp, O_WRONLY, 0644);
+
+    doc_snapshot_foreach(snapshot, write_piece, GINT_TO_POINTER(fd));
+    fsync(fd);
+    close(fd);
+    g_rename(temp, path);
+
+    doc_snapshot_free(snapshot);
+    g_free(temp);
+    g_free(path);
+}
+
+static void file_cases(Corpus *corpus) {
+    gchar *path = g_build_filename(temp_dir, "open", NULL);
+    g_file_set_contents(path, corpus->text, corpus->len, NULL);
+    run_case("open", corpus, bench_open, path);
+    g_unlink(path);
+    g_free(path);
+
+    Document *doc = document_new();
+    document_insert(doc, 0, corpus->text, corpus->len);
+    run_case("save", corpus, bench_save, doc);
+    document_free(doc);
+
+    path = g_build_filename(temp_dir, "save", NULL);
+    g_unlink(path);
+    g_free(path);
+}
+
+// status bar counts
+
+static void bench_stats(Corpus *corpus, gpointer data) {
+    DocStats stats;
+    doc_stats_reset(&stats);
+    doc_stats_insert(&stats, 0, corpus->text, corpus->len, 0);
+}
+
+// keystrokes, timed one at a time
+
+static void apply_undo_op(UndoOpType type, gint offset, const gchar *text, gint length, gpointer user_data) {
+    Document *doc = (Document *)user_data;
+
+    if (type == UNDO_OP_INSERT) {
+        document_insert(doc, offset, text, strlen(text));
+    } else {
+        document_delete(doc, offset, length);
+    }
+}
+
+static void edit_cases(Corpus *corpus) {
+    Document *doc = document_new();
+    UndoJournal *journal = undo_journal_new(G_MAXSIZE);
+    GRand *rand = g_rand_new_with_seed(2);
+    GArray *typing = g_array_new(FALSE, FALSE, sizeof(gint64));
+    GArray *undoing = g_array_new(FALSE, FALSE, sizeof(gint64));
+    GArray *redoing = g_array_new(FALSE, FALSE, sizeof(gint64));
+    gint chars;
+
+    document_insert(doc, 0, corpus->text, corpus->len);
+    chars = document_get_chars(doc);
+    reset_peak_rss();
+
+    // typing a character somewhere & recording it, like the insert handler does
+    for (guint i = 0; i < BENCH_EDITS; i++) {
+        gint offset = g_rand_int_range(rand, 0, chars + 1);
+        gint64 start = now_ns();
+
+        document_insert(doc, offset, "x", 1);
+        undo_journal_record_insert(journal, offset, "x", 1);
+
+        gint64 elapsed = now_ns() - start;
+        g_array_append_val(typing, elapsed);
+        chars++;
+    }
+
+    glong typing_peak = peak_rss_kb();
+    reset_peak_rss();
+
+    for (guint i = 0; i < BENCH_EDITS; i++) {
+        gint64 start = now_ns();
+        undo_journal_undo(journal, apply_undo_op, doc);
+        gint64 elapsed = now_ns() - start;
+        g_array_append_val(undoing, elapsed);
+    }
+
+    glong undoing_peak = peak_rss_kb();
+    reset_peak_rss();
+
+    for (guint i = 0; i < BENCH_EDITS; i++) {
+        gint64 start = now_ns();
+        undo_journal_redo(journal, apply_undo_op, doc);
+        gint64 elapsed = now_ns() - start;
+        g_array_append_val(redoing, elapsed);
+    }
+
+    report("edit/type+undo-push", corpus->len, 1, typing, typing_peak);
+    report("edit/undo", corpus->len, 1, undoing, undoing_peak);
+    report("edit/redo", corpus->len, 1, redoing, peak_rss_kb());
+
+    g_array_free(typing, TRUE);
+    g_array_free(undoing, TRUE);
+    g_array_free(redoing, TRUE);
+    g_rand_free(rand);
+    undo_journal_free(journal);
+    document_free(doc);
+}
+
+int main(int argc, char *argv[]) {
+    gchar *max_size_arg = NULL;
+    gchar *output_path = NULL;
+
+    GOptionEntry entries[] = {
+        { "max-size", 0, 0, G_OPTION_ARG_STRING, &max_size_arg, "Largest corpus, e.g. 64M (default 1G)", "SIZE" },
+        { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path, "Write the JSON results to FILE instead of stdout", "FILE" },
+        { NULL }
+    };
+
+    GOptionContext *context = g_option_context_new("- benchmark the editing core");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    GError *error = NULL;
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+    g_option_context_free(context);
+
+    gsize max_size = 1024 * 1024 * 1024;
+    if (max_size_arg) {
+        gchar *end;
+        max_size = g_ascii_strtoull(max_size_arg, &end, 10);
+        if (*end == 'K' || *end == 'k') max_size <<= 10;
+        if (*end == 'M' || *end == 'm') max_size <<= 20;
+        if (*end == 'G' || *end == 'g') max_size <<= 30;
+    }
+
+    temp_dir = g_dir_make_tmp("notebook-bench-XXXXXX", NULL);
+    output = g_string_new(NULL);
+
+    for (guint i = 0; i < G_N_ELEMENTS(corpus_sizes) && corpus_sizes[i] <= max_size; i++) {
+        Corpus corpus = corpus_new(corpus_sizes[i]);
+
+        search_cases(&corpus);
+        run_case("stats", &corpus, bench_stats, NULL);
+        file_cases(&corpus);
+        edit_cases(&corpus);
+
+        g_free((gchar *)corpus.text);
+    }
+
+    gchar *json = g_strdup_printf("[\n%s\n]\n", output->str);
+
+    if (output_path) {
+        g_file_set_contents(output_path, json, -1, NULL);
+    } else {
+        g_print("%s", json);
+    }
+
+    g_rmdir(temp_dir);
+    g_free(json);
+    g_string_free(output, TRUE);
+    g_free(temp_dir);
+    g_free(output_path);
+    g_free(max_size_arg);
+    return 0;
+}
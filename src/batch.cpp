@@ -0,0 +1,320 @@
+#include "batch.h"
+#include "savefile.h"
+#include "search.h"
+
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    gchar *path;
+    gchar *target; // what path is after following links, that file is the one replaced
+    gsize size;
+    guint matches;
+    gchar *error;
+} BatchFile;
+
+typedef struct {
+    SearchPattern *pattern;
+    const gchar *replacement; // NULL to only count matches
+    GArray *files;            // BatchFile
+    gint next_file;           // taken by workers one at a time
+} BatchRun;
+
+static void add_file(GArray *files, const gchar *path) {
+    BatchFile file = {};
+    file.path = g_strdup(path);
+
+    gchar *target = realpath(path, NULL);
+    file.target = g_strdup(target ? target : path);
+    free(target);
+
+    g_array_append_val(files, file);
+}
+
+// every regular file under path, skipping hidden ones & not following links into directories
+static gboolean collect_files(GArray *files, const gchar *path, gboolean top) {
+    if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
+        if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+            add_file(files, path);
+            return TRUE;
+        }
+
+        g_printerr("%s: no such file\n", path);
+        return FALSE;
+    }
+
+    if (!top && g_file_test(path, G_FILE_TEST_IS_SYMLINK)) return TRUE;
+
+    GError *error = NULL;
+    GDir *dir = g_dir_open(path, 0, &error);
+
+    if (!dir) {
+        g_printerr("%s: %s\n", path, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    gboolean ok = TRUE;
+    const gchar *name;
+
+    while ((name = g_dir_read_name(dir))) {
+        if (name[0] == '.') continue;
+
+        gchar *child = g_build_filename(path, name, NULL);
+        if (g_file_test(child, G_FILE_TEST_IS_DIR)) {
+            ok &= collect_files(files, child, FALSE);
+        } else if (g_file_test(child, G_FILE_TEST_IS_REGULAR)) {
+            add_file(files, child);
+        }
+        g_free(child);
+    }
+
+    g_dir_close(dir);
+    return ok;
+}
+
+// written next to the file & renamed over it, so it's never left half replaced
+static gboolean replace_file(const gchar *target, const gchar *text, gsize len, GError **error) {
+    SaveFile save;
+
+    if (!save_file_open(&save, target, error))
+        return FALSE;
+
+    if (!save_file_write(&save, text, len, error)) {
+        save_file_abort(&save);
+        return FALSE;
+    }
+
+    return save_file_commit(&save, TRUE, error);
+}
+
+// find the matches in one file, and swap them out if replacing
+static void process_file(BatchRun *run, BatchFile *file) {
+    GError *error = NULL;
+    GMappedFile *mapped = g_mapped_file_new(file->path, FALSE, &error);
+
+    if (!mapped) {
+        file->error = g_strdup(error->message);
+        g_error_free(error);
+        return;
+    }
+
+    const gchar *text = g_mapped_file_get_contents(mapped);
+    gsize len = g_mapped_file_get_length(mapped);
+    file->size = len;
+
+    if (len == 0 || memchr(text, '\0', MIN(len, BATCH_BINARY_CHECK_SIZE))) {
+        g_mapped_file_unref(mapped);
+        return;
+    }
+
+    GArray *ranges = g_array_new(FALSE, FALSE, sizeof(gsize));
+    search_pattern_find_all(run->pattern, text, len, ranges, &error);
+
+    // e.g. a regex over text that isn't utf-8, half the matches aren't worth replacing
+    if (error) {
+        file->error = g_strdup(error->message);
+        g_error_free(error);
+        g_array_free(ranges, TRUE);
+        g_mapped_file_unref(mapped);
+        return;
+    }
+
+    file->matches = ranges->len / 2;
+
+    if (run->replacement && file->matches > 0) {
+        GString *result = search_replace_ranges(run->pattern, text, len, ranges, run->replacement, NULL);
+
+        // through links, replacing a link would turn it into a copy
+        if (!replace_file(file->target, result->str, result->len, &error)) {
+            file->error = g_strdup(error->message);
+            g_error_free(error);
+        }
+
+        g_string_free(result, TRUE);
+    }
+
+    g_array_free(ranges, TRUE);
+    g_mapped_file_unref(mapped);
+}
+
+// workers take the next file until there are none left, so a thread stuck on
+// a big file doesn't hold up the rest, they just go to whoever is free
+static gpointer batch_worker(gpointer data) {
+    BatchRun *run = (BatchRun *)data;
+
+    while (TRUE) {
+        guint i = g_atomic_int_add(&run->next_file, 1);
+        if (i >= run->files->len) break;
+
+        process_file(run, &g_array_index(run->files, BatchFile, i));
+    }
+
+    return NULL;
+}
+
+// biggest first, so the last file started isn't a huge one
+static gint compare_file_size(gconstpointer a, gconstpointer b) {
+    gsize size_a = ((const BatchFile *)a)->size;
+    gsize size_b = ((const BatchFile *)b)->size;
+    return size_a < size_b ? 1 : size_a > size_b ? -1 : 0;
+}
+
+static gint compare_file_path(gconstpointer a, gconstpointer b) {
+    return strcmp((*(BatchFile *const *)a)->path, (*(BatchFile *const *)b)->path);
+}
+
+gboolean batch_requested(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--find") == 0 || g_str_has_prefix(argv[i], "--find=")) return TRUE;
+    }
+
+    return FALSE;
+}
+
+int batch_main(int argc, char *argv[]) {
+    gchar *find = NULL;
+    gchar *replacement = NULL;
+    gboolean ignore_case = FALSE;
+    gboolean regex = FALSE;
+    gint jobs = g_get_num_processors();
+    gchar **paths = NULL;
+
+    GOptionEntry entries[] = {
+        { "find", 0, 0, G_OPTION_ARG_STRING, &find, "Text to search for", "TEXT" },
+        { "replace", 0, 0, G_OPTION_ARG_STRING, &replacement, "Replace every match with TEXT", "TEXT" },
+        { "ignore-case", 'i', 0, G_OPTION_ARG_NONE, &ignore_case, "Match regardless of case", NULL },
+        { "regex", 0, 0, G_OPTION_ARG_NONE, &regex, "Treat the search text as a regular expression", NULL },
+        { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Files to work on at once", "N" },
+        { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &paths, NULL, "FILE|DIRECTORY..." },
+        { NULL }
+    };
+
+    GOptionContext *context = g_option_context_new("- find & replace in files without the editor");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    GError *error = NULL;
+    gboolean parsed = g_option_context_parse(context, &argc, &argv, &error);
+    g_option_context_free(context);
+
+    if (!parsed || !find || !*find || !paths) {
+        g_printerr("%s\n", error ? error->message : "usage: notebook --find TEXT [--replace TEXT] [-i] [--regex] FILE|DIRECTORY...");
+        if (error) g_error_free(error);
+        return 2;
+    }
+
+    SearchPattern *pattern;
+
+    if (regex) {
+        pattern = search_pattern_new_regex(find, !ignore_case, &error);
+        if (!pattern) {
+            g_printerr("%s\n", error->message);
+            g_error_free(error);
+            return 2;
+        }
+    } else {
+        pattern = search_pattern_new(find, !ignore_case);
+    }
+
+    BatchRun run = {};
+    run.pattern = pattern;
+    run.replacement = replacement;
+    run.files = g_array_new(FALSE, FALSE, sizeof(BatchFile));
+
+    gboolean ok = TRUE;
+    for (gchar **path = paths; *path; path++)
+        ok &= collect_files(run.files, *path, TRUE);
+
+    // a file reached through more than one link is only done once,
+    // otherwise two workers could be replacing it at the same time
+    GHashTable *targets = g_hash_table_new(g_str_hash, g_str_equal);
+    guint kept = 0;
+
+    for (guint i = 0; i < run.files->len; i++) {
+        BatchFile *file = &g_array_index(run.files, BatchFile, i);
+
+        if (g_hash_table_add(targets, file->target)) {
+            g_array_index(run.files, BatchFile, kept++) = *file;
+        } else {
+            g_free(file->path);
+            g_free(file->target);
+        }
+    }
+
+    g_array_set_size(run.files, kept);
+    g_hash_table_destroy(targets);
+
+    for (guint i = 0; i < run.files->len; i++) {
+        BatchFile *file = &g_array_index(run.files, BatchFile, i);
+        GStatBuf info;
+        if (g_stat(file->path, &info) == 0) file->size = info.st_size;
+    }
+
+    g_array_sort(run.files, compare_file_size);
+
+    gint64 start = g_get_monotonic_time();
+    guint threads = CLAMP(jobs, 1, (gint)MAX(run.files->len, 1));
+    GThread **workers = g_new(GThread *, threads);
+
+    for (guint i = 0; i < threads; i++)
+        workers[i] = g_thread_new("batch", batch_worker, &run);
+
+    for (guint i = 0; i < threads; i++)
+        g_thread_join(workers[i]);
+
+    gdouble seconds = (g_get_monotonic_time() - start) / (gdouble)G_USEC_PER_SEC;
+
+    // results in path order, whichever order the files were done in
+    GPtrArray *order = g_ptr_array_new();
+    for (guint i = 0; i < run.files->len; i++)
+        g_ptr_array_add(order, &g_array_index(run.files, BatchFile, i));
+    g_ptr_array_sort(order, compare_file_path);
+
+    guint64 total_matches = 0, total_bytes = 0;
+    guint matched_files = 0;
+
+    for (guint i = 0; i < order->len; i++) {
+        BatchFile *file = (BatchFile *)order->pdata[i];
+
+        if (file->error) {
+            g_printerr("%s: %s\n", file->path, file->error);
+            ok = FALSE;
+            continue;
+        }
+
+        total_bytes += file->size;
+        if (file->matches == 0) continue;
+
+        g_print("%s: %u %s\n", file->path, file->matches,
+                replacement ? (file->matches == 1 ? "replacement" : "replacements") : (file->matches == 1 ? "match" : "matches"));
+        total_matches += file->matches;
+        matched_files++;
+    }
+
+    gchar *size = g_format_size(total_bytes);
+    gchar *rate = g_format_size(seconds > 0 ? total_bytes / seconds : total_bytes);
+    g_print("%" G_GUINT64_FORMAT " %s in %u of %u files, %s in %.2fs (%s/s, %u threads)\n",
+            total_matches, replacement ? "replacements" : "matches", matched_files, run.files->len,
+            size, seconds, rate, threads);
+    g_free(size);
+    g_free(rate);
+
+    for (guint i = 0; i < run.files->len; i++) {
+        BatchFile *file = &g_array_index(run.files, BatchFile, i);
+        g_free(file->path);
+        g_free(file->target);
+        g_free(file->error);
+    }
+
+    g_ptr_array_free(order, TRUE);
+    g_array_free(run.files, TRUE);
+    g_free(workers);
+    search_pattern_free(pattern);
+    g_strfreev(paths);
+    g_free(find);
+    g_free(replacement);
+
+    if (!ok) return 2;
+    return total_matches > 0 ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+#ifndef NOTEBOOK_BATCH_H
+#define NOTEBOOK_BATCH_H
+
+#include <glib.h>
+
+// headless find & replace over many files, run instead of the ui when notebook
+// is started with --find, e.g.
+//   notebook --find foo --replace bar --ignore-case src/ README.md
+// files are shared out between worker threads using the same search core as the
+// editor, and replaced files are written to a temp file that then takes their place
+// (for links, the file they point to, so the link stays a link)
+
+// when a file counts as binary and is skipped, same as grep: a nul in its start
+#define BATCH_BINARY_CHECK_SIZE 8192
+
+gboolean batch_requested(int argc, char *argv[]);
+
+// the exit status, 0 if anything matched, 1 if nothing did, 2 on errors
+int batch_main(int argc, char *argv[]);
+
+#endif
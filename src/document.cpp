@@ -0,0 +1,592 @@
+#include "document.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct DocPiece {
+    gint ref_count;
+    guint32 priority;
+    DocPiece *left;
+    DocPiece *right;
+    GBytes *block;
+    const gchar *text;
+    gsize len;
+    gsize chars;
+    gsize newlines;       // counted as if the piece stood alone
+    gsize total_len;      // this piece & everything under it
+    gsize total_chars;
+    gsize total_newlines;
+    gchar head;           // first & last byte under it, for a \r\n split over two pieces
+    gchar tail;
+};
+
+static gsize total_len(DocPiece *node) {
+    return node ? node->total_len : 0;
+}
+
+static gsize total_chars(DocPiece *node) {
+    return node ? node->total_chars : 0;
+}
+
+static gsize total_newlines(DocPiece *node) {
+    return node ? node->total_newlines : 0;
+}
+
+// a \r at the end of one run & a \n at the start of the next are one break, but both runs counted it
+static gsize joined(gchar before, gchar after) {
+    return before == '\r' && after == '\n';
+}
+
+static gsize count_chars(const gchar *text, gsize len) {
+    gsize chars = 0;
+
+    for (gsize i = 0; i < len; i++)
+        chars += ((guchar)text[i] & 0xC0) != 0x80;
+
+    return chars;
+}
+
+// line breaks are the same as gtk's & the stats': \r, \n, \r\n, U+2028 & U+2029,
+// each one is counted at its last byte
+static gboolean ends_break(const gchar *text, gsize i) {
+    guchar c = text[i];
+
+    if (c == '\r') return TRUE;
+    if (c == '\n') return i == 0 || text[i - 1] != '\r';
+    return (c & 0xFE) == 0xA8 && i >= 2 && (guchar)text[i - 1] == 0x80 && (guchar)text[i - 2] == 0xE2;
+}
+
+// every piece of a loaded file goes through here, so it takes 16 bytes at a time
+static gsize count_newlines(const gchar *text, gsize len) {
+    gsize newlines = 0;
+    gsize i = 0;
+
+#ifdef __SSE2__
+    // the masks of the bytes just before each block, shifted to where they'd land in it
+    guint carry_cr = 0, carry_80 = 0, carry_e2 = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(text + i));
+        guint cr = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')));
+        guint lf = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+
+        newlines += __builtin_popcount(cr) + __builtin_popcount(lf & ~((cr << 1) | carry_cr));
+        carry_cr = cr >> 15;
+
+        // the separators are e2 80 a8 & e2 80 a9, plain ascii can't have them
+        if (_mm_movemask_epi8(bytes) == 0 && (carry_80 | carry_e2) == 0) continue;
+
+        guint e2 = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((gchar)0xE2)));
+        guint x80 = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((gchar)0x80)));
+        guint sep = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(bytes, _mm_set1_epi8((gchar)0xFE)),
+                                                     _mm_set1_epi8((gchar)0xA8)));
+
+        newlines += __builtin_popcount(sep & ((x80 << 1) | carry_80) & ((e2 << 2) | carry_e2));
+        carry_80 = x80 >> 15;
+        carry_e2 = e2 >> 14;
+    }
+#endif
+
+    for (; i < len; i++)
+        newlines += ends_break(text, i);
+
+    return newlines;
+}
+
+// offset just past the nth line break of a piece, counting from 1 the same way as count_newlines,
+// a \r\n inside the piece is passed as a whole
+static gsize find_newline(const gchar *text, gsize len, gsize n) {
+    for (gsize i = 0; i < len; i++) {
+        if (!ends_break(text, i) || --n > 0) continue;
+        return text[i] == '\r' && i + 1 < len && text[i + 1] == '\n' ? i + 2 : i + 1;
+    }
+
+    return len;
+}
+
+// byte offset of a character inside a piece
+static gsize char_to_piece_offset(const gchar *text, gsize len, gsize chars) {
+    for (gsize i = 0; i < len; i++) {
+        if (((guchar)text[i] & 0xC0) == 0x80) continue;
+        if (chars-- == 0) return i;
+    }
+
+    return len;
+}
+
+static DocPiece *piece_ref(DocPiece *node) {
+    if (node) g_atomic_int_inc(&node->ref_count);
+    return node;
+}
+
+static void piece_unref(DocPiece *node) {
+    if (!node || !g_atomic_int_dec_and_test(&node->ref_count)) return;
+
+    piece_unref(node->left);
+    piece_unref(node->right);
+    g_bytes_unref(node->block);
+    g_free(node);
+}
+
+// a node for some text in a block, taking over the references to left & right
+static DocPiece *piece_new(GBytes *block, const gchar *text, gsize len, gsize chars, gsize newlines,
+                           guint32 priority, DocPiece *left, DocPiece *right) {
+    DocPiece *node = g_new(DocPiece, 1);
+    node->ref_count = 1;
+    node->priority = priority;
+    node->left = left;
+    node->right = right;
+    node->block = g_bytes_ref(block);
+    node->text = text;
+    node->len = len;
+    node->chars = chars;
+    node->newlines = newlines;
+    node->total_len = total_len(left) + len + total_len(right);
+    node->total_chars = total_chars(left) + chars + total_chars(right);
+    node->total_newlines = total_newlines(left) + newlines + total_newlines(right);
+    node->head = left ? left->head : text[0];
+    node->tail = right ? right->tail : text[len - 1];
+
+    // a \r\n split between this piece & a neighbour was counted on both sides
+    if (left) node->total_newlines -= joined(left->tail, text[0]);
+    if (right) node->total_newlines -= joined(text[len - 1], right->head);
+    return node;
+}
+
+// same piece with different children
+static DocPiece *piece_copy(DocPiece *node, DocPiece *left, DocPiece *right) {
+    return piece_new(node->block, node->text, node->len, node->chars, node->newlines, node->priority, left, right);
+}
+
+// split a tree into the text before & after a byte offset on a character boundary,
+// the tree itself is left alone
+static void split(DocPiece *node, gsize pos, DocPiece **before, DocPiece **after) {
+    if (!node) {
+        *before = *after = NULL;
+        return;
+    }
+
+    gsize left_len = total_len(node->left);
+    DocPiece *rest;
+
+    if (pos <= left_len) {
+        split(node->left, pos, before, &rest);
+        *after = piece_copy(node, rest, piece_ref(node->right));
+    } else if (pos >= left_len + node->len) {
+        split(node->right, pos - left_len - node->len, &rest, after);
+        *before = piece_copy(node, piece_ref(node->left), rest);
+    } else {
+        // cut the piece itself in two, both halves keep its place in the heap
+        gsize head = pos - left_len;
+        gsize head_chars = count_chars(node->text, head);
+        gsize head_newlines = count_newlines(node->text, head);
+
+        *before = piece_new(node->block, node->text, head, head_chars, head_newlines,
+                            node->priority, piece_ref(node->left), NULL);
+        *after = piece_new(node->block, node->text + head, node->len - head, node->chars - head_chars,
+                           node->newlines - head_newlines + joined(node->text[head - 1], node->text[head]),
+                           node->priority, NULL, piece_ref(node->right));
+    }
+}
+
+// join two trees with all of a before all of b, takes over both references
+static DocPiece *merge(DocPiece *a, DocPiece *b) {
+    if (!a) return b;
+    if (!b) return a;
+
+    DocPiece *node;
+
+    if (a->priority >= b->priority) {
+        node = piece_copy(a, piece_ref(a->left), merge(piece_ref(a->right), b));
+        piece_unref(a);
+    } else {
+        node = piece_copy(b, merge(a, piece_ref(b->left)), piece_ref(b->right));
+        piece_unref(b);
+    }
+
+    return node;
+}
+
+static DocPiece *last_piece(DocPiece *node) {
+    while (node && node->right)
+        node = node->right;
+
+    return node;
+}
+
+// grow the last piece of a tree over text written right after it, takes over the reference
+static DocPiece *extend_last_piece(DocPiece *node, gsize len, gsize chars, gsize newlines) {
+    DocPiece *copy;
+
+    if (node->right) {
+        copy = piece_copy(node, piece_ref(node->left), extend_last_piece(piece_ref(node->right), len, chars, newlines));
+    } else {
+        gsize newlines_after = node->newlines + newlines - joined(node->text[node->len - 1], node->text[node->len]);
+        copy = piece_new(node->block, node->text, node->len + len, node->chars + chars,
+                         newlines_after, node->priority, piece_ref(node->left), NULL);
+    }
+
+    piece_unref(node);
+    return copy;
+}
+
+static gsize char_to_byte(DocPiece *node, gsize chars) {
+    gsize pos = 0;
+
+    while (node) {
+        gsize left_chars = total_chars(node->left);
+
+        if (chars < left_chars) {
+            node = node->left;
+            continue;
+        }
+
+        chars -= left_chars;
+        pos += total_len(node->left);
+
+        if (chars <= node->chars)
+            return pos + char_to_piece_offset(node->text, node->len, chars);
+
+        chars -= node->chars;
+        pos += node->len;
+        node = node->right;
+    }
+
+    return pos;
+}
+
+// copy the bytes in [from, to) of a tree
+static void copy_range(DocPiece *node, gsize from, gsize to, gchar *dest) {
+    while (node && from < to) {
+        gsize left_len = total_len(node->left);
+
+        if (from < left_len) {
+            gsize end = MIN(to, left_len);
+            copy_range(node->left, from, end, dest);
+            dest += end - from;
+            from = end;
+        }
+
+        if (from >= to) return;
+
+        if (from < left_len + node->len) {
+            gsize end = MIN(to, left_len + node->len);
+            memcpy(dest, node->text + (from - left_len), end - from);
+            dest += end - from;
+            from = end;
+        }
+
+        if (from >= to) return;
+
+        from -= left_len + node->len;
+        to -= left_len + node->len;
+        node = node->right;
+    }
+}
+
+static gboolean foreach_piece(DocPiece *node, DocPieceFunc func, gpointer user_data) {
+    if (!node) return TRUE;
+
+    return foreach_piece(node->left, func, user_data)
+        && func(node->text, node->len, user_data)
+        && foreach_piece(node->right, func, user_data);
+}
+
+// same as foreach_piece, for the bytes from from to to only
+static gboolean foreach_piece_range(DocPiece *node, gsize from, gsize to, DocPieceFunc func, gpointer user_data) {
+    if (!node || from >= to) return TRUE;
+
+    gsize left_len = total_len(node->left);
+    gsize piece_end = left_len + node->len;
+
+    if (from < left_len && !foreach_piece_range(node->left, from, MIN(to, left_len), func, user_data))
+        return FALSE;
+
+    if (from < piece_end && to > left_len) {
+        gsize start = MAX(from, left_len);
+        if (!func(node->text + (start - left_len), MIN(to, piece_end) - start, user_data))
+            return FALSE;
+    }
+
+    if (to <= piece_end) return TRUE;
+    return foreach_piece_range(node->right, from > piece_end ? from - piece_end : 0, to - piece_end, func, user_data);
+}
+
+// the piece a byte offset is in (the last one at the very end of the text),
+// with the bytes & characters before it
+static DocPiece *find_piece(DocPiece *node, gsize offset, gsize *start, gsize *chars) {
+    *start = 0;
+    *chars = 0;
+
+    while (node) {
+        gsize left_len = total_len(node->left);
+
+        if (offset < left_len) {
+            node = node->left;
+            continue;
+        }
+
+        offset -= left_len;
+        *start += left_len;
+        *chars += total_chars(node->left);
+
+        if (offset < node->len || !node->right)
+            return node;
+
+        offset -= node->len;
+        *start += node->len;
+        *chars += node->chars;
+        node = node->right;
+    }
+
+    return NULL;
+}
+
+// blocks are only ever appended to, bytes already handed out to pieces
+// are never written again so other threads can read them without locking
+static void start_block(Document *doc) {
+    if (doc->block) g_bytes_unref(doc->block);
+
+    doc->block_data = (gchar *)g_malloc(DOC_PIECE_SIZE);
+    doc->block = g_bytes_new_take(doc->block_data, DOC_PIECE_SIZE);
+    doc->block_used = 0;
+}
+
+// copy text into blocks & add it after a tree as pieces, takes over the reference
+static DocPiece *append_text(Document *doc, DocPiece *tree, const gchar *text, gsize len) {
+    while (len > 0) {
+        gsize room = doc->block ? DOC_PIECE_SIZE - doc->block_used : 0;
+        gsize n = len;
+
+        // only whole characters go in, the rest starts the next block
+        if (n > room) {
+            n = room;
+            while (n > 0 && ((guchar)text[n] & 0xC0) == 0x80)
+                n--;
+        }
+
+        if (n == 0) {
+            start_block(doc);
+            continue;
+        }
+
+        gchar *dest = doc->block_data + doc->block_used;
+        memcpy(dest, text, n);
+        doc->block_used += n;
+
+        gsize chars = count_chars(dest, n);
+        gsize newlines = count_newlines(dest, n);
+        DocPiece *last = last_piece(tree);
+
+        // typing one character after another keeps growing the same piece
+        if (last && last->block == doc->block && last->text + last->len == dest) {
+            tree = extend_last_piece(tree, n, chars, newlines);
+        } else {
+            tree = merge(tree, piece_new(doc->block, dest, n, chars, newlines, g_random_int(), NULL, NULL));
+        }
+
+        text += n;
+        len -= n;
+    }
+
+    return tree;
+}
+
+Document *document_new() {
+    return g_new0(Document, 1);
+}
+
+void document_free(Document *doc) {
+    piece_unref(doc->root);
+    if (doc->block) g_bytes_unref(doc->block);
+    g_free(doc);
+}
+
+void document_insert(Document *doc, gint offset, const gchar *text, gsize len) {
+    if (len == 0) return;
+
+    DocPiece *before, *after;
+    split(doc->root, char_to_byte(doc->root, offset), &before, &after);
+
+    piece_unref(doc->root);
+    doc->root = merge(append_text(doc, before, text, len), after);
+}
+
+void document_delete(Document *doc, gint offset, gint length) {
+    if (length <= 0) return;
+
+    gsize from = char_to_byte(doc->root, offset);
+    gsize to = char_to_byte(doc->root, offset + length);
+    DocPiece *before, *rest, *deleted, *after;
+
+    split(doc->root, from, &before, &rest);
+    split(rest, to - from, &deleted, &after);
+
+    piece_unref(rest);
+    piece_unref(deleted);
+    piece_unref(doc->root);
+    doc->root = merge(before, after);
+}
+
+gchar *document_get_text(Document *doc, gint start, gint end) {
+    gsize from = char_to_byte(doc->root, start);
+    gsize to = char_to_byte(doc->root, MAX(start, end));
+    gchar *text = (gchar *)g_malloc(to - from + 1);
+
+    copy_range(doc->root, from, to, text);
+    text[to - from] = '\0';
+    return text;
+}
+
+gsize document_get_length(Document *doc) {
+    return total_len(doc->root);
+}
+
+gsize document_get_chars(Document *doc) {
+    return total_chars(doc->root);
+}
+
+gsize document_get_lines(Document *doc) {
+    return total_newlines(doc->root) + 1;
+}
+
+gint document_line_start(Document *doc, gsize line) {
+    DocPiece *node = doc->root;
+    gsize chars = 0;
+    gchar prev = 0, next = 0;   // the bytes just before & after the subtree
+
+    if (line == 0) return 0;
+
+    // the line starts right after its line-th break
+    while (node) {
+        gsize left_newlines = node->left ? node->left->total_newlines - joined(prev, node->left->head) : 0;
+
+        if (line <= left_newlines) {
+            next = node->text[0];
+            node = node->left;
+            continue;
+        }
+
+        line -= left_newlines;
+        chars += total_chars(node->left);
+        if (node->left) prev = node->left->tail;
+
+        // a \n finishing the break before the piece is counted in it, but isn't a break here
+        gsize skipped = joined(prev, node->text[0]);
+
+        if (line <= node->newlines - skipped) {
+            gsize end = find_newline(node->text, node->len, line + skipped);
+            gchar after = node->right ? node->right->head : next;
+
+            // a \r ending the piece takes the \n starting the next one with it
+            if (end == node->len && joined(node->text[end - 1], after)) chars++;
+            return chars + count_chars(node->text, end);
+        }
+
+        line -= node->newlines - skipped;
+        chars += node->chars;
+        prev = node->text[node->len - 1];
+        node = node->right;
+    }
+
+    return chars;
+}
+
+gsize document_line_at(Document *doc, gint offset) {
+    DocPiece *node = doc->root;
+    gsize chars = MAX(offset, 0);
+    gsize line = 0;
+    gchar prev = 0;   // the byte just before the subtree
+
+    // the breaks before the offset, whole subtrees at a time
+    while (node) {
+        gsize left_chars = total_chars(node->left);
+
+        if (chars < left_chars) {
+            node = node->left;
+            continue;
+        }
+
+        chars -= left_chars;
+
+        if (node->left) {
+            line += node->left->total_newlines - joined(prev, node->left->head);
+            prev = node->left->tail;
+        }
+
+        if (chars <= node->chars) {
+            gsize bytes = char_to_piece_offset(node->text, node->len, chars);
+            return bytes ? line + count_newlines(node->text, bytes) - joined(prev, node->text[0]) : line;
+        }
+
+        chars -= node->chars;
+        line += node->newlines - joined(prev, node->text[0]);
+        prev = node->text[node->len - 1];
+        node = node->right;
+    }
+
+    return line;
+}
+
+DocSnapshot *document_snapshot(Document *doc) {
+    DocSnapshot *snapshot = g_new(DocSnapshot, 1);
+    snapshot->root = piece_ref(doc->root);
+    return snapshot;
+}
+
+void doc_snapshot_free(DocSnapshot *snapshot) {
+    piece_unref(snapshot->root);
+    g_free(snapshot);
+}
+
+gsize doc_snapshot_get_length(DocSnapshot *snapshot) {
+    return total_len(snapshot->root);
+}
+
+gboolean doc_snapshot_foreach(DocSnapshot *snapshot, DocPieceFunc func, gpointer user_data) {
+    return foreach_piece(snapshot->root, func, user_data);
+}
+
+gboolean doc_snapshot_foreach_range(DocSnapshot *snapshot, gsize from, gsize to, DocPieceFunc func, gpointer user_data) {
+    return foreach_piece_range(snapshot->root, from, MIN(to, total_len(snapshot->root)), func, user_data);
+}
+
+void doc_snapshot_copy(DocSnapshot *snapshot, gsize from, gsize to, gchar *dest) {
+    copy_range(snapshot->root, from, to, dest);
+}
+
+void doc_snapshot_to_char_offsets(DocSnapshot *snapshot, GArray *offsets) {
+    DocPiece *piece = NULL;
+    gsize start = 0;
+    gsize byte_pos = 0;
+    gsize char_pos = 0;
+
+    for (guint i = 0; i < offsets->len; i++) {
+        gsize offset = g_array_index(offsets, gsize, i);
+
+        // sorted offsets mostly land in the piece the one before was in
+        if (!piece || offset < byte_pos || offset > start + piece->len) {
+            piece = find_piece(snapshot->root, offset, &start, &char_pos);
+            byte_pos = start;
+        }
+
+        if (piece) {
+            char_pos += count_chars(piece->text + (byte_pos - start), offset - byte_pos);
+            byte_pos = offset;
+        }
+
+        g_array_index(offsets, gsize, i) = char_pos;
+    }
+}
+
+GBytes *doc_snapshot_flatten(DocSnapshot *snapshot) {
+    gsize len = total_len(snapshot->root);
+    gchar *text = (gchar *)g_malloc(len + 1);
+
+    copy_range(snapshot->root, 0, len, text);
+    text[len] = '\0';
+    return g_bytes_new_take(text, len);
+}
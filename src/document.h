@@ -0,0 +1,79 @@
+#ifndef NOTEBOOK_DOCUMENT_H
+#define NOTEBOOK_DOCUMENT_H
+
+#include <glib.h>
+
+// piece table holding the document's text
+// text is kept in refcounted blocks that never change once written, and the
+// document is a treap of pieces pointing into them where every node knows the
+// bytes, characters & line breaks under it, so edits & lookups are O(log n)
+//
+// nodes are never modified either, an edit copies the path it walks instead,
+// so a snapshot is just a reference to the root that worker threads can read
+// while the document keeps changing on the main thread
+//
+// it isn't what the view is drawn from, the GtkTextBuffer keeps its own copy &
+// the buffer's insert & delete handlers apply every edit here too, so an open file
+// is held twice: once in gtk's btree & once here, at about its size in bytes plus
+// a node per piece (blocks stay whole while any piece or snapshot points into them)
+// what that buys is a copy of the text that can be read off the main thread &
+// snapshotted for free, for searching, saving & the journal
+
+// blocks are this big and no piece is bigger, so scanning inside one stays cheap
+#define DOC_PIECE_SIZE (64 * 1024)
+
+typedef struct DocPiece DocPiece;
+
+typedef struct {
+    DocPiece *root;
+    GBytes *block;    // block new text is appended to
+    gchar *block_data;
+    gsize block_used;
+} Document;
+
+typedef struct {
+    DocPiece *root;
+} DocSnapshot;
+
+// called for every piece in order, return FALSE to stop
+typedef gboolean (*DocPieceFunc)(const gchar *text, gsize len, gpointer user_data);
+
+Document *document_new();
+void document_free(Document *doc);
+
+// offsets & lengths are in characters, same as GtkTextIter offsets
+void document_insert(Document *doc, gint offset, const gchar *text, gsize len);
+void document_delete(Document *doc, gint offset, gint length);
+gchar *document_get_text(Document *doc, gint start, gint end);
+
+gsize document_get_length(Document *doc);
+gsize document_get_chars(Document *doc);
+gsize document_get_lines(Document *doc);
+
+// the line breaks every node counts double as the line index, lines from 0,
+// they're gtk's breaks: \r, \n, \r\n, U+2028 & U+2029, same as the stats
+// where a line starts, past the last line is the end of the text
+gint document_line_start(Document *doc, gsize line);
+// line a character offset is on
+gsize document_line_at(Document *doc, gint offset);
+
+DocSnapshot *document_snapshot(Document *doc);
+void doc_snapshot_free(DocSnapshot *snapshot);
+gsize doc_snapshot_get_length(DocSnapshot *snapshot);
+
+// FALSE if func stopped early
+gboolean doc_snapshot_foreach(DocSnapshot *snapshot, DocPieceFunc func, gpointer user_data);
+
+// same for the bytes from from to to, pieces at the ends are cut short
+gboolean doc_snapshot_foreach_range(DocSnapshot *snapshot, gsize from, gsize to, DocPieceFunc func, gpointer user_data);
+
+// copy the bytes from from to to into dest
+void doc_snapshot_copy(DocSnapshot *snapshot, gsize from, gsize to, gchar *dest);
+
+// turn sorted byte offsets into character offsets in place
+void doc_snapshot_to_char_offsets(DocSnapshot *snapshot, GArray *offsets);
+
+// the whole text as one string, for code that needs it contiguous
+GBytes *doc_snapshot_flatten(DocSnapshot *snapshot);
+
+#endif
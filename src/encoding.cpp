@@ -0,0 +1,478 @@
+#include "encoding.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// the block validator needs ssse3 shuffles, it's built for them on its own
+// & only used when the cpu has them, so the rest still runs anywhere
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UTF8_SSSE3
+#include <tmmintrin.h>
+#endif
+
+// what cp1252 puts in 0x80 - 0x9f, the gaps stay the latin-1 control characters
+static const gunichar cp1252_high[32] = {
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+};
+
+// how far the ascii at the start of text goes, stopping at a nul too
+static gsize ascii_prefix(const guchar *p, gsize len) {
+    gsize i = 0;
+
+#ifdef __SSE2__
+    // bytes that are <= 0 as signed are exactly nul & everything >= 0x80
+    const __m128i one = _mm_set1_epi8(1);
+
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_cmpgt_epi8(one, _mm_loadu_si128((const __m128i *)(p + i)));
+        __m128i b = _mm_cmpgt_epi8(one, _mm_loadu_si128((const __m128i *)(p + i + 16)));
+        __m128i c = _mm_cmpgt_epi8(one, _mm_loadu_si128((const __m128i *)(p + i + 32)));
+        __m128i d = _mm_cmpgt_epi8(one, _mm_loadu_si128((const __m128i *)(p + i + 48)));
+
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)))) break;
+    }
+
+    for (; i + 16 <= len; i += 16) {
+        gint mask = _mm_movemask_epi8(_mm_cmpgt_epi8(one, _mm_loadu_si128((const __m128i *)(p + i))));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#else
+    // eight bytes at a time, looking for a high bit or a zero byte
+    for (; i + 8 <= len; i += 8) {
+        guint64 word;
+        memcpy(&word, p + i, 8);
+
+        guint64 high = word & G_GUINT64_CONSTANT(0x8080808080808080);
+        guint64 zero = (word - G_GUINT64_CONSTANT(0x0101010101010101)) & ~word & G_GUINT64_CONSTANT(0x8080808080808080);
+        if (high | zero) break;
+    }
+#endif
+
+    while (i < len && p[i] > 0 && p[i] < 0x80)
+        i++;
+
+    return i;
+}
+
+// length of the utf-8 sequence at p, 0 if it isn't valid,
+// -1 if it would be but len runs out first
+static gint utf8_sequence(const guchar *p, gsize len) {
+    guchar c = p[0];
+    guchar low = 0x80, high = 0xBF;
+    gint needed;
+
+    if (c < 0x80) return c ? 1 : 0;
+    if (c < 0xC2) return 0;
+
+    if (c < 0xE0) {
+        needed = 2;
+    } else if (c < 0xF0) {
+        needed = 3;
+        // no overlong forms & no surrogates
+        if (c == 0xE0) low = 0xA0;
+        if (c == 0xED) high = 0x9F;
+    } else if (c < 0xF5) {
+        needed = 4;
+        // no overlong forms & nothing past U+10FFFF
+        if (c == 0xF0) low = 0x90;
+        if (c == 0xF4) high = 0x8F;
+    } else {
+        return 0;
+    }
+
+    for (gint i = 1; i < needed; i++) {
+        if ((gsize)i >= len) return -1;
+        if (p[i] < low || p[i] > high) return 0;
+
+        low = 0x80;
+        high = 0xBF;
+    }
+
+    return needed;
+}
+
+#ifdef UTF8_SSSE3
+// errors a pair of bytes can show, looked up from the high & low nibble of the
+// first and the high nibble of the second, only a real error has a bit in all three
+// (the lookup validator from Keiser & Lemire, "Validating UTF-8 In Less Than One
+// Instruction Per Byte")
+#define UTF8_TOO_SHORT      (1 << 0) // lead or ascii, then lead or ascii after a lead
+#define UTF8_TOO_LONG       (1 << 1) // ascii, then a continuation
+#define UTF8_OVERLONG_3     (1 << 2) // e0, then 80 - 9f
+#define UTF8_TOO_LARGE      (1 << 3) // f4, then 90 - bf, or f5 & up
+#define UTF8_SURROGATE      (1 << 4) // ed, then a0 - bf
+#define UTF8_OVERLONG_2     (1 << 5) // c0 or c1
+#define UTF8_TOO_LARGE_1000 (1 << 6) // f5 & up, then 80 - 8f
+#define UTF8_OVERLONG_4     (1 << 6) // f0, then 80 - 8f
+#define UTF8_TWO_CONTS      (1 << 7) // a continuation after a continuation
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static inline __m128i high_nibbles(__m128i bytes) {
+    return _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0F));
+}
+
+// the bits of every error in a block, given the block before it
+__attribute__((target("ssse3")))
+static inline __m128i utf8_block_errors(__m128i input, __m128i prev_input) {
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+
+    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(_mm_shuffle_epi8(byte_1_high_table, high_nibbles(prev1)),
+                      _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, _mm_set1_epi8(0x0F)))),
+        _mm_shuffle_epi8(byte_2_high_table, high_nibbles(input)));
+
+    // the third & fourth bytes of a character are two continuations in a row,
+    // which is only an error anywhere else
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+    __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must_continue = _mm_and_si128(_mm_or_si128(is_third, is_fourth), _mm_set1_epi8((char)0x80));
+
+    // & nul doesn't count as valid
+    __m128i nul = _mm_cmpeq_epi8(input, _mm_setzero_si128());
+
+    return _mm_or_si128(_mm_xor_si128(must_continue, special), nul);
+}
+
+// how far text is valid a block at a time, up to the first block with an error
+// the result is on a character boundary, anything from it on still has to be checked
+__attribute__((target("ssse3")))
+static gsize utf8_valid_blocks(const guchar *p, gsize len) {
+    __m128i prev_input = _mm_setzero_si128();
+    gsize i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i errors = utf8_block_errors(input, prev_input);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(errors, _mm_setzero_si128())) != 0xFFFF) break;
+        prev_input = input;
+    }
+
+    // back up to the start of a character running into the next block
+    for (gsize back = 1; back <= 3 && back <= i; back++) {
+        guchar c = p[i - back];
+        if ((c & 0xC0) == 0x80) continue;
+
+        gsize needed = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        if (needed > back) return i - back;
+        break;
+    }
+
+    return i;
+}
+#endif
+
+gsize utf8_valid_len(const gchar *text, gsize len) {
+    const guchar *p = (const guchar *)text;
+    gsize i = 0;
+
+#ifdef UTF8_SSSE3
+    if (__builtin_cpu_supports("ssse3"))
+        i = utf8_valid_blocks(p, len);
+#endif
+
+    // whatever the blocks left, byte by byte
+    while (i < len) {
+        i += ascii_prefix(p + i, len - i);
+
+        // stay out of the block loop while the text isn't ascii
+        while (i < len && p[i] >= 0x80) {
+            gint n = utf8_sequence(p + i, len - i);
+            if (n <= 0) return i;
+            i += n;
+        }
+
+        if (i < len && p[i] == 0) return i;
+    }
+
+    return i;
+}
+
+TextEncoding text_encoding_sniff(const gchar *data, gsize len, gsize *bom_len) {
+    const guchar *p = (const guchar *)data;
+    *bom_len = 0;
+
+    if (len >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) {
+        *bom_len = 3;
+        return TEXT_ENCODING_UTF8;
+    }
+
+    if (len >= 2 && p[0] == 0xFF && p[1] == 0xFE) {
+        *bom_len = 2;
+        return TEXT_ENCODING_UTF16LE;
+    }
+
+    if (len >= 2 && p[0] == 0xFE && p[1] == 0xFF) {
+        *bom_len = 2;
+        return TEXT_ENCODING_UTF16BE;
+    }
+
+    // no bom, but utf-16 of mostly ascii text has a zero in every other byte
+    // and hardly any in between, which binary files don't tend to
+    gsize units = MIN(len, ENCODING_SNIFF_SIZE) / 2;
+    gsize even = 0, odd = 0;
+
+    for (gsize i = 0; i < units; i++) {
+        even += p[2 * i] == 0;
+        odd += p[2 * i + 1] == 0;
+    }
+
+    if (units >= 2 && odd >= units * 3 / 4 && even <= units / 20) return TEXT_ENCODING_UTF16LE;
+    if (units >= 2 && even >= units * 3 / 4 && odd <= units / 20) return TEXT_ENCODING_UTF16BE;
+
+    return TEXT_ENCODING_UTF8;
+}
+
+void text_decoder_init(TextDecoder *decoder) {
+    memset(decoder, 0, sizeof(TextDecoder));
+}
+
+static void keep_tail(TextDecoder *decoder, const guchar *data, gsize len) {
+    memcpy(decoder->tail, data, len);
+    decoder->tail_len = len;
+}
+
+static void append_cp1252(GString *out, guchar c) {
+    if (c == 0) {
+        g_string_append_unichar(out, 0xFFFD);
+    } else if (c >= 0x80 && c < 0xA0) {
+        g_string_append_unichar(out, cp1252_high[c - 0x80]);
+    } else {
+        g_string_append_unichar(out, c);
+    }
+}
+
+// valid runs are copied as they are & each byte in between converted on its own,
+// unless final a character cut off at the end is kept for the next chunk
+static void decode_utf8(TextDecoder *decoder, const guchar *data, gsize len, gboolean final,
+                        DecodedTextFunc func, gpointer user_data) {
+    gsize valid = utf8_valid_len((const gchar *)data, len);
+
+    // the usual case, handed on without copying
+    if (valid == len || (!final && utf8_sequence(data + valid, len - valid) < 0)) {
+        if (valid > 0) func((const gchar *)data, valid, user_data);
+        keep_tail(decoder, data + valid, len - valid);
+        return;
+    }
+
+    GString *out = g_string_sized_new(len + len / 2);
+    gsize pos = 0;
+
+    decoder->converted = TRUE;
+
+    while (TRUE) {
+        g_string_append_len(out, (const gchar *)data + pos, valid);
+        pos += valid;
+
+        if (pos == len) break;
+
+        if (!final && utf8_sequence(data + pos, len - pos) < 0) {
+            keep_tail(decoder, data + pos, len - pos);
+            break;
+        }
+
+        append_cp1252(out, data[pos++]);
+        valid = utf8_valid_len((const gchar *)data + pos, len - pos);
+    }
+
+    if (out->len > 0) func(out->str, out->len, user_data);
+    g_string_free(out, TRUE);
+}
+
+static gunichar utf16_unit(const guchar *p, gboolean big_endian) {
+    return big_endian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+// unpaired surrogates & nul become U+FFFD
+static void decode_utf16(TextDecoder *decoder, const guchar *data, gsize len, gboolean final,
+                         DecodedTextFunc func, gpointer user_data) {
+    gboolean big_endian = decoder->encoding == TEXT_ENCODING_UTF16BE;
+    guchar *joined = NULL;
+
+    // it all gets converted anyway, so the carry over just goes in front
+    if (decoder->tail_len > 0) {
+        joined = (guchar *)g_malloc(decoder->tail_len + len);
+        memcpy(joined, decoder->tail, decoder->tail_len);
+        memcpy(joined + decoder->tail_len, data, len);
+
+        data = joined;
+        len += decoder->tail_len;
+        decoder->tail_len = 0;
+    }
+
+    // at most 3 bytes of utf-8 for every unit, & one more U+FFFD for an odd byte
+    gchar *out = (gchar *)g_malloc(len / 2 * 3 + 3);
+    gsize out_len = 0;
+    gsize pos = 0;
+
+    while (len - pos >= 2) {
+        gunichar c = utf16_unit(data + pos, big_endian);
+
+        if (c >= 0xD800 && c < 0xDC00) {
+            if (len - pos < 4 && !final) break;
+
+            gunichar low = len - pos >= 4 ? utf16_unit(data + pos + 2, big_endian) : 0;
+
+            if (low >= 0xDC00 && low < 0xE000) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                pos += 4;
+            } else {
+                c = 0xFFFD;
+                pos += 2;
+            }
+        } else {
+            if (c == 0 || (c >= 0xDC00 && c < 0xE000)) c = 0xFFFD;
+            pos += 2;
+        }
+
+        out_len += g_unichar_to_utf8(c, out + out_len);
+    }
+
+    if (pos < len) {
+        if (final) {
+            out_len += g_unichar_to_utf8(0xFFFD, out + out_len);
+        } else {
+            keep_tail(decoder, data + pos, len - pos);
+        }
+    }
+
+    if (out_len > 0) func(out, out_len, user_data);
+
+    g_free(out);
+    g_free(joined);
+}
+
+// sniff the encoding from the start of the input, returns the length of the bom to skip
+static gsize start_decoding(TextDecoder *decoder, const guchar *data, gsize len) {
+    gsize bom_len;
+    decoder->encoding = text_encoding_sniff((const gchar *)data, len, &bom_len);
+
+    // the bom isn't part of the text, & utf-16 is saved back as utf-8
+    decoder->converted = bom_len > 0 || decoder->encoding != TEXT_ENCODING_UTF8;
+    return bom_len;
+}
+
+void text_decoder_feed(TextDecoder *decoder, const gchar *data, gsize len, DecodedTextFunc func, gpointer user_data) {
+    const guchar *p = (const guchar *)data;
+
+    if (len == 0) return;
+
+    if (decoder->encoding == TEXT_ENCODING_UNKNOWN) {
+        // not enough to go on yet, only happens with tiny reads
+        if (decoder->tail_len + len < sizeof(decoder->tail)) {
+            memcpy(decoder->tail + decoder->tail_len, data, len);
+            decoder->tail_len += len;
+            return;
+        }
+
+        if (decoder->tail_len > 0) {
+            gsize joined_len = decoder->tail_len + len;
+            guchar *joined = (guchar *)g_malloc(joined_len);
+
+            memcpy(joined, decoder->tail, decoder->tail_len);
+            memcpy(joined + decoder->tail_len, data, len);
+            decoder->tail_len = 0;
+
+            gsize bom_len = start_decoding(decoder, joined, joined_len);
+            text_decoder_feed(decoder, (const gchar *)joined + bom_len, joined_len - bom_len, func, user_data);
+            g_free(joined);
+            return;
+        }
+
+        gsize bom_len = start_decoding(decoder, p, len);
+        p += bom_len;
+        len -= bom_len;
+    }
+
+    if (decoder->encoding != TEXT_ENCODING_UTF8) {
+        decode_utf16(decoder, p, len, FALSE, func, user_data);
+        return;
+    }
+
+    // finish the character split off the end of the last chunk
+    if (decoder->tail_len > 0) {
+        guchar c = decoder->tail[0];
+        gsize needed = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+
+        while (len > 0 && decoder->tail_len < needed && (*p & 0xC0) == 0x80) {
+            decoder->tail[decoder->tail_len++] = *p++;
+            len--;
+        }
+
+        // this chunk was all continuation bytes & it still isn't done
+        if (len == 0 && decoder->tail_len < needed) return;
+
+        guchar character[4];
+        gsize character_len = decoder->tail_len;
+
+        memcpy(character, decoder->tail, character_len);
+        decoder->tail_len = 0;
+        decode_utf8(decoder, character, character_len, TRUE, func, user_data);
+    }
+
+    decode_utf8(decoder, p, len, FALSE, func, user_data);
+}
+
+void text_decoder_finish(TextDecoder *decoder, DecodedTextFunc func, gpointer user_data) {
+    if (decoder->tail_len == 0) return;
+
+    guchar rest[4];
+    gsize rest_len = decoder->tail_len;
+
+    memcpy(rest, decoder->tail, rest_len);
+    decoder->tail_len = 0;
+
+    gsize bom_len = 0;
+    if (decoder->encoding == TEXT_ENCODING_UNKNOWN)
+        bom_len = start_decoding(decoder, rest, rest_len);
+
+    if (decoder->encoding == TEXT_ENCODING_UTF8) {
+        decode_utf8(decoder, rest + bom_len, rest_len - bom_len, TRUE, func, user_data);
+    } else {
+        decode_utf16(decoder, rest + bom_len, rest_len - bom_len, TRUE, func, user_data);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef NOTEBOOK_ENCODING_H
+#define NOTEBOOK_ENCODING_H
+
+#include <glib.h>
+
+// turning file contents into the utf-8 a text buffer needs, independent from GTK
+// the encoding is sniffed from the start of the file, a byte order mark or the
+// zeros utf-16 leaves all over ascii text. utf-8 is validated a block at a time
+// and handed on as is, only bytes that aren't valid utf-8 get converted (as
+// cp1252, which covers latin-1) so a file with a few stray bytes still opens
+
+// how much of the start of a file is looked at for utf-16 without a bom
+#define ENCODING_SNIFF_SIZE 4096
+
+typedef enum {
+    TEXT_ENCODING_UNKNOWN, // not sniffed yet
+    TEXT_ENCODING_UTF8,
+    TEXT_ENCODING_UTF16LE,
+    TEXT_ENCODING_UTF16BE
+} TextEncoding;
+
+typedef struct {
+    TextEncoding encoding;
+    gboolean converted; // the text isn't byte for byte what was fed in
+    guchar tail[4];     // start of a character split across chunks
+    gsize tail_len;
+} TextDecoder;
+
+// gets valid utf-8, possibly in several pieces per chunk
+typedef void (*DecodedTextFunc)(const gchar *text, gsize len, gpointer user_data);
+
+void text_decoder_init(TextDecoder *decoder);
+
+// decode the next chunk of input, the first one decides the encoding
+void text_decoder_feed(TextDecoder *decoder, const gchar *data, gsize len, DecodedTextFunc func, gpointer user_data);
+
+// end of input, a character left unfinished is converted as it is
+void text_decoder_finish(TextDecoder *decoder, DecodedTextFunc func, gpointer user_data);
+
+// bom_len is set to the length of the byte order mark to skip, if there is one
+TextEncoding text_encoding_sniff(const gchar *data, gsize len, gsize *bom_len);
+
+// length of the valid utf-8 at the start of text, nul bytes don't count as valid
+// since a text buffer won't take them either
+gsize utf8_valid_len(const gchar *text, gsize len);
+
+#endif
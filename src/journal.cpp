@@ -0,0 +1,461 @@
+#include "journal.h"
+#include "encoding.h"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// file layout: the magic, then records of
+//   type (1 byte), offset (8), length (8), payload size (8), payload, check (4)
+// all little endian, the check is fnv-1a over everything before it in the record
+// so a record torn by a crash is spotted and replay stops there
+#define JOURNAL_MAGIC "NBJ1"
+#define JOURNAL_MAGIC_SIZE 4
+#define JOURNAL_HEADER_SIZE 25
+#define JOURNAL_CHECK_SIZE 4
+#define JOURNAL_CHUNK_SIZE (1024 * 1024)
+
+// never worth compacting below this much
+#define JOURNAL_CHECKPOINT_MIN (4 * 1024 * 1024)
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+enum {
+    RECORD_BASE_EMPTY = 'E',
+    RECORD_BASE_FILE = 'H', // length is the file's size, payload its sha-256 then its path
+    RECORD_BASE_TEXT = 'T', // payload is the whole text
+    RECORD_INSERT = 'i',    // payload is the inserted text
+    RECORD_DELETE = 'd',    // length is in characters
+};
+
+typedef struct {
+    GByteArray *records;   // edits to append, or the base record to start over from
+    DocSnapshot *snapshot; // or a checkpoint to start over from
+    gboolean reset;
+    EditJournalWrittenFunc written; // or just to say everything before it is written
+    gpointer user_data;
+} JournalTask;
+
+typedef struct {
+    EditJournalWrittenFunc func;
+    gpointer user_data;
+    gboolean intact;
+} JournalWritten;
+
+typedef struct {
+    gint fd;
+    GByteArray *chunk;
+    guint32 check;
+} CheckpointWriter;
+
+static guint32 fnv1a(guint32 hash, const void *data, gsize len) {
+    const guint8 *p = (const guint8 *)data;
+
+    for (gsize i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static void put_uint(guint8 *p, guint64 value, guint size) {
+    for (guint i = 0; i < size; i++)
+        p[i] = (guint8)(value >> (8 * i));
+}
+
+static guint64 get_uint(const guint8 *p, guint size) {
+    guint64 value = 0;
+
+    for (guint i = 0; i < size; i++)
+        value |= (guint64)p[i] << (8 * i);
+
+    return value;
+}
+
+static void encode_header(guint8 *header, guint8 type, guint64 offset, guint64 length, guint64 payload_len) {
+    header[0] = type;
+    put_uint(header + 1, offset, 8);
+    put_uint(header + 9, length, 8);
+    put_uint(header + 17, payload_len, 8);
+}
+
+static void append_record(GByteArray *out, guint8 type, guint64 offset, guint64 length, const gchar *payload, gsize payload_len) {
+    guint8 header[JOURNAL_HEADER_SIZE];
+    guint8 check[JOURNAL_CHECK_SIZE];
+
+    encode_header(header, type, offset, length, payload_len);
+    put_uint(check, fnv1a(fnv1a(FNV_OFFSET, header, sizeof(header)), payload, payload_len), JOURNAL_CHECK_SIZE);
+
+    g_byte_array_append(out, header, sizeof(header));
+    g_byte_array_append(out, (const guint8 *)payload, payload_len);
+    g_byte_array_append(out, check, sizeof(check));
+}
+
+static gboolean write_all(gint fd, const void *data, gsize len) {
+    const gchar *p = (const gchar *)data;
+
+    while (len > 0) {
+        gssize n = write(fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return FALSE;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+// writer thread
+static gboolean write_checkpoint_piece(const gchar *text, gsize len, gpointer user_data) {
+    CheckpointWriter *writer = (CheckpointWriter *)user_data;
+
+    writer->check = fnv1a(writer->check, text, len);
+    g_byte_array_append(writer->chunk, (const guint8 *)text, len);
+
+    if (writer->chunk->len < JOURNAL_CHUNK_SIZE)
+        return TRUE;
+
+    gboolean ok = write_all(writer->fd, writer->chunk->data, writer->chunk->len);
+    g_byte_array_set_size(writer->chunk, 0);
+    return ok;
+}
+
+// writer thread, the whole text as one record streamed a chunk at a time
+static gboolean write_checkpoint(gint fd, DocSnapshot *snapshot) {
+    guint8 header[JOURNAL_HEADER_SIZE];
+    guint8 check[JOURNAL_CHECK_SIZE];
+    gsize len = doc_snapshot_get_length(snapshot);
+    CheckpointWriter writer = { fd, g_byte_array_sized_new(JOURNAL_CHUNK_SIZE), 0 };
+
+    encode_header(header, RECORD_BASE_TEXT, 0, len, len);
+    writer.check = fnv1a(FNV_OFFSET, header, sizeof(header));
+
+    gboolean ok = write_all(fd, header, sizeof(header))
+        && doc_snapshot_foreach(snapshot, write_checkpoint_piece, &writer)
+        && write_all(fd, writer.chunk->data, writer.chunk->len);
+
+    put_uint(check, writer.check, JOURNAL_CHECK_SIZE);
+    ok = ok && write_all(fd, check, sizeof(check));
+
+    g_byte_array_free(writer.chunk, TRUE);
+    return ok;
+}
+
+// writer thread, the new journal is written next to the old one and renamed over it
+// so a crash part way through still leaves one of them whole
+static void start_over(EditJournal *journal, JournalTask *task) {
+    gchar *temp = g_strconcat(journal->path, ".new", NULL);
+    gint fd = g_open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    gboolean ok = fd >= 0 && write_all(fd, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE);
+
+    if (ok && task->snapshot) {
+        ok = write_checkpoint(fd, task->snapshot);
+    } else if (ok) {
+        ok = write_all(fd, task->records->data, task->records->len);
+    }
+
+    ok = ok && fdatasync(fd) == 0 && g_rename(temp, journal->path) == 0;
+
+    if (journal->fd >= 0)
+        close(journal->fd);
+
+    // better no journal than an old one that would bring back the wrong text
+    if (!ok) {
+        if (fd >= 0) close(fd);
+        g_unlink(temp);
+        g_unlink(journal->path);
+        fd = -1;
+    }
+
+    journal->fd = fd;
+    g_free(temp);
+}
+
+// main thread
+static gboolean call_written(gpointer data) {
+    JournalWritten *written = (JournalWritten *)data;
+
+    written->func(written->intact, written->user_data);
+    g_free(written);
+    return G_SOURCE_REMOVE;
+}
+
+// writer thread
+static void write_journal_task(gpointer data, gpointer user_data) {
+    JournalTask *task = (JournalTask *)data;
+    EditJournal *journal = (EditJournal *)user_data;
+
+    if (task->written) {
+        JournalWritten *written = g_new(JournalWritten, 1);
+        written->func = task->written;
+        written->user_data = task->user_data;
+        written->intact = journal->fd >= 0;
+        g_idle_add(call_written, written);
+    } else if (task->reset) {
+        start_over(journal, task);
+    } else if (journal->fd >= 0) {
+        if (write_all(journal->fd, task->records->data, task->records->len)) {
+            fdatasync(journal->fd);
+        } else {
+            // a gap would make every later edit land in the wrong place
+            close(journal->fd);
+            g_unlink(journal->path);
+            journal->fd = -1;
+        }
+    }
+
+    if (task->records) g_byte_array_free(task->records, TRUE);
+    if (task->snapshot) doc_snapshot_free(task->snapshot);
+    g_free(task);
+}
+
+static void push_task(EditJournal *journal, GByteArray *records, DocSnapshot *snapshot, gboolean reset) {
+    JournalTask *task = g_new0(JournalTask, 1);
+    task->records = records;
+    task->snapshot = snapshot;
+    task->reset = reset;
+    g_thread_pool_push(journal->writer, task, NULL);
+}
+
+// edits before a new base don't matter anymore
+static void push_reset(EditJournal *journal, GByteArray *records, DocSnapshot *snapshot) {
+    g_byte_array_set_size(journal->pending, 0);
+    journal->logged = 0;
+    push_task(journal, records, snapshot, TRUE);
+}
+
+// the text of a file base, only if the file is still exactly what it was
+// going by its contents, an mtime can't tell apart two writes within its resolution
+static gboolean load_base_file(Document *doc, const gchar *filename, guint64 size, const guint8 *hash) {
+    GStatBuf info;
+    if (g_stat(filename, &info) != 0 || (guint64)info.st_size != size)
+        return FALSE;
+
+    GMappedFile *file = g_mapped_file_new(filename, FALSE, NULL);
+    if (!file) return FALSE;
+
+    const gchar *text = g_mapped_file_get_contents(file);
+    gsize len = g_mapped_file_get_length(file);
+    guint8 file_hash[JOURNAL_HASH_SIZE];
+    gsize hash_len = sizeof(file_hash);
+
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(checksum, (const guchar *)text, len);
+    g_checksum_get_digest(checksum, file_hash, &hash_len);
+    g_checksum_free(checksum);
+
+    gboolean ok = len == size && memcmp(file_hash, hash, JOURNAL_HASH_SIZE) == 0 && utf8_valid_len(text, len) == len;
+
+    if (ok)
+        document_insert(doc, 0, text, len);
+
+    g_mapped_file_unref(file);
+    return ok;
+}
+
+EditJournal *edit_journal_open(const gchar *path) {
+    EditJournal *journal = g_new0(EditJournal, 1);
+    journal->path = g_strdup(path);
+    journal->fd = -1;
+    journal->pending = g_byte_array_new();
+    journal->writer = g_thread_pool_new(write_journal_task, journal, 1, FALSE, NULL);
+
+    gchar *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    return journal;
+}
+
+gboolean edit_journal_close(EditJournal *journal, gboolean discard) {
+    if (!discard)
+        edit_journal_flush(journal);
+
+    g_thread_pool_free(journal->writer, FALSE, TRUE);
+
+    gboolean intact = journal->fd >= 0;
+    if (intact)
+        close(journal->fd);
+
+    if (discard)
+        g_unlink(journal->path);
+
+    g_byte_array_free(journal->pending, TRUE);
+    g_free(journal->path);
+    g_free(journal);
+    return intact;
+}
+
+// TRUE if there was a base to build on, edits counts the records after it
+static gboolean replay_records(EditJournal *journal, Document *doc, gchar **base_path, guint *edits_out) {
+    *base_path = NULL;
+
+    GMappedFile *file = g_mapped_file_new(journal->path, FALSE, NULL);
+    if (!file) return FALSE;
+
+    const guint8 *data = (const guint8 *)g_mapped_file_get_contents(file);
+    gsize len = g_mapped_file_get_length(file);
+    gsize pos = JOURNAL_MAGIC_SIZE;
+    gsize base_end = 0;
+    guint edits = 0;
+
+    if (len < JOURNAL_MAGIC_SIZE || memcmp(data, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0) {
+        g_mapped_file_unref(file);
+        return FALSE;
+    }
+
+    // replay up to the first record that's torn or doesn't fit the text
+    while (len - pos >= JOURNAL_HEADER_SIZE + JOURNAL_CHECK_SIZE) {
+        const guint8 *header = data + pos;
+        guint8 type = header[0];
+        guint64 offset = get_uint(header + 1, 8);
+        guint64 length = get_uint(header + 9, 8);
+        guint64 payload_len = get_uint(header + 17, 8);
+
+        if (payload_len > len - pos - JOURNAL_HEADER_SIZE - JOURNAL_CHECK_SIZE) break;
+
+        const gchar *payload = (const gchar *)header + JOURNAL_HEADER_SIZE;
+        guint32 check = fnv1a(fnv1a(FNV_OFFSET, header, JOURNAL_HEADER_SIZE), payload, payload_len);
+        if (check != get_uint((const guint8 *)payload + payload_len, JOURNAL_CHECK_SIZE)) break;
+
+        gsize chars = document_get_chars(doc);
+        gboolean based = base_end > 0;
+        gboolean ok = TRUE;
+
+        switch (type) {
+            case RECORD_BASE_EMPTY:
+                ok = !based;
+                break;
+
+            case RECORD_BASE_TEXT:
+                ok = !based && g_utf8_validate_len(payload, payload_len, NULL);
+                if (ok) document_insert(doc, 0, payload, payload_len);
+                break;
+
+            case RECORD_BASE_FILE:
+                ok = !based && payload_len > JOURNAL_HASH_SIZE;
+                if (!ok) break;
+
+                *base_path = g_strndup(payload + JOURNAL_HASH_SIZE, payload_len - JOURNAL_HASH_SIZE);
+                ok = load_base_file(doc, *base_path, length, (const guint8 *)payload);
+                break;
+
+            case RECORD_INSERT:
+                ok = based && offset <= chars && g_utf8_validate_len(payload, payload_len, NULL);
+                if (ok) document_insert(doc, offset, payload, payload_len);
+                break;
+
+            case RECORD_DELETE:
+                ok = based && offset <= chars && length <= chars - offset;
+                if (ok) document_delete(doc, offset, length);
+                break;
+
+            default:
+                ok = FALSE;
+        }
+
+        if (!ok) break;
+
+        pos += JOURNAL_HEADER_SIZE + payload_len + JOURNAL_CHECK_SIZE;
+
+        if (based) {
+            edits++;
+        } else {
+            base_end = pos;
+        }
+    }
+
+    g_mapped_file_unref(file);
+
+    // nothing to build on, the base file changed or the journal is broken
+    if (base_end == 0) {
+        g_free(*base_path);
+        *base_path = NULL;
+        return FALSE;
+    }
+
+    // carry on after the last good record
+    journal->fd = g_open(journal->path, O_WRONLY, 0);
+    if (journal->fd >= 0 && (ftruncate(journal->fd, pos) != 0 || lseek(journal->fd, 0, SEEK_END) < 0)) {
+        close(journal->fd);
+        journal->fd = -1;
+    }
+
+    journal->logged = pos - base_end;
+    *edits_out = edits;
+    return TRUE;
+}
+
+gboolean edit_journal_replay(EditJournal *journal, Document *doc, gchar **base_path) {
+    guint edits;
+    return replay_records(journal, doc, base_path, &edits) && edits > 0;
+}
+
+gboolean edit_journal_restore(EditJournal *journal, Document *doc) {
+    gchar *base_path;
+    guint edits;
+    gboolean ok = replay_records(journal, doc, &base_path, &edits);
+
+    g_free(base_path);
+    return ok;
+}
+
+void edit_journal_reset_empty(EditJournal *journal) {
+    GByteArray *records = g_byte_array_new();
+    append_record(records, RECORD_BASE_EMPTY, 0, 0, NULL, 0);
+    push_reset(journal, records, NULL);
+}
+
+void edit_journal_reset_file(EditJournal *journal, const gchar *filename, gint64 size, const guint8 *hash) {
+    GByteArray *records = g_byte_array_new();
+    GByteArray *payload = g_byte_array_new();
+
+    g_byte_array_append(payload, hash, JOURNAL_HASH_SIZE);
+    g_byte_array_append(payload, (const guint8 *)filename, strlen(filename));
+    append_record(records, RECORD_BASE_FILE, 0, size, (const gchar *)payload->data, payload->len);
+    g_byte_array_free(payload, TRUE);
+
+    push_reset(journal, records, NULL);
+}
+
+void edit_journal_checkpoint(EditJournal *journal, DocSnapshot *snapshot) {
+    push_reset(journal, NULL, snapshot);
+}
+
+void edit_journal_record_insert(EditJournal *journal, gint offset, const gchar *text, gsize len) {
+    append_record(journal->pending, RECORD_INSERT, offset, 0, text, len);
+    journal->logged += JOURNAL_HEADER_SIZE + len + JOURNAL_CHECK_SIZE;
+}
+
+void edit_journal_record_delete(EditJournal *journal, gint offset, gint length) {
+    append_record(journal->pending, RECORD_DELETE, offset, length, NULL, 0);
+    journal->logged += JOURNAL_HEADER_SIZE + JOURNAL_CHECK_SIZE;
+}
+
+void edit_journal_flush(EditJournal *journal) {
+    if (journal->pending->len == 0) return;
+
+    push_task(journal, journal->pending, NULL, FALSE);
+    journal->pending = g_byte_array_new();
+}
+
+void edit_journal_when_written(EditJournal *journal, EditJournalWrittenFunc func, gpointer user_data) {
+    edit_journal_flush(journal);
+
+    JournalTask *task = g_new0(JournalTask, 1);
+    task->written = func;
+    task->user_data = user_data;
+    g_thread_pool_push(journal->writer, task, NULL);
+}
+
+gboolean edit_journal_needs_checkpoint(EditJournal *journal, gsize doc_len) {
+    return journal->logged > MAX(JOURNAL_CHECKPOINT_MIN, doc_len);
+}
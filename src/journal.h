@@ -0,0 +1,61 @@
+#ifndef NOTEBOOK_JOURNAL_H
+#define NOTEBOOK_JOURNAL_H
+
+#include <glib.h>
+
+#include "document.h"
+
+// write-ahead journal of edits, for getting unsaved work back after a crash
+// the file starts with a base (nothing, a file on disk as it was when loaded or
+// saved, or a checkpoint of the whole text) followed by every insert & delete
+// since, so keeping it up to date costs O(edit size) instead of rewriting the
+// document. edits are gathered on the main thread and written out in batches
+// by a writer thread, and the journal is compacted into a fresh checkpoint once
+// the edits after the base outgrow the document itself
+typedef struct {
+    gchar *path;
+    gint fd;              // only touched by the writer thread once it's running
+    GThreadPool *writer;  // one thread, so batches land in order
+    GByteArray *pending;  // edits not handed to the writer yet
+    gsize logged;         // bytes of edits since the base
+} EditJournal;
+
+EditJournal *edit_journal_open(const gchar *path);
+
+// waits for everything queued to be written, discard deletes the journal
+// FALSE if a write failed along the way and the file can't be relied on
+gboolean edit_journal_close(EditJournal *journal, gboolean discard);
+
+// rebuild the document a journal left behind, TRUE if it had edits past its base
+// base_path is the file the base came from, if it did
+// afterwards new edits are appended to the same journal
+gboolean edit_journal_replay(EditJournal *journal, Document *doc, gchar **base_path);
+
+// the same for a journal closed earlier on purpose, TRUE whenever its text could
+// be rebuilt, edits or not (a file base that changed on disk since can't be)
+gboolean edit_journal_restore(EditJournal *journal, Document *doc);
+
+// start over from a new base, dropping every edit before it
+void edit_journal_reset_empty(EditJournal *journal);
+
+// a file base is known by the sha-256 of its contents, as read or written
+#define JOURNAL_HASH_SIZE 32
+void edit_journal_reset_file(EditJournal *journal, const gchar *filename, gint64 size, const guint8 *hash);
+void edit_journal_checkpoint(EditJournal *journal, DocSnapshot *snapshot);
+
+// offsets & lengths in characters like the undo journal, inserts carry their text
+void edit_journal_record_insert(EditJournal *journal, gint offset, const gchar *text, gsize len);
+void edit_journal_record_delete(EditJournal *journal, gint offset, gint length);
+
+// hand the recorded edits to the writer thread
+void edit_journal_flush(EditJournal *journal);
+
+// called back on the main thread once everything recorded so far is on disk,
+// intact is FALSE if a write failed along the way and the file can't be relied on
+typedef void (*EditJournalWrittenFunc)(gboolean intact, gpointer user_data);
+void edit_journal_when_written(EditJournal *journal, EditJournalWrittenFunc func, gpointer user_data);
+
+// whether compacting would now save more than it costs
+gboolean edit_journal_needs_checkpoint(EditJournal *journal, gsize doc_len);
+
+#endif
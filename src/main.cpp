@@ -1,16 +1,33 @@
 #include <gtk/gtk.h>
 #include <gdk/gdk.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "document.h"
+#include "encoding.h"
+#include "journal.h"
+#include "matches.h"
+#include "savefile.h"
+#include "search.h"
+#include "stats.h"
+#include "trace.h"
+#include "undo.h"
+#include "viewer.h"
 
 int current_font_size = 12;
 int min_font_size = 1;
 int max_font_size = 144;
 
-int max_undo_history = 100;
-
-typedef struct {
-    gchar *text;
-} UndoState;
+// undo history each tab keeps in memory, in MB, the rest goes to a temporary file
+int max_undo_memory = 64;
 
 typedef struct {
     GtkAdjustment *vadj;
@@ -29,9 +46,148 @@ const gchar *date_formats[] = {
 };
 
 GtkWidget *window;
-GtkWidget *text_view;
 GtkWidget *info_text;
-GtkTextTag *font_tag;
+GtkCssProvider *font_provider;
+
+// opening files
+// read asynchronously a chunk at a time, with a progress bar & cancel button
+#define LOAD_CHUNK_SIZE (1024 * 1024)
+
+typedef struct Tab Tab;
+
+typedef struct {
+    Tab *tab;
+    GFile *file;
+    GInputStream *stream;
+    GCancellable *cancellable;
+    goffset size;
+    goffset loaded;
+    TextDecoder decoder;
+    GChecksum *checksum; // of the bytes read, to find the file's undo history
+    gsize line_run;      // bytes since the last newline read
+} FileLoad;
+
+GtkWidget *load_bar;
+GtkWidget *load_progress;
+
+// saving
+// written on a worker thread from a snapshot of the document so editing carries
+// on meanwhile, into a temp file next to the real one which then replaces it
+#define SAVE_CHUNK_SIZE (1024 * 1024)
+
+typedef struct {
+    Tab *tab;
+    gchar *filename;
+    DocSnapshot *snapshot;
+    guint generation;  // the tab's generation when the snapshot was taken
+    gint64 size;       // of the saved file, filled in once it's written
+    gboolean sync;
+    SaveFile file;
+    gchar *chunk;      // pieces are gathered here into bigger writes
+    gsize chunk_len;
+    GChecksum *checksum; // of what's written, the undo history is kept under it
+} SaveJob;
+
+gboolean sync_on_save = TRUE;
+
+// crash recovery
+// every edit is appended to a journal in the cache directory, written out
+// in batches a little after typing, and offered back on the next start
+// each tab has its own, named after the process so a second notebook leaves them be
+#define JOURNAL_FLUSH_MS 1000
+
+gchar *journal_dir = NULL;
+guint next_journal_id = 0;
+guint journal_flush_id = 0;
+
+// undo history kept between sessions
+// written whenever a file is saved with nothing edited since, one file per path
+// holding the hash of what was saved, so it's only used again on that same text
+// ones that haven't been written in a while are cleared out on startup
+#define UNDO_HISTORY_MAX_AGE (30 * 24 * 60 * 60)
+
+gchar *undo_dir = NULL;
+
+// tabs
+// every open document, all sharing one tag table & the search machinery
+// background tabs aren't read in until they're first shown, and under memory
+// pressure the ones left alone for a while drop their text, which the journal
+// already has on disk, and read it back from there when they're shown again
+#define TAB_UNLOAD_IDLE_SECONDS 300
+#define TAB_UNLOAD_MIN_SIZE (64 * 1024)
+
+struct Tab {
+    GtkWidget *scrolled_window;
+    GtkWidget *text_view;
+    GtkWidget *label;
+
+    // the text itself, kept in step with the buffer from its signals
+    // so searching & saving can read it without copying it out of gtk
+    Document *document;
+    DocStats doc_stats;    // status bar counts
+    UndoJournal *undo_journal;
+    EditJournal *edit_journal; // NULL while unloaded
+    gchar *journal_path;
+    guint generation;      // bumped by every edit
+
+    gchar *filename;
+    FileLoad *file_load;
+    gboolean saving;
+    gboolean save_again;   // ctrl + s was pressed again while saving
+    gboolean closed;       // closed while saving or unloading, freed once that's done
+
+    gboolean loaded;       // FALSE until a lazily opened file is first shown
+    gboolean large;        // too big to edit or with too long a line, so it goes to the viewer instead once it's shown
+    gboolean edit_anyway;  // opened for editing from the viewer, long lines & all
+    gboolean unloading;    // its journal is being written out, the text goes once it's there
+    gboolean unloaded;     // text dropped for memory, the journal has it
+    gint64 last_active;    // when it was last in front
+    gint cursor;           // kept while unloaded
+
+    // what's tagged by the search highlighting
+    GtkTextMark *highlight_start_mark;
+    GtkTextMark *highlight_end_mark;
+};
+
+GtkWidget *notebook;
+GtkTextTagTable *tag_table;
+GPtrArray *tabs = NULL;
+Tab *tab = NULL; // the one in front
+GMemoryMonitor *memory_monitor = NULL;
+
+// tracing
+// off unless NOTEBOOK_TRACE is set or it's turned on in settings, while on
+// the status bar shows the p99 of keystroke to paint latency
+#define TRACE_STATUS_MS 1000
+
+gint64 frame_start = 0;
+guint trace_status_id = 0;
+
+// large file viewer
+// big files are memory mapped read only and only a window of lines from the
+// top of the screen down is put in the view, the scrollbar runs over bytes
+#define LARGE_FILE_SIZE ((goffset)512 * 1024 * 1024)
+// so do files found to have a line longer than this while they're read, gtk lays out each
+// line as one paragraph again after every keystroke, which past a megabyte or so lags typing
+// & takes seconds on a big minified file, the viewer cuts it into segments
+// (they can still be opened for editing from there)
+#define LONG_LINE_SIZE (1024 * 1024)
+#define VIEWER_WINDOW_LINES 200
+#define VIEWER_WINDOW_BYTES (256 * 1024)
+#define VIEWER_CONTEXT_LINES 3
+
+MappedDoc *viewer_doc = NULL;
+Tab *viewer_tab = NULL; // unread tab whose file the viewer took, closed along with it
+gsize viewer_top = 0;
+gsize viewer_end = 0;
+GArray *viewer_breaks; // where in the window a long line was cut, the view has a line break there the file doesn't
+GArray *viewer_strays; // continuation bytes out of place in the window, each shows as a U+FFFD counting characters misses
+gboolean viewer_scrolling = FALSE;
+gdouble viewer_scroll_delta = 0;
+GtkWidget *viewer_box;
+GtkWidget *edit_anyway_bar; // shown when the file came from a tab & isn't too big to edit
+GtkWidget *viewer_view;
+GtkAdjustment *viewer_adjustment;
 
 // find
 // ctrl + f
@@ -39,6 +195,7 @@ GtkWidget *search_entry;
 GtkWidget *search_bar;
 GtkWidget *match_label;
 GtkWidget *case_checkbox;
+GtkWidget *regex_checkbox;
 GtkWidget *find_next_button;
 GtkWidget *find_prev_button;
 
@@ -53,18 +210,70 @@ GtkWidget *replace_all_button;
 GtkWidget *replace_find_next_button;
 GtkWidget *replace_find_prev_button;
 GtkWidget *replace_case_checkbox;
+GtkWidget *replace_regex_checkbox;
 
 // undo & redo
 // ctrl + z, ctrl + y
-GList *undo_stack = NULL;
-GList *redo_stack = NULL;
 gboolean undoing = FALSE;
 gboolean redoing = FALSE;
+gboolean loading_file = FALSE;
+gboolean replacing_all = FALSE;
+
+// user actions
+// changed-signal work is deferred until the outermost user action ends
+gint user_action_depth = 0;
+gboolean text_changed_pending = FALSE;
 
 // highlighting
+// matches are kept as character offsets and only the ones on or near the
+// screen get tagged, the marks cover whatever is currently tagged
+#define HIGHLIGHT_MARGIN_SCREENS 1
+
 GtkTextTag *highlight_tag;
-GArray *search_matches = NULL;
-int current_match_index = -1;
+guint highlight_idle_id = 0;
+gboolean highlight_reset_pending = FALSE;
+MatchIndex *search_matches = NULL;
+int current_match_index = -1; // slot in search_matches
+
+// search as you type
+// keystrokes are debounced and big documents are split into chunks scanned on
+// a pool of worker threads, with matches streamed back to the main loop
+#define SEARCH_DEBOUNCE_MS 150
+#define SEARCH_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef struct {
+    gint ref_count;
+    gint cancelled;
+    gchar *query;
+    gboolean case_sensitive;
+    SearchPattern *pattern;
+    DocSnapshot *doc;         // pieces big documents are searched in, without copying them out
+    GBytes *snapshot;         // or the text as one string, for small documents & the viewer
+    const gchar *text;
+    gsize len;
+    guint generation;         // buffer_generation when the snapshot was taken
+    GArray *ranges;           // byte ranges merged so far, in order
+    gsize scan_pos;           // everything before this has been merged
+    guint published;          // ranges already added to search_matches
+    SearchOffsetCursor cursor;
+    GPtrArray *chunks;        // finished chunks waiting on the ones before them
+    guint next_chunk;
+} SearchJob;
+
+// one slice of the snapshot, scanned on a worker thread
+typedef struct {
+    SearchJob *job;
+    guint index;
+    gsize from;
+    gsize to;
+    gsize resume;
+    GArray *ranges;
+} SearchChunk;
+
+SearchJob *search_job = NULL;
+GThreadPool *search_pool = NULL;
+guint search_debounce_id = 0;
+guint buffer_generation = 0;
 
 // helper function
 int clamp(int x, int min, int max) {
@@ -77,52 +286,218 @@ int clamp(int x, int min, int max) {
     return x;
 }
 
-// create new file
-void new_file(GtkWidget *widget, gpointer data) {
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-    gtk_text_buffer_set_text(buffer, "", -1);
+gboolean flush_save_chunk(SaveJob *job, GError **error) {
+    if (!save_file_write(&job->file, job->chunk, job->chunk_len, error))
+        return FALSE;
+
+    job->chunk_len = 0;
+    return TRUE;
 }
 
-// prompt user to open new file
-void open_file(GtkWidget *widget, gpointer data) {
-    GtkWidget *dialog;
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+// save thread, so at most one chunk is held on top of the document
+gboolean save_piece(const gchar *text, gsize len, gpointer user_data) {
+    SaveJob *job = (SaveJob *)user_data;
 
-    dialog = gtk_file_chooser_dialog_new(
-        "Open File",
-        GTK_WINDOW(data),
-        GTK_FILE_CHOOSER_ACTION_OPEN,
-        "_Cancel", GTK_RESPONSE_CANCEL,
-        "_Open", GTK_RESPONSE_ACCEPT,
-        NULL
-    );
+    g_checksum_update(job->checksum, (const guchar *)text, len);
 
-    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
-        char *filename;
-        char *contents;
-        gsize length;
-
-        filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-        if (g_file_get_contents(filename, &contents, &length, NULL)) {
-            gtk_text_buffer_set_text(buffer, contents, length);
-            g_free(contents);
+    while (len > 0) {
+        gsize n = MIN(len, SAVE_CHUNK_SIZE - job->chunk_len);
+        memcpy(job->chunk + job->chunk_len, text, n);
+        job->chunk_len += n;
+        text += n;
+        len -= n;
+
+        if (job->chunk_len == SAVE_CHUNK_SIZE && !flush_save_chunk(job, NULL))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+void save_job_free(SaveJob *job) {
+    doc_snapshot_free(job->snapshot);
+    g_checksum_free(job->checksum);
+    g_free(job->filename);
+    g_free(job->chunk);
+    g_free(job);
+}
+
+// save thread, the rename only happens once everything is written (and synced)
+// so the file on disk is always either the old or the new version, never half of each
+void write_save_file(GTask *task, gpointer source, gpointer data, GCancellable *cancellable) {
+    TRACE("write_save_file");
+
+    SaveJob *job = (SaveJob *)data;
+    GError *error = NULL;
+    GStatBuf info;
+
+    if (!save_file_open(&job->file, job->filename, &error)) {
+        g_prefix_error(&error, "%s: ", job->filename);
+        g_task_return_error(task, error);
+        return;
+    }
+
+    job->chunk = (gchar *)g_malloc(SAVE_CHUNK_SIZE);
+
+    gboolean ok = doc_snapshot_foreach(job->snapshot, save_piece, job) && flush_save_chunk(job, &error);
+
+    if (!ok) {
+        // a failed write inside the walk doesn't get to report why
+        if (!error) {
+            int saved_errno = errno;
+            g_set_error_literal(&error, G_FILE_ERROR, g_file_error_from_errno(saved_errno), g_strerror(saved_errno));
         }
 
-        g_free(filename);
+        save_file_abort(&job->file);
+    } else {
+        ok = save_file_commit(&job->file, job->sync, &error);
     }
 
-    gtk_widget_destroy(dialog);
+    if (!ok) {
+        g_prefix_error(&error, "%s: ", job->filename);
+        g_task_return_error(task, error);
+        return;
+    }
+
+    if (g_stat(job->filename, &info) == 0)
+        job->size = info.st_size;
+
+    g_task_return_boolean(task, TRUE);
 }
 
-// prompt user to save file
-// TODO: if a user opens a file then makes changes, this should just directly write to the file
-void save_file(GtkWidget *widget, gpointer data) {
-    GtkWidget *dialog;
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+void start_save(Tab *t, const gchar *filename);
+void free_tab(Tab *t);
 
-    dialog = gtk_file_chooser_dialog_new(
+// where a file's undo history is kept, named after its full path
+gchar *undo_history_path(const gchar *filename) {
+    gchar *full = g_canonicalize_filename(filename, NULL);
+    gchar *name = g_compute_checksum_for_string(G_CHECKSUM_SHA256, full, -1);
+    gchar *path = g_build_filename(undo_dir, name, NULL);
+
+    g_free(name);
+    g_free(full);
+    return path;
+}
+
+// the history is keyed on the hash of the text it leads up to
+void store_undo_history(UndoJournal *journal, const gchar *filename, GChecksum *checksum) {
+    guint8 hash[UNDO_HASH_SIZE];
+    gsize hash_len = sizeof(hash);
+    g_checksum_get_digest(checksum, hash, &hash_len);
+
+    gchar *path = undo_history_path(filename);
+    undo_journal_store(journal, path, hash);
+    g_free(path);
+}
+
+// the journal checks the file is still the same by its hash, which was taken anyway
+void reset_journal_file(EditJournal *journal, const gchar *filename, gint64 size, GChecksum *checksum) {
+    guint8 hash[JOURNAL_HASH_SIZE];
+    gsize hash_len = sizeof(hash);
+    g_checksum_get_digest(checksum, hash, &hash_len);
+
+    edit_journal_reset_file(journal, filename, size, hash);
+}
+
+// worker thread, the files of paths that haven't been saved in a while
+void prune_undo_histories(GTask *task, gpointer source, gpointer data, GCancellable *cancellable) {
+    undo_journal_prune(undo_dir, UNDO_HISTORY_MAX_AGE);
+}
+
+void load_undo_history(UndoJournal *journal, const gchar *filename, GChecksum *checksum) {
+    guint8 hash[UNDO_HASH_SIZE];
+    gsize hash_len = sizeof(hash);
+    g_checksum_get_digest(checksum, hash, &hash_len);
+
+    gchar *path = undo_history_path(filename);
+    undo_journal_load(journal, path, hash);
+    g_free(path);
+}
+
+void on_file_saved(GObject *source, GAsyncResult *result, gpointer data) {
+    TRACE("on_file_saved");
+
+    SaveJob *job = (SaveJob *)g_task_get_task_data(G_TASK(result));
+    Tab *t = job->tab;
+    GError *error = NULL;
+
+    t->saving = FALSE;
+
+    if (!g_task_propagate_boolean(G_TASK(result), &error)) {
+        t->save_again = FALSE;
+
+        GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_MODAL,
+            GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Couldn't save the file");
+        gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog), "%s", error->message);
+        gtk_dialog_run(GTK_DIALOG(dialog));
+        gtk_widget_destroy(dialog);
+
+        g_error_free(error);
+        if (t->closed && !t->unloading) free_tab(t);
+        return;
+    }
+
+    // the tab went away while this was being written
+    if (t->closed) {
+        if (!t->unloading) free_tab(t);
+        return;
+    }
+
+    // nothing edited since, so the saved file is all the journal needs to start from
+    // & the undo history leads up to exactly what was saved
+    if (job->generation == t->generation) {
+        reset_journal_file(t->edit_journal, job->filename, job->size, job->checksum);
+        store_undo_history(t->undo_journal, job->filename, job->checksum);
+    }
+
+    // saved what the document was when it started, there may be newer edits to write
+    if (t->save_again && t->filename) {
+        t->save_again = FALSE;
+        start_save(t, t->filename);
+    }
+}
+
+void start_save(Tab *t, const gchar *filename) {
+    if (t->saving) {
+        t->save_again = TRUE;
+        return;
+    }
+
+    SaveJob *job = g_new0(SaveJob, 1);
+    job->tab = t;
+    job->filename = g_strdup(filename);
+    job->snapshot = document_snapshot(t->document);
+    job->generation = t->generation;
+    job->sync = sync_on_save;
+    job->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    t->saving = TRUE;
+
+    GTask *task = g_task_new(NULL, NULL, on_file_saved, NULL);
+    g_task_set_task_data(task, job, (GDestroyNotify)save_job_free);
+    g_task_run_in_thread(task, write_save_file);
+    g_object_unref(task);
+}
+
+// the file's name on its tab, with the whole path as the tooltip
+void set_tab_title(Tab *t) {
+    gchar *basename = t->filename ? g_path_get_basename(t->filename) : g_strdup("Untitled");
+
+    gtk_label_set_text(GTK_LABEL(t->label), basename);
+    gtk_widget_set_tooltip_text(t->label, t->filename);
+
+    g_free(basename);
+}
+
+// prompt user for where to save the file
+void save_file_as(GtkWidget *widget, gpointer data) {
+    TRACE("save_file_as");
+
+    // the viewer is read only, and a half loaded file isn't worth saving
+    if (viewer_doc || tab->file_load) return;
+
+    GtkWidget *dialog = gtk_file_chooser_dialog_new(
         "Save File",
-        GTK_WINDOW(data),
+        GTK_WINDOW(window),
         GTK_FILE_CHOOSER_ACTION_SAVE,
         "_Cancel",
         GTK_RESPONSE_CANCEL,
@@ -133,23 +508,34 @@ void save_file(GtkWidget *widget, gpointer data) {
 
     gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
 
+    if (tab->filename)
+        gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(dialog), tab->filename);
+
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
-        char *filename;
-        char *text;
-        GtkTextIter start, end;
+        g_free(tab->filename);
+        tab->filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        set_tab_title(tab);
+        start_save(tab, tab->filename);
+    }
+
+    gtk_widget_destroy(dialog);
+}
 
-        filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-        gtk_text_buffer_get_start_iter(buffer, &start);
-        gtk_text_buffer_get_end_iter(buffer, &end);
-        text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+// ctrl + s, straight back to the opened file, or ask where if there isn't one
+void save_file(GtkWidget *widget, gpointer data) {
+    TRACE("save_file");
 
-        g_file_set_contents(filename, text, -1, NULL);
+    if (viewer_doc || tab->file_load) return;
 
-        g_free(filename);
-        g_free(text);
+    if (tab->filename) {
+        start_save(tab, tab->filename);
+    } else {
+        save_file_as(widget, data);
     }
+}
 
-    gtk_widget_destroy(dialog);
+void on_sync_on_save_toggled(GtkCheckMenuItem *item, gpointer data) {
+    sync_on_save = gtk_check_menu_item_get_active(item);
 }
 
 // wrapper for gtk_main_quit triggered from events
@@ -157,68 +543,188 @@ void quit_app(GtkWidget *widget, gpointer data) {
     gtk_main_quit();
 }
 
-// wrapper for applying font tags
-void apply_font_tag_to_buffer() {
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-    GtkTextIter start, end;
+// update bottom label text that includes character, word & line count and font size
+void update_label_text() {
+    TRACE("update_label_text");
 
-    gtk_text_buffer_get_start_iter(buffer, &start);
-    gtk_text_buffer_get_end_iter(buffer, &end);
-    gtk_text_buffer_apply_tag(buffer, font_tag, &start, &end);
-}
+    // the viewer has no counts, just where in the file the view is
+    if (viewer_doc) {
+        gchar *size = g_format_size(viewer_doc->len);
+        gchar *info = g_strdup_printf(" Read Only  Size: %s  Position: %d%%  Text Size: %d",
+            size, viewer_doc->len ? (int)(viewer_top * 100 / viewer_doc->len) : 0, current_font_size);
+        gtk_label_set_text(GTK_LABEL(info_text), info);
 
-// update bottom label text that includes character & line number and font size
-void update_label_text() {
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+        g_free(info);
+        g_free(size);
+        return;
+    }
 
-    GtkTextIter start, end;
-    gtk_text_buffer_get_start_iter(buffer, &start);
-    gtk_text_buffer_get_end_iter(buffer, &end);
+    // where the cursor is, from the line index rather than walking the buffer
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(buffer, &cursor, gtk_text_buffer_get_insert(buffer));
 
-    gchar *text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    gint offset = gtk_text_iter_get_offset(&cursor);
+    gsize line = document_line_at(tab->document, offset);
+    gint column = offset - document_line_start(tab->document, line);
 
-    int char_count = g_utf8_strlen(text, -1);
-    int line_count = gtk_text_iter_get_line(&end) + 1;
+    gchar *info = g_strdup_printf(" Line: %" G_GSIZE_FORMAT "  Column: %d  Characters: %" G_GINT64_FORMAT "  Words: %" G_GINT64_FORMAT "  Lines: %" G_GINT64_FORMAT "  Text Size: %d",
+        line + 1, column + 1, tab->doc_stats.chars, tab->doc_stats.words, tab->doc_stats.lines + 1, current_font_size);
+
+    gdouble latency = trace_enabled ? trace_input_latency_p99_ms() : -1;
+    if (latency >= 0) {
+        gchar *with_latency = g_strdup_printf("%s  Input p99: %.1f ms", info, latency);
+        g_free(info);
+        info = with_latency;
+    }
 
-    gchar *info = g_strdup_printf(" Characters: %d  Lines: %d  Text Size: %d", char_count, line_count, current_font_size);
     gtk_label_set_text(GTK_LABEL(info_text), info);
 
-    g_free(text);
     g_free(info);
 }
 
+// every frame clock tick, so time spent in gtk's layout & drawing shows up next to the handlers
+void on_frame_before_paint(GdkFrameClock *clock, gpointer data) {
+    if (trace_enabled) frame_start = trace_now();
+}
+
+void on_frame_after_paint(GdkFrameClock *clock, gpointer data) {
+    if (!trace_enabled || !frame_start) return;
+
+    trace_record("frame", frame_start, trace_now());
+    trace_mark_painted();
+    frame_start = 0;
+}
+
+gboolean on_trace_status_timeout(gpointer data) {
+    update_label_text();
+    return G_SOURCE_CONTINUE;
+}
+
+void set_tracing(gboolean enabled) {
+    trace_set_enabled(enabled);
+    frame_start = 0;
+
+    if (enabled && !trace_status_id) {
+        trace_status_id = g_timeout_add(TRACE_STATUS_MS, on_trace_status_timeout, NULL);
+    } else if (!enabled && trace_status_id) {
+        g_source_remove(trace_status_id);
+        trace_status_id = 0;
+    }
+
+    update_label_text();
+}
+
+void on_record_trace_toggled(GtkCheckMenuItem *item, gpointer data) {
+    set_tracing(gtk_check_menu_item_get_active(item));
+}
+
+// save what's been recorded for chrome://tracing or perfetto
+void export_trace(GtkWidget *widget, gpointer data) {
+    GtkWidget *dialog = gtk_file_chooser_dialog_new(
+        "Export Trace",
+        GTK_WINDOW(window),
+        GTK_FILE_CHOOSER_ACTION_SAVE,
+        "_Cancel",
+        GTK_RESPONSE_CANCEL,
+        "_Export",
+        GTK_RESPONSE_ACCEPT,
+        NULL
+    );
+
+    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+    gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "notebook-trace.json");
+
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        gchar *filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        GError *error = NULL;
+
+        if (!trace_export(filename, &error)) {
+            GtkWidget *message = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_MODAL,
+                GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Couldn't export the trace");
+            gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message), "%s", error->message);
+            gtk_dialog_run(GTK_DIALOG(message));
+            gtk_widget_destroy(message);
+            g_error_free(error);
+        }
+
+        g_free(filename);
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+// whether matches are still coming in from the workers
+gboolean search_in_progress() {
+    return search_job && search_job->scan_pos < search_job->len;
+}
+
+// matches found so far, -1 when nothing is being searched for
+// the viewer's matches are the job's byte ranges, it can't be edited so they never move
+int match_total() {
+    if (viewer_doc)
+        return search_job ? (int)(search_job->ranges->len / 2) : -1;
+
+    return search_matches ? (int)search_matches->count : -1;
+}
+
 // update match count labels for find & replace
+// while a search is still running the count is marked as partial
 void update_match_label() {
-    if (search_matches) {
-        int total = search_matches->len / 2;
-        gchar *label_text = g_strdup_printf("%d match%s ", total, total == 1 ? "" : "es");
+    TRACE("update_match_label");
+
+    if (match_total() >= 0) {
+        int total = match_total();
+        const gchar *partial = search_in_progress() ? "+" : "";
+
+        // which line the selected match is on
+        gchar *where = NULL;
+        gint start_offset, end_offset;
+        if (!viewer_doc && search_matches && match_index_get(search_matches, current_match_index, &start_offset, &end_offset))
+            where = g_strdup_printf(", line %" G_GSIZE_FORMAT, document_line_at(tab->document, start_offset) + 1);
+
+        // text the regex engine failed on counts as no match, e.g. invalid utf-8 in the viewer
+        const GError *failed = search_job ? search_pattern_get_match_error(search_job->pattern) : NULL;
+        const gchar *skipped = failed ? ", some text not searched" : "";
+
+        gchar *label_text = g_strdup_printf("%d%s match%s%s%s ", total, partial, total == 1 ? "" : "es", where ? where : "", skipped);
         gtk_label_set_text(GTK_LABEL(match_label), label_text);
 
-        gchar *replace_label_text = g_strdup_printf(" %d match%s ", total, total == 1 ? "" : "es");
-        gtk_label_set_text(GTK_LABEL(replace_match_label), label_text);
+        gchar *replace_label_text = g_strdup_printf(" %d%s match%s%s%s ", total, partial, total == 1 ? "" : "es", where ? where : "", skipped);
+        gtk_label_set_text(GTK_LABEL(replace_match_label), replace_label_text);
+
+        if (failed) {
+            gtk_widget_set_tooltip_text(match_label, failed->message);
+            gtk_widget_set_tooltip_text(replace_match_label, failed->message);
+        }
 
         g_free(replace_label_text);
         g_free(label_text);
+        g_free(where);
     } else {
         gtk_label_set_text(GTK_LABEL(match_label), "0 matches ");
-        gtk_label_set_text(GTK_LABEL(match_label), " 0 matches ");
+        gtk_label_set_text(GTK_LABEL(replace_match_label), " 0 matches ");
     }
 }
 
 // update font size
 // done for zooming in & out (since it's just changing font size)
+// the font is set on the view itself, so this costs the same for any document size
 void update_font_size() {
-    gchar *font_str = g_strdup_printf("Monospace %d", current_font_size);
+    TRACE("update_font_size");
+
+    gchar *css = g_strdup_printf("textview { font-family: Monospace; font-size: %dpt; }", current_font_size);
 
-    g_object_set(font_tag, "font", font_str, NULL);
-    g_free(font_str);
+    gtk_css_provider_load_from_data(font_provider, css, -1, NULL);
+    g_free(css);
 
-    apply_font_tag_to_buffer();
     update_label_text();
 }
 
 // zoom in wrapper
 void zoom_in(GtkWidget *widget, gpointer data) {
+    TRACE("zoom_in");
+
     if (current_font_size < max_font_size) {
         current_font_size += 1;
         update_font_size();
@@ -227,14 +733,24 @@ void zoom_in(GtkWidget *widget, gpointer data) {
 
 // zoom out wrapper
 void zoom_out(GtkWidget *widget, gpointer data) {
+    TRACE("zoom_out");
+
     if (current_font_size > min_font_size) {
         current_font_size -= 1;
         update_font_size();
     }
 }
 
+// reset zoom wrapper
+void zoom_reset(GtkWidget *widget, gpointer data) {
+    current_font_size = 12;
+    update_font_size();
+}
+
 // restore scroll position
 gboolean restore_scroll_position(gpointer data) {
+    TRACE("restore_scroll_position");
+
     ScrollState *scroll = (ScrollState *)data;
     gtk_adjustment_set_value(scroll->vadj, scroll->vscroll);
     gtk_adjustment_set_value(scroll->hadj, scroll->hscroll);
@@ -242,433 +758,2206 @@ gboolean restore_scroll_position(gpointer data) {
     return G_SOURCE_REMOVE;
 }
 
-void free_undo_stack(GList *stack) {
-    g_list_free_full(stack, (GDestroyNotify)g_free);
-}
-
-// add a new undo state to the list of undo states
-// TODO: make this less memory intensive (ie. save state as changes to previous state)
-void push_undo_state() {
-    if (undoing || redoing) return;
+// take the highlight off whatever is tagged right now
+void remove_visible_highlights() {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    GtkTextIter start, end;
 
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+    gtk_text_buffer_get_iter_at_mark(buffer, &start, tab->highlight_start_mark);
+    gtk_text_buffer_get_iter_at_mark(buffer, &end, tab->highlight_end_mark);
+    gtk_text_buffer_remove_tag(buffer, highlight_tag, &start, &end);
+    gtk_text_buffer_move_mark(buffer, tab->highlight_end_mark, &start);
+}
 
+// tag the matches on screen (plus a screen either way) and untag the ones that scrolled away
+// with reset everything tagged before is dropped first, for when the matches themselves changed
+void update_visible_highlights(gboolean reset) {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
     GtkTextIter start, end;
-    gtk_text_buffer_get_start_iter(buffer, &start);
-    gtk_text_buffer_get_end_iter(buffer, &end);
 
-    UndoState *state = g_new(UndoState, 1);
-    state->text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    if (reset || !search_matches || search_matches->count == 0)
+        remove_visible_highlights();
+
+    if (!search_matches || search_matches->count == 0) return;
+
+    GdkRectangle rect;
+    gtk_text_view_get_visible_rect(GTK_TEXT_VIEW(tab->text_view), &rect);
+    gtk_text_view_get_line_at_y(GTK_TEXT_VIEW(tab->text_view), &start, rect.y - rect.height * HIGHLIGHT_MARGIN_SCREENS, NULL);
+    gtk_text_view_get_line_at_y(GTK_TEXT_VIEW(tab->text_view), &end, rect.y + rect.height * (HIGHLIGHT_MARGIN_SCREENS + 1), NULL);
+    if (!gtk_text_iter_ends_line(&end))
+        gtk_text_iter_forward_to_line_end(&end);
+
+    gint from = gtk_text_iter_get_offset(&start);
+    gint to = gtk_text_iter_get_offset(&end);
+    gint match_start, match_end;
+    guint first = match_index_find(search_matches, from);
+    guint last = match_index_find(search_matches, to);
+
+    // the match before the window can still run into it
+    if (first > 0 && match_index_get(search_matches, first - 1, &match_start, &match_end) && match_end > from)
+        first--;
+
+    // grow the window so it never cuts a match in half
+    if (first < last && match_index_get(search_matches, first, &match_start, &match_end))
+        from = MIN(from, match_start);
+
+    if (first < last && match_index_get(search_matches, last - 1, &match_start, &match_end))
+        to = MAX(to, match_end);
+
+    gtk_text_buffer_get_iter_at_mark(buffer, &start, tab->highlight_start_mark);
+    gtk_text_buffer_get_iter_at_mark(buffer, &end, tab->highlight_end_mark);
+    gint tagged_from = gtk_text_iter_get_offset(&start);
+    gint tagged_to = gtk_text_iter_get_offset(&end);
+
+    // untag what's no longer in the window
+    if (tagged_from < tagged_to) {
+        if (tagged_from < from) {
+            gtk_text_buffer_get_iter_at_offset(buffer, &end, MIN(tagged_to, from));
+            gtk_text_buffer_remove_tag(buffer, highlight_tag, &start, &end);
+        }
 
-    undo_stack = g_list_prepend(undo_stack, state);
-    g_list_free_full(redo_stack, (GDestroyNotify)g_free);
-    redo_stack = NULL;
+        if (tagged_to > to) {
+            gtk_text_buffer_get_iter_at_offset(buffer, &start, MAX(tagged_from, to));
+            gtk_text_buffer_get_iter_at_mark(buffer, &end, tab->highlight_end_mark);
+            gtk_text_buffer_remove_tag(buffer, highlight_tag, &start, &end);
+        }
+    }
 
-    if (g_list_length(undo_stack) > max_undo_history) {
-        GList *last_allowed = g_list_nth(undo_stack, max_undo_history - 1);
-        GList *excess = last_allowed->next;
-        last_allowed->next = NULL;
+    // and tag what wasn't in it before
+    for (guint slot = first; slot < last; slot++) {
+        if (!match_index_get(search_matches, slot, &match_start, &match_end)) continue;
+        if (match_start >= tagged_from && match_end <= tagged_to) continue;
 
-        g_list_free_full(excess, (GDestroyNotify)g_free);
+        gtk_text_buffer_get_iter_at_offset(buffer, &start, match_start);
+        gtk_text_buffer_get_iter_at_offset(buffer, &end, match_end);
+        gtk_text_buffer_apply_tag(buffer, highlight_tag, &start, &end);
     }
+
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, from);
+    gtk_text_buffer_get_iter_at_offset(buffer, &end, to);
+    gtk_text_buffer_move_mark(buffer, tab->highlight_start_mark, &start);
+    gtk_text_buffer_move_mark(buffer, tab->highlight_end_mark, &end);
 }
 
-// restore an undo state from before
-void restore_undo_state(UndoState *state) {
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+gboolean on_highlight_idle(gpointer data) {
+    TRACE("on_highlight_idle");
 
-    GtkWidget *scrolled_window = gtk_widget_get_parent(text_view);
+    gboolean reset = highlight_reset_pending;
+    highlight_idle_id = 0;
+    highlight_reset_pending = FALSE;
 
-    GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scrolled_window));
-    GtkAdjustment *hadj = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(scrolled_window));
-    gdouble vscroll = gtk_adjustment_get_value(vadj);
-    gdouble hscroll = gtk_adjustment_get_value(hadj);
+    update_visible_highlights(reset);
 
-    gtk_text_buffer_set_text(buffer, state->text, -1);
+    // edits that broke matches also change the count
+    if (reset)
+        update_match_label();
 
-    ScrollState *scroll = g_new(ScrollState, 1);
-    scroll->vadj = vadj;
-    scroll->hadj = hadj;
-    scroll->vscroll = vscroll;
-    scroll->hscroll = hscroll;
+    return G_SOURCE_REMOVE;
+}
 
-    g_idle_add(restore_scroll_position, scroll);
+// scrolling, resizing or editing changes which matches are on screen
+// retagging waits until layout is done, and only happens once per batch of events
+void queue_visible_highlights(gboolean reset) {
+    highlight_reset_pending |= reset;
+
+    if (!search_matches || highlight_idle_id) return;
+    highlight_idle_id = g_idle_add(on_highlight_idle, NULL);
 }
 
-// undo functionality
-void undo() {
-    if (!undo_stack || !undo_stack->next) return;
-    undoing = TRUE;
+// only the tab in front has matches to highlight
+void on_view_scrolled(GtkAdjustment *adjustment, gpointer user_data) {
+    TRACE("on_view_scrolled");
 
-    UndoState *current = (UndoState *)undo_stack->data;
-    redo_stack = g_list_prepend(redo_stack, current);
+    if (user_data == tab)
+        queue_visible_highlights(FALSE);
+}
 
-    undo_stack = g_list_delete_link(undo_stack, undo_stack);
-    UndoState *prev = (UndoState *)undo_stack->data;
-    restore_undo_state(prev);
+void on_view_size_allocate(GtkWidget *widget, GdkRectangle *allocation, gpointer user_data) {
+    TRACE("on_view_size_allocate");
 
-    undoing = FALSE;
+    if (user_data == tab)
+        queue_visible_highlights(FALSE);
 }
 
-// redo functionality
-void redo() {
-    if (!redo_stack) return;
-    redoing = TRUE;
+// character before an iter, 0 at the start of the buffer
+gunichar get_char_before(const GtkTextIter *iter) {
+    GtkTextIter prev = *iter;
+    return gtk_text_iter_backward_char(&prev) ? gtk_text_iter_get_char(&prev) : 0;
+}
 
-    UndoState *state = (UndoState *)redo_stack->data;
-    undo_stack = g_list_prepend(undo_stack, state);
+// append loaded text to the end of the buffer, invalid bytes become U+FFFD
+void append_loaded_text(GtkTextBuffer *buffer, const gchar *text, gsize len) {
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(buffer, &end);
 
-    redo_stack = g_list_delete_link(redo_stack, redo_stack);
-    restore_undo_state(state);
+    if (utf8_valid_len(text, len) == len) {
+        gtk_text_buffer_insert(buffer, &end, text, len);
+        return;
+    }
 
-    redoing = FALSE;
+    gchar *valid = g_utf8_make_valid(text, len);
+    gtk_text_buffer_insert(buffer, &end, valid, -1);
+    g_free(valid);
 }
 
-// some necessary stuff like saving undo state
-// GTK 3 for some reason making changes to font size doesn't
-// keep when adding text so updating font size required
-void on_text_changed(GtkTextBuffer *buffer, gpointer user_data) {
-    if (!undoing && !redoing) {
-        g_list_free_full(redo_stack, (GDestroyNotify)g_free);
-        redo_stack = NULL;
+// text out of the file's decoder, already valid
+void append_decoded_text(const gchar *text, gsize len, gpointer user_data) {
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(GTK_TEXT_BUFFER(user_data), &end);
+    gtk_text_buffer_insert(GTK_TEXT_BUFFER(user_data), &end, text, len);
+}
+
+gboolean on_journal_flush_timeout(gpointer data) {
+    TRACE("on_journal_flush_timeout");
+
+    journal_flush_id = 0;
 
-        push_undo_state();
+    for (guint i = 0; i < tabs->len; i++) {
+        Tab *t = (Tab *)g_ptr_array_index(tabs, i);
+        if (!t->edit_journal) continue;
+
+        edit_journal_flush(t->edit_journal);
+
+        // once the edits outweigh the text, a checkpoint makes the journal small again
+        if (edit_journal_needs_checkpoint(t->edit_journal, document_get_length(t->document)))
+            edit_journal_checkpoint(t->edit_journal, document_snapshot(t->document));
     }
 
-    update_font_size();
+    return G_SOURCE_REMOVE;
 }
 
-// clear highlights from find & replace
-void clear_search_highlights() {
-    if (!search_matches) return;
+void queue_journal_flush() {
+    if (!journal_flush_id)
+        journal_flush_id = g_timeout_add(JOURNAL_FLUSH_MS, on_journal_flush_timeout, NULL);
+}
+
+// text put in while loading is covered by the journal's base instead
+void journal_insert(Tab *t, gint offset, const gchar *text, gsize len) {
+    if (loading_file) return;
+
+    edit_journal_record_insert(t->edit_journal, offset, text, len);
+    queue_journal_flush();
+}
+
+void journal_delete(Tab *t, gint offset, gint length) {
+    if (loading_file) return;
 
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-    for (guint i = 0; i + 1 < search_matches->len; i += 2) {
-        int start_offset = g_array_index(search_matches, int, i);
-        int end_offset = g_array_index(search_matches, int, i + 1);
-        GtkTextIter s_iter, e_iter;
-        gtk_text_buffer_get_iter_at_offset(buffer, &s_iter, start_offset);
-        gtk_text_buffer_get_iter_at_offset(buffer, &e_iter, end_offset);
-        gtk_text_buffer_remove_tag(buffer, highlight_tag, &s_iter, &e_iter);
+    edit_journal_record_delete(t->edit_journal, offset, length);
+    queue_journal_flush();
+}
+
+// record text about to be inserted so it can be deleted again on undo
+// and add it to the status bar counts
+// the buffer may belong to a tab in the background that's still loading
+void on_insert_text(GtkTextBuffer *buffer, GtkTextIter *location, gchar *text, gint len, gpointer user_data) {
+    TRACE("on_insert_text");
+
+    Tab *t = (Tab *)user_data;
+
+    t->generation++;
+    document_insert(t->document, gtk_text_iter_get_offset(location), text, len);
+    journal_insert(t, gtk_text_iter_get_offset(location), text, len);
+    doc_stats_insert(&t->doc_stats, get_char_before(location), text, len, gtk_text_iter_get_char(location));
+
+    if (t == tab) {
+        buffer_generation++;
+
+        if (search_matches && match_index_insert(search_matches, gtk_text_iter_get_offset(location), g_utf8_strlen(text, len)))
+            queue_visible_highlights(TRUE);
     }
 
-    g_array_free(search_matches, TRUE);
-    search_matches = NULL;
-    current_match_index = -1;
+    if (undoing || redoing || loading_file || replacing_all) return;
+
+    undo_journal_record_insert(t->undo_journal, gtk_text_iter_get_offset(location), text, len);
 }
 
-// get match from index
-void select_match(int index) {
-    if (!search_matches || search_matches->len < 2 || index < 0)
+// record text about to be deleted so it can be inserted again on undo
+// and take it out of the status bar counts
+void on_delete_range(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end, gpointer user_data) {
+    TRACE("on_delete_range");
+
+    Tab *t = (Tab *)user_data;
+    gboolean recording = !(undoing || redoing || loading_file || replacing_all);
+    gboolean everything = gtk_text_iter_is_start(start) && gtk_text_iter_is_end(end);
+    gint start_offset = gtk_text_iter_get_offset(start);
+    gint end_offset = gtk_text_iter_get_offset(end);
+
+    t->generation++;
+
+    if (t == tab) {
+        buffer_generation++;
+
+        if (search_matches) {
+            if (everything) {
+                match_index_clear(search_matches);
+                queue_visible_highlights(TRUE);
+            } else if (match_index_delete(search_matches, start_offset, end_offset - start_offset)) {
+                queue_visible_highlights(TRUE);
+            }
+        }
+    }
+
+    // clearing everything (opening a file, replace all) doesn't need the text
+    if (!recording && everything) {
+        document_delete(t->document, start_offset, end_offset - start_offset);
+        journal_delete(t, start_offset, end_offset - start_offset);
+        doc_stats_reset(&t->doc_stats);
         return;
+    }
 
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-    int total = search_matches->len / 2;
+    gchar *text = document_get_text(t->document, start_offset, end_offset);
+    document_delete(t->document, start_offset, end_offset - start_offset);
+    journal_delete(t, start_offset, end_offset - start_offset);
+    doc_stats_delete(&t->doc_stats, get_char_before(start), text, strlen(text), gtk_text_iter_get_char(end));
 
-    index = clamp(index, 0, total - 1);
-    current_match_index = index;
+    if (recording)
+        undo_journal_record_delete(t->undo_journal, start_offset, text, -1);
+
+    g_free(text);
+}
 
-    GtkTextIter *start = &g_array_index(search_matches, GtkTextIter, current_match_index * 2);
-    GtkTextIter *end = &g_array_index(search_matches, GtkTextIter, current_match_index * 2 + 1);
-    gtk_text_buffer_select_range(buffer, start, end);
-    gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(text_view), start, 0.2, TRUE, 0.5, 0.0);
+// everything done in one user action (typing a key, pasting, etc.) is one undo step
+void on_begin_user_action(GtkTextBuffer *buffer, gpointer user_data) {
+    TRACE("on_begin_user_action");
 
-    update_match_label();
+    user_action_depth++;
+    undo_journal_begin_group(((Tab *)user_data)->undo_journal);
 }
 
-// get case sensitive setting
-gboolean get_case_sensitive_setting() {
-    return gtk_widget_is_visible(replace_bar)
-        ? gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(replace_case_checkbox))
-        : gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(case_checkbox));
+void on_end_user_action(GtkTextBuffer *buffer, gpointer user_data) {
+    TRACE("on_end_user_action");
+
+    undo_journal_end_group(((Tab *)user_data)->undo_journal);
+
+    if (--user_action_depth == 0 && text_changed_pending) {
+        text_changed_pending = FALSE;
+        update_label_text();
+    }
+}
+
+// replay a single op from the undo journal onto the buffer
+void apply_undo_op(UndoOpType type, gint offset, const gchar *text, gint length, gpointer user_data) {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    GtkTextIter start, end;
+
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, offset);
+
+    if (type == UNDO_OP_INSERT) {
+        gtk_text_buffer_insert(buffer, &start, text, -1);
+    } else {
+        end = start;
+        gtk_text_iter_forward_chars(&end, length);
+        gtk_text_buffer_delete(buffer, &start, &end);
+    }
+
+    gtk_text_buffer_place_cursor(buffer, &start);
+}
+
+// undo functionality
+void undo() {
+    TRACE("undo");
+
+    // a half loaded file has no history yet, & its text isn't ready to be edited
+    if (tab->file_load) return;
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    undoing = TRUE;
+    gtk_text_buffer_begin_user_action(buffer);
+
+    if (undo_journal_undo(tab->undo_journal, apply_undo_op, NULL))
+        gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(tab->text_view), gtk_text_buffer_get_insert(buffer));
+
+    gtk_text_buffer_end_user_action(buffer);
+    undoing = FALSE;
+}
+
+// redo functionality
+void redo() {
+    TRACE("redo");
+
+    if (tab->file_load) return;
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    redoing = TRUE;
+    gtk_text_buffer_begin_user_action(buffer);
+
+    if (undo_journal_redo(tab->undo_journal, apply_undo_op, NULL))
+        gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(tab->text_view), gtk_text_buffer_get_insert(buffer));
+
+    gtk_text_buffer_end_user_action(buffer);
+    redoing = FALSE;
+}
+
+// refresh the status bar after an edit
+// inside a user action this only runs once, when the action ends
+void on_text_changed(GtkTextBuffer *buffer, gpointer user_data) {
+    TRACE("on_text_changed");
+
+    // a tab loading in the background isn't what the status bar shows
+    if (user_data != tab) return;
+
+    if (user_action_depth > 0) {
+        text_changed_pending = TRUE;
+        return;
+    }
+
+    update_label_text();
+}
+
+// the line & column in the status bar follow the cursor
+void on_cursor_moved(GObject *buffer, GParamSpec *pspec, gpointer user_data) {
+    TRACE("on_cursor_moved");
+
+    if (user_data != tab || loading_file) return;
+
+    if (user_action_depth > 0) {
+        text_changed_pending = TRUE;
+        return;
+    }
+
+    update_label_text();
+}
+
+// how many of the sorted offsets come before pos, or up to it with inclusive
+guint offsets_before(GArray *offsets, gsize pos, gboolean inclusive) {
+    guint lo = 0, hi = offsets->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        gsize at = g_array_index(offsets, gsize, mid);
+
+        if (at < pos || (inclusive && at == pos)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// byte ranges in the viewer's window to offsets in its buffer, which has a character
+// more for every break put into a long line & every stray byte made valid
+void viewer_window_offsets(GArray *ranges) {
+    GArray *bytes = g_array_sized_new(FALSE, FALSE, sizeof(gsize), ranges->len);
+    g_array_append_vals(bytes, ranges->data, ranges->len);
+
+    SearchOffsetCursor cursor = { 0, 0 };
+    search_ranges_to_char_offsets(viewer_doc->data + viewer_top, ranges, 0, &cursor);
+
+    // a range starting on a break starts after it, one ending there ends before it
+    for (guint i = 0; i < ranges->len; i++) {
+        gsize pos = g_array_index(bytes, gsize, i);
+        g_array_index(ranges, gsize, i) += offsets_before(viewer_breaks, pos, i % 2 == 0) + offsets_before(viewer_strays, pos, FALSE);
+    }
+
+    g_array_free(bytes, TRUE);
+}
+
+// tag the matches inside the lines the viewer has materialized
+void viewer_update_highlights() {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(viewer_view));
+    GtkTextIter start, end;
+
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    gtk_text_buffer_remove_tag(buffer, highlight_tag, &start, &end);
+
+    if (!viewer_doc || !search_job || search_job->text != viewer_doc->data) return;
+
+    // first match ending after the top of the window
+    GArray *ranges = search_job->ranges;
+    guint lo = 0, hi = ranges->len / 2;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(ranges, gsize, mid * 2 + 1) <= viewer_top) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    GArray *window = g_array_new(FALSE, FALSE, sizeof(gsize));
+    for (guint i = lo; i < ranges->len / 2 && g_array_index(ranges, gsize, i * 2) < viewer_end; i++) {
+        gsize match_start = MAX(g_array_index(ranges, gsize, i * 2), viewer_top) - viewer_top;
+        gsize match_end = MIN(g_array_index(ranges, gsize, i * 2 + 1), viewer_end) - viewer_top;
+        g_array_append_val(window, match_start);
+        g_array_append_val(window, match_end);
+    }
+
+    viewer_window_offsets(window);
+
+    for (guint i = 0; i + 1 < window->len; i += 2) {
+        gtk_text_buffer_get_iter_at_offset(buffer, &start, g_array_index(window, gsize, i));
+        gtk_text_buffer_get_iter_at_offset(buffer, &end, g_array_index(window, gsize, i + 1));
+        gtk_text_buffer_apply_tag(buffer, highlight_tag, &start, &end);
+    }
+
+    g_array_free(window, TRUE);
+}
+
+// put the lines starting at top in the viewer
+void viewer_show(gsize top) {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(viewer_view));
+    GtkTextIter start;
+
+    viewer_top = top;
+    viewer_end = mapped_doc_window_end(viewer_doc, top, VIEWER_WINDOW_LINES, VIEWER_WINDOW_BYTES);
+
+    // gtk lays out a line as one paragraph however long, so each segment of a long line
+    // goes on a line of its own, the breaks are only in the view
+    GString *text = g_string_sized_new(viewer_end - viewer_top + VIEWER_WINDOW_LINES);
+    g_array_set_size(viewer_breaks, 0);
+
+    for (gsize pos = viewer_top; pos < viewer_end;) {
+        gsize next = mapped_doc_next_line(viewer_doc, pos);
+        g_string_append_len(text, viewer_doc->data + pos, next - pos);
+
+        if (next < viewer_end && viewer_doc->data[next - 1] != '\n') {
+            gsize at = next - viewer_top;
+            g_array_append_val(viewer_breaks, at);
+            g_string_append_c(text, '\n');
+        }
+
+        pos = next;
+    }
+
+    // invalid bytes go in as U+FFFD one at a time, which only changes the character count for
+    // continuation bytes, the ones counting characters skips
+    g_array_set_size(viewer_strays, 0);
+
+    for (gsize pos = viewer_top; pos < viewer_end; pos++) {
+        pos += utf8_valid_len(viewer_doc->data + pos, viewer_end - pos);
+        if (pos >= viewer_end) break;
+
+        if (((guchar)viewer_doc->data[pos] & 0xC0) == 0x80) {
+            gsize at = pos - viewer_top;
+            g_array_append_val(viewer_strays, at);
+        }
+    }
+
+    gtk_text_buffer_set_text(buffer, "", -1);
+    append_loaded_text(buffer, text->str, text->len);
+    g_string_free(text, TRUE);
+
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    gtk_text_buffer_place_cursor(buffer, &start);
+
+    viewer_scrolling = TRUE;
+    gtk_adjustment_set_value(viewer_adjustment, viewer_top);
+    viewer_scrolling = FALSE;
+
+    viewer_update_highlights();
+    update_label_text();
+}
+
+// move the top of the viewer by some lines, negative goes up
+void viewer_scroll_lines(gint lines) {
+    gsize top = viewer_top;
+
+    for (; lines > 0 && top < viewer_doc->len; lines--)
+        top = mapped_doc_next_line(viewer_doc, top);
+
+    for (; lines < 0 && top > 0; lines++)
+        top = mapped_doc_prev_line(viewer_doc, top);
+
+    if (top != viewer_top)
+        viewer_show(top);
+}
+
+// lines that fit on screen in the viewer
+gint viewer_visible_lines() {
+    GdkRectangle rect;
+    GtkTextIter bottom;
+
+    gtk_text_view_get_visible_rect(GTK_TEXT_VIEW(viewer_view), &rect);
+    gtk_text_view_get_line_at_y(GTK_TEXT_VIEW(viewer_view), &bottom, rect.y + rect.height, NULL);
+    return MAX(1, gtk_text_iter_get_line(&bottom));
+}
+
+// dragging the scrollbar lands on a byte, show the line it's in
+void on_viewer_adjustment_changed(GtkAdjustment *adjustment, gpointer user_data) {
+    TRACE("on_viewer_adjustment_changed");
+
+    if (viewer_scrolling || !viewer_doc) return;
+    viewer_show(mapped_doc_line_start(viewer_doc, (gsize)gtk_adjustment_get_value(adjustment)));
+}
+
+// the wheel moves through the file a few lines at a time
+gboolean on_viewer_scroll_event(GtkWidget *widget, GdkEventScroll *event, gpointer user_data) {
+    TRACE("on_viewer_scroll_event");
+
+    if (!viewer_doc) return FALSE;
+
+    gdouble dx, dy;
+
+    switch (event->direction) {
+        case GDK_SCROLL_UP:
+            viewer_scroll_lines(-3);
+            return TRUE;
+
+        case GDK_SCROLL_DOWN:
+            viewer_scroll_lines(3);
+            return TRUE;
+
+        case GDK_SCROLL_SMOOTH:
+            if (!gdk_event_get_scroll_deltas((GdkEvent *)event, &dx, &dy) || dy == 0)
+                return FALSE;
+
+            viewer_scroll_delta += dy * 3;
+            viewer_scroll_lines((gint)viewer_scroll_delta);
+            viewer_scroll_delta -= (gint)viewer_scroll_delta;
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+gboolean on_viewer_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data) {
+    TRACE("on_viewer_key_press");
+
+    if (!viewer_doc) return FALSE;
+
+    switch (event->keyval) {
+        case GDK_KEY_Up:
+            viewer_scroll_lines(-1);
+            return TRUE;
+
+        case GDK_KEY_Down:
+            viewer_scroll_lines(1);
+            return TRUE;
+
+        case GDK_KEY_Page_Up:
+            viewer_scroll_lines(-(viewer_visible_lines() - 1));
+            return TRUE;
+
+        case GDK_KEY_Page_Down:
+            viewer_scroll_lines(viewer_visible_lines() - 1);
+            return TRUE;
+
+        case GDK_KEY_Home:
+            if (!(event->state & GDK_CONTROL_MASK)) return FALSE;
+            viewer_show(0);
+            return TRUE;
+
+        case GDK_KEY_End:
+            if (!(event->state & GDK_CONTROL_MASK)) return FALSE;
+            viewer_show(mapped_doc_line_start(viewer_doc, viewer_doc->len));
+            viewer_scroll_lines(-(viewer_visible_lines() - 1));
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+// show a match a few lines down from the top of the viewer and select it
+void viewer_select_match(int index) {
+    GArray *ranges = search_job->ranges;
+    gsize match_start = g_array_index(ranges, gsize, index * 2);
+    gsize match_end = g_array_index(ranges, gsize, index * 2 + 1);
+    gsize top = mapped_doc_line_start(viewer_doc, match_start);
+
+    for (int i = 0; i < VIEWER_CONTEXT_LINES && top > 0; i++)
+        top = mapped_doc_prev_line(viewer_doc, top);
+
+    current_match_index = index;
+    viewer_show(top);
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(viewer_view));
+    GtkTextIter start, end;
+    GArray *offsets = g_array_new(FALSE, FALSE, sizeof(gsize));
+
+    match_start -= viewer_top;
+    match_end = MIN(match_end, viewer_end) - viewer_top;
+    g_array_append_val(offsets, match_start);
+    g_array_append_val(offsets, match_end);
+    viewer_window_offsets(offsets);
+
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, g_array_index(offsets, gsize, 0));
+    gtk_text_buffer_get_iter_at_offset(buffer, &end, g_array_index(offsets, gsize, 1));
+    gtk_text_buffer_select_range(buffer, &start, &end);
+    gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(viewer_view), &start, 0.0, FALSE, 0.0, 0.0);
+
+    g_array_free(offsets, TRUE);
+    update_match_label();
+}
+
+// clear highlights from find & replace
+void clear_search_highlights() {
+    if (viewer_doc) {
+        viewer_update_highlights();
+        current_match_index = -1;
+        return;
+    }
+
+    if (!search_matches) return;
+
+    remove_visible_highlights();
+
+    match_index_free(search_matches);
+    search_matches = NULL;
+    current_match_index = -1;
+}
+
+// select a match by its slot, dead ones are skipped by the callers
+void select_match(int slot) {
+    if (viewer_doc) {
+        if (slot >= 0 && slot < match_total())
+            viewer_select_match(slot);
+
+        return;
+    }
+
+    gint start_offset, end_offset;
+    if (!search_matches || slot < 0 || !match_index_get(search_matches, slot, &start_offset, &end_offset))
+        return;
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    GtkTextIter start, end;
+
+    current_match_index = slot;
+
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, start_offset);
+    gtk_text_buffer_get_iter_at_offset(buffer, &end, end_offset);
+    gtk_text_buffer_select_range(buffer, &start, &end);
+    gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(tab->text_view), &start, 0.2, TRUE, 0.5, 0.0);
+
+    update_match_label();
+}
+
+// live match after & before the current one, wrapping around
+int next_match_slot() {
+    if (viewer_doc)
+        return (current_match_index + 1) % match_total();
+
+    guint rank = match_index_rank(search_matches, current_match_index + 1);
+    return match_index_select(search_matches, rank % search_matches->count);
+}
+
+int prev_match_slot() {
+    if (viewer_doc)
+        return (MAX(current_match_index, 0) + match_total() - 1) % match_total();
+
+    guint rank = match_index_rank(search_matches, MAX(current_match_index, 0));
+    return match_index_select(search_matches, (rank + search_matches->count - 1) % search_matches->count);
+}
+
+// get case sensitive setting
+gboolean get_case_sensitive_setting() {
+    return gtk_widget_is_visible(replace_bar)
+        ? gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(replace_case_checkbox))
+        : gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(case_checkbox));
+}
+
+// get regex setting
+gboolean get_regex_setting() {
+    return gtk_widget_is_visible(replace_bar)
+        ? gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(replace_regex_checkbox))
+        : gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(regex_checkbox));
+}
+
+// set the same text on the find & replace match labels
+void set_match_labels(const gchar *text) {
+    gchar *replace_text = g_strdup_printf(" %s", text);
+
+    gtk_label_set_text(GTK_LABEL(match_label), text);
+    gtk_label_set_text(GTK_LABEL(replace_match_label), replace_text);
+
+    g_free(replace_text);
+}
+
+// compile the search text as typed, in regex mode a bad expression
+// shows up in the match labels (with the reason as the tooltip) and gives NULL
+SearchPattern *create_search_pattern(const gchar *search_text) {
+    gboolean case_sensitive = get_case_sensitive_setting();
+
+    gtk_widget_set_tooltip_text(match_label, NULL);
+    gtk_widget_set_tooltip_text(replace_match_label, NULL);
+
+    if (!get_regex_setting())
+        return search_pattern_new(search_text, case_sensitive);
+
+    GError *error = NULL;
+    SearchPattern *pattern = search_pattern_new_regex(search_text, case_sensitive, &error);
+
+    if (!pattern) {
+        set_match_labels("invalid regex ");
+        gtk_widget_set_tooltip_text(match_label, error->message);
+        gtk_widget_set_tooltip_text(replace_match_label, error->message);
+        g_error_free(error);
+    }
+
+    return pattern;
+}
+
+// check the capture group references in a regex replacement
+gboolean check_replacement(SearchPattern *pattern, const gchar *replacement) {
+    if (!pattern->regex) return TRUE;
+
+    GError *error = NULL;
+    if (g_regex_check_replacement(replacement, NULL, &error)) return TRUE;
+
+    set_match_labels("invalid replacement ");
+    gtk_widget_set_tooltip_text(replace_match_label, error->message);
+    g_error_free(error);
+    return FALSE;
+}
+
+// change the undo memory budget
+void on_set_undo_limit_activate(GtkWidget *widget, gpointer data) {
+    TRACE("on_set_undo_limit_activate");
+
+    GtkWidget *dialog = gtk_dialog_new_with_buttons(
+        "Set Max Undo Memory (MB)",
+        GTK_WINDOW(window),
+        (GtkDialogFlags)(GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT),
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_OK", GTK_RESPONSE_ACCEPT,
+        NULL
+    );
+
+    GtkWidget *content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+    GtkWidget *spin = gtk_spin_button_new_with_range(1, 16384, 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin), max_undo_memory);
+    gtk_container_add(GTK_CONTAINER(content_area), spin);
+    gtk_widget_show_all(dialog);
+
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        max_undo_memory = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(spin));
+
+        for (guint i = 0; i < tabs->len; i++)
+            undo_journal_set_limit(((Tab *)g_ptr_array_index(tabs, i))->undo_journal, (gsize)max_undo_memory * 1024 * 1024);
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+// jump to a line, the line index finds where it starts without walking the buffer
+void on_go_to_line_activate(GtkWidget *widget, gpointer data) {
+    TRACE("on_go_to_line_activate");
+
+    if (viewer_doc) return;
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(buffer, &cursor, gtk_text_buffer_get_insert(buffer));
+
+    GtkWidget *dialog = gtk_dialog_new_with_buttons(
+        "Go to Line",
+        GTK_WINDOW(window),
+        (GtkDialogFlags)(GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT),
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_Go", GTK_RESPONSE_ACCEPT,
+        NULL
+    );
+
+    gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
+
+    GtkWidget *content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+    GtkWidget *spin = gtk_spin_button_new_with_range(1, document_get_lines(tab->document), 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin), document_line_at(tab->document, gtk_text_iter_get_offset(&cursor)) + 1);
+    gtk_entry_set_activates_default(GTK_ENTRY(spin), TRUE);
+    gtk_container_add(GTK_CONTAINER(content_area), spin);
+    gtk_widget_show_all(dialog);
+
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        gsize line = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(spin)) - 1;
+        GtkTextIter start;
+
+        gtk_text_buffer_get_iter_at_offset(buffer, &start, document_line_start(tab->document, line));
+        gtk_text_buffer_place_cursor(buffer, &start);
+        gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(tab->text_view), &start, 0.2, TRUE, 0.0, 0.5);
+    }
+
+    gtk_widget_destroy(dialog);
+    gtk_widget_grab_focus(tab->text_view);
+}
+
+SearchJob *search_job_ref(SearchJob *job) {
+    g_atomic_int_inc(&job->ref_count);
+    return job;
+}
+
+void search_job_unref(SearchJob *job) {
+    if (!g_atomic_int_dec_and_test(&job->ref_count)) return;
+
+    search_pattern_free(job->pattern);
+    g_array_free(job->ranges, TRUE);
+    g_ptr_array_free(job->chunks, TRUE);
+    if (job->doc) doc_snapshot_free(job->doc);
+    if (job->snapshot) g_bytes_unref(job->snapshot);
+    g_free(job->query);
+    g_free(job);
+}
+
+void search_chunk_free(SearchChunk *chunk) {
+    search_job_unref(chunk->job);
+    g_array_free(chunk->ranges, TRUE);
+    g_free(chunk);
+}
+
+// chunks that finished ahead of one before them wait in the job, each holding a reference to it
+void free_parked_chunks(SearchJob *job) {
+    for (guint i = job->next_chunk; i < job->chunks->len; i++) {
+        SearchChunk *chunk = (SearchChunk *)g_ptr_array_index(job->chunks, i);
+        g_ptr_array_index(job->chunks, i) = NULL;
+        if (chunk) search_chunk_free(chunk);
+    }
+}
+
+// let go of a job the main loop is done with, it's freed once the workers are done with it too
+void release_search_job(SearchJob *job) {
+    g_atomic_int_set(&job->cancelled, TRUE);
+    free_parked_chunks(job);
+    search_job_unref(job);
+}
+
+// stop any search in progress and drop its snapshot
+void stop_search() {
+    if (search_debounce_id) {
+        g_source_remove(search_debounce_id);
+        search_debounce_id = 0;
+    }
+
+    if (search_job) {
+        release_search_job(search_job);
+        search_job = NULL;
+    }
+}
+
+// add the matches merged since last time, only the visible ones get tagged
+void publish_search_results(SearchJob *job) {
+    if (job->published >= job->ranges->len) {
+        update_match_label();
+        return;
+    }
+
+    // the viewer works on the byte ranges directly
+    if (viewer_doc) {
+        job->published = job->ranges->len;
+
+        if (current_match_index < 0) {
+            select_match(0);
+        } else {
+            viewer_update_highlights();
+            update_match_label();
+        }
+
+        return;
+    }
+
+    GArray *offsets = g_array_sized_new(FALSE, FALSE, sizeof(gsize), job->ranges->len - job->published);
+    g_array_append_vals(offsets, &g_array_index(job->ranges, gsize, job->published), job->ranges->len - job->published);
+    if (job->text)
+        search_ranges_to_char_offsets(job->text, offsets, 0, &job->cursor);
+    else
+        doc_snapshot_to_char_offsets(job->doc, offsets);
+
+    job->published = job->ranges->len;
+
+    for (guint i = 0; i + 1 < offsets->len; i += 2)
+        match_index_append(search_matches, g_array_index(offsets, gsize, i), g_array_index(offsets, gsize, i + 1));
+
+    g_array_free(offsets, TRUE);
+
+    update_visible_highlights(TRUE);
+
+    // jump to the first hit as soon as there is one
+    if (current_match_index < 0) {
+        select_match(match_index_select(search_matches, 0));
+    } else {
+        update_match_label();
+    }
+}
+
+gboolean feed_search_stream(const gchar *text, gsize len, gpointer user_data) {
+    return search_stream_feed((SearchStream *)user_data, text, len);
+}
+
+// matches starting between from & to, in the flat snapshot or straight out of the pieces
+gsize search_job_find_range(SearchJob *job, gsize from, gsize to, GArray *ranges) {
+    if (job->text)
+        return search_pattern_find_range(job->pattern, job->text, job->len, from, to, ranges);
+
+    SearchStream stream;
+    gsize feed_from, feed_to;
+
+    search_stream_init(&stream, job->pattern, job->len, from, to, ranges, &feed_from, &feed_to);
+    doc_snapshot_foreach_range(job->doc, feed_from, feed_to, feed_search_stream, &stream);
+    return search_stream_finish(&stream);
+}
+
+// narrow down the previous matches without a flat snapshot,
+// each one is checked on a copy of the few bytes a match there can cover
+void refine_search_pieces(SearchJob *job, GArray *candidates) {
+    gsize max_len = search_pattern_max_match_len(job->pattern);
+    gchar *text = (gchar *)g_malloc(max_len);
+    GArray *candidate = g_array_sized_new(FALSE, FALSE, sizeof(gsize), 2);
+    GArray *found = g_array_sized_new(FALSE, FALSE, sizeof(gsize), 2);
+    gsize last_end = 0;
+
+    for (guint i = 0; i + 1 < candidates->len; i += 2) {
+        gsize start = g_array_index(candidates, gsize, i);
+        if (start < last_end) continue;
+
+        gsize end = MIN(job->len, start + max_len);
+        doc_snapshot_copy(job->doc, start, end, text);
+
+        gsize bounds[2] = { 0, end - start };
+        g_array_set_size(candidate, 0);
+        g_array_append_vals(candidate, bounds, 2);
+        g_array_set_size(found, 0);
+        search_pattern_refine(job->pattern, text, end - start, candidate, found);
+
+        if (found->len == 0) continue;
+
+        last_end = start + g_array_index(found, gsize, 1);
+        gsize match[2] = { start, last_end };
+        g_array_append_vals(job->ranges, match, 2);
+    }
+
+    g_array_free(found, TRUE);
+    g_array_free(candidate, TRUE);
+    g_free(text);
+}
+
+// add a chunk's matches after the ones before it
+void merge_search_chunk(SearchJob *job, SearchChunk *chunk) {
+    GArray *ranges = chunk->ranges;
+    guint first = 0;
+
+    // a match from the previous chunk ran into this one
+    if (job->scan_pos > chunk->from && ranges->len > 0 && g_array_index(ranges, gsize, 0) < job->scan_pos) {
+        if (search_pattern_is_self_overlapping(job->pattern)) {
+            // matches here could line up differently now, scan again from where it ended
+            g_array_set_size(ranges, 0);
+            chunk->resume = search_job_find_range(job, job->scan_pos, chunk->to, ranges);
+        } else {
+            while (first < ranges->len && g_array_index(ranges, gsize, first) < job->scan_pos)
+                first += 2;
+        }
+    }
+
+    if (first < ranges->len)
+        g_array_append_vals(job->ranges, &g_array_index(ranges, gsize, first), ranges->len - first);
+
+    job->scan_pos = MAX(job->scan_pos, chunk->resume);
+}
+
+gboolean on_search_debounce_timeout(gpointer data);
+
+// cancelled, or the buffer changed underneath us so the job's matches are no good anymore
+gboolean search_job_expired(SearchJob *job) {
+    if (job == search_job && !g_atomic_int_get(&job->cancelled) && job->generation == buffer_generation)
+        return FALSE;
+
+    // what was published so far moved along with the edits, but the rest has to be searched again
+    if (job == search_job && !g_atomic_int_get(&job->cancelled) && !search_debounce_id)
+        search_debounce_id = g_timeout_add(SEARCH_DEBOUNCE_MS, on_search_debounce_timeout, NULL);
+
+    return TRUE;
+}
+
+// runs on the main loop whenever a worker finishes a chunk
+gboolean on_search_chunk_done(gpointer data) {
+    TRACE("on_search_chunk_done");
+
+    SearchChunk *chunk = (SearchChunk *)data;
+    SearchJob *job = chunk->job;
+
+    if (search_job_expired(job)) {
+        free_parked_chunks(job);
+        search_chunk_free(chunk);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_ptr_array_index(job->chunks, chunk->index) = chunk;
+
+    // merge every chunk that's ready, in order, so matches stay sorted
+    while (job->next_chunk < job->chunks->len && g_ptr_array_index(job->chunks, job->next_chunk)) {
+        SearchChunk *next = (SearchChunk *)g_ptr_array_index(job->chunks, job->next_chunk);
+        g_ptr_array_index(job->chunks, job->next_chunk) = NULL;
+        job->next_chunk++;
+
+        merge_search_chunk(job, next);
+        search_chunk_free(next);
+    }
+
+    publish_search_results(job);
+    return G_SOURCE_REMOVE;
+}
+
+// worker thread, the pattern & snapshot are read only here
+void search_worker(gpointer data, gpointer user_data) {
+    TRACE("search_worker");
+
+    SearchChunk *chunk = (SearchChunk *)data;
+    SearchJob *job = chunk->job;
+
+    if (!g_atomic_int_get(&job->cancelled))
+        chunk->resume = search_job_find_range(job, chunk->from, chunk->to, chunk->ranges);
+
+    g_idle_add(on_search_chunk_done, chunk);
+}
+
+// split the snapshot into chunks and hand them to the workers
+void start_search_workers(SearchJob *job) {
+    if (!search_pool)
+        search_pool = g_thread_pool_new(search_worker, NULL, g_get_num_processors(), FALSE, NULL);
+
+    guint count = (job->len - job->scan_pos + SEARCH_CHUNK_SIZE - 1) / SEARCH_CHUNK_SIZE;
+    g_ptr_array_set_size(job->chunks, count);
+
+    for (guint i = 0; i < count; i++) {
+        SearchChunk *chunk = g_new0(SearchChunk, 1);
+        chunk->job = search_job_ref(job);
+        chunk->index = i;
+        chunk->from = job->scan_pos + (gsize)i * SEARCH_CHUNK_SIZE;
+        chunk->to = MIN(chunk->from + SEARCH_CHUNK_SIZE, job->len);
+        chunk->ranges = g_array_new(FALSE, FALSE, sizeof(gsize));
+
+        g_thread_pool_push(search_pool, chunk, NULL);
+    }
+}
+
+// small documents are done right away, big ones are scanned in the background
+void scan_search_snapshot(SearchJob *job) {
+    if (job->len - job->scan_pos <= SEARCH_CHUNK_SIZE)
+        job->scan_pos = search_job_find_range(job, job->scan_pos, job->len, job->ranges);
+
+    if (job->scan_pos < job->len)
+        start_search_workers(job);
+}
+
+void set_search_snapshot(SearchJob *job, GBytes *snapshot) {
+    job->snapshot = snapshot;
+    job->text = (const gchar *)g_bytes_get_data(snapshot, &job->len);
+}
+
+// update search colors
+void on_search_activate(GtkEntry *entry, gpointer user_data) {
+    TRACE("on_search_activate");
+
+    // get the search text
+    const gchar *search_text = NULL;
+    if (gtk_widget_is_visible(replace_bar)) {
+        search_text = gtk_entry_get_text(GTK_ENTRY(replace_find_entry));
+    } else {
+        search_text = gtk_entry_get_text(GTK_ENTRY(search_entry));
+    }
+
+    gboolean case_sensitive = get_case_sensitive_setting();
+
+    if (search_debounce_id) {
+        g_source_remove(search_debounce_id);
+        search_debounce_id = 0;
+    }
+
+    SearchJob *prev = search_job;
+    search_job = NULL;
+
+    if (prev)
+        g_atomic_int_set(&prev->cancelled, TRUE);
+
+    clear_search_highlights();
+    if (!search_text || !*search_text) {
+        if (prev) release_search_job(prev);
+
+        gtk_label_set_text(GTK_LABEL(match_label), "0 matches ");
+        gtk_label_set_text(GTK_LABEL(replace_match_label), " 0 matches ");
+        return;
+    }
+
+    SearchPattern *pattern = create_search_pattern(search_text);
+    if (!pattern) {
+        if (prev) release_search_job(prev);
+        return;
+    }
+
+    SearchJob *job = g_new0(SearchJob, 1);
+    job->ref_count = 1;
+    job->query = g_strdup(search_text);
+    job->case_sensitive = case_sensitive;
+    job->pattern = pattern;
+    job->ranges = g_array_new(FALSE, FALSE, sizeof(gsize));
+    job->chunks = g_ptr_array_new();
+    job->generation = buffer_generation;
+
+    gboolean same_text = prev && prev->generation == buffer_generation;
+
+    // typing more of the previous query can only narrow its matches down,
+    // as long as they couldn't overlap each other (regexes never narrow)
+    gboolean narrow = same_text
+        && prev->scan_pos >= prev->len
+        && prev->case_sensitive == case_sensitive
+        && !prev->pattern->regex && !pattern->regex
+        && g_str_has_prefix(search_text, prev->query)
+        && !search_pattern_is_self_overlapping(prev->pattern);
+
+    // share the previous snapshot while the buffer hasn't changed,
+    // the viewer searches the mapped file itself
+    if (same_text && prev->snapshot) {
+        set_search_snapshot(job, g_bytes_ref(prev->snapshot));
+    } else if (viewer_doc) {
+        set_search_snapshot(job, mapped_doc_get_bytes(viewer_doc));
+    } else {
+        job->doc = document_snapshot(tab->document);
+        job->len = doc_snapshot_get_length(job->doc);
+
+        // small documents are copied out right away, big ones are searched in their pieces
+        if (job->len <= SEARCH_CHUNK_SIZE) {
+            set_search_snapshot(job, doc_snapshot_flatten(job->doc));
+            doc_snapshot_free(job->doc);
+            job->doc = NULL;
+        }
+    }
+
+    if (narrow) {
+        if (job->text)
+            search_pattern_refine(job->pattern, job->text, job->len, prev->ranges, job->ranges);
+        else
+            refine_search_pieces(job, prev->ranges);
+
+        job->scan_pos = job->len;
+    }
+
+    if (prev) release_search_job(prev);
+
+    search_job = job;
+    if (!viewer_doc)
+        search_matches = match_index_new();
+
+    scan_search_snapshot(job);
+    publish_search_results(job);
+
+    if (match_total() == 0 && !search_in_progress()) {
+        gtk_label_set_text(GTK_LABEL(match_label), "0 matches ");
+        gtk_label_set_text(GTK_LABEL(replace_match_label), " 0 matches ");
+    }
+}
+
+void on_find_next_clicked(GtkButton *button, gpointer user_data) {
+    TRACE("on_find_next_clicked");
+
+    if (match_total() <= 0) return;
+    select_match(next_match_slot());
+}
+
+void on_find_prev_clicked(GtkButton *button, gpointer user_data) {
+    TRACE("on_find_prev_clicked");
+
+    if (match_total() <= 0) return;
+    select_match(prev_match_slot());
+}
+
+void show_search_bar() {
+    TRACE("show_search_bar");
+
+    gtk_widget_hide(replace_bar);
+    gtk_widget_show(search_bar);
+
+    gtk_widget_grab_focus(search_entry);
+    on_search_activate(NULL, NULL);
+}
+
+void show_replace_bar() {
+    TRACE("show_replace_bar");
+
+    gtk_widget_hide(search_bar);
+    gtk_widget_show(replace_bar);
+
+    gtk_widget_grab_focus(replace_find_entry);
+    on_search_activate(NULL, NULL);
+}
+
+void new_file(GtkWidget *widget, gpointer data);
+void close_tab(Tab *t);
+void close_viewer();
+void open_large_file(const gchar *filename);
+
+// keybinds
+gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data) {
+    TRACE("on_key_press");
+    trace_mark_input();
+
+    // non-ctrl keybinds
+    switch (event->keyval) {
+        case GDK_KEY_Escape:
+            gtk_widget_hide(search_bar);
+            gtk_widget_hide(replace_bar);
+            stop_search();
+            clear_search_highlights();
+            gtk_widget_grab_focus(tab->text_view);
+            return TRUE;
+    }
+
+    // ctrl keybinds
+    if (event->state & GDK_CONTROL_MASK) {
+        switch (event->keyval) {
+            case GDK_KEY_plus:
+            case GDK_KEY_equal:
+                zoom_in(NULL, NULL);
+                return TRUE;
+
+            case GDK_KEY_minus:
+                zoom_out(NULL, NULL);
+                return TRUE;
+
+            case GDK_KEY_0:
+            case GDK_KEY_KP_0:
+                zoom_reset(NULL, NULL);
+                return TRUE;
+
+            case GDK_KEY_z:
+                undo();
+                return TRUE;
+
+            case GDK_KEY_y:
+                redo();
+                return TRUE;
+
+            case GDK_KEY_f:
+                show_search_bar();
+                return TRUE;
+
+            case GDK_KEY_g:
+                show_replace_bar();
+                return TRUE;
+
+            case GDK_KEY_l:
+                on_go_to_line_activate(NULL, NULL);
+                return TRUE;
+
+            case GDK_KEY_s:
+                save_file(NULL, NULL);
+                return TRUE;
+
+            case GDK_KEY_S:
+                save_file_as(NULL, NULL);
+                return TRUE;
+
+            case GDK_KEY_t:
+                new_file(NULL, NULL);
+                return TRUE;
+
+            // closes the viewer when it's covering the tabs
+            case GDK_KEY_w:
+                if (viewer_doc) {
+                    close_viewer();
+                } else {
+                    close_tab(tab);
+                }
+                return TRUE;
+
+            case GDK_KEY_Page_Up:
+                if (viewer_doc) return FALSE;
+                gtk_notebook_prev_page(GTK_NOTEBOOK(notebook));
+                return TRUE;
+
+            case GDK_KEY_Page_Down:
+                if (viewer_doc) return FALSE;
+                gtk_notebook_next_page(GTK_NOTEBOOK(notebook));
+                return TRUE;
+
+        }
+    }
+
+    // moving match index based on enter key press
+    // and whether or not shift is held
+    if (gtk_widget_has_focus(search_entry)) {
+        if (event->keyval == GDK_KEY_Return || event->keyval == GDK_KEY_KP_Enter) {
+            if (match_total() > 0) {
+                if (event->state & GDK_SHIFT_MASK) {
+                    on_find_next_clicked(NULL, NULL);
+                } else {
+                    on_find_prev_clicked(NULL, NULL);
+                }
+
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+gboolean on_search_debounce_timeout(gpointer data) {
+    TRACE("on_search_debounce_timeout");
+
+    search_debounce_id = 0;
+    on_search_activate(NULL, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+// both for find & replace
+// wait for typing to pause before searching
+gboolean on_search_entry_text_changed() {
+    TRACE("on_search_entry_text_changed");
+
+    if (search_debounce_id)
+        g_source_remove(search_debounce_id);
+
+    search_debounce_id = g_timeout_add(SEARCH_DEBOUNCE_MS, on_search_debounce_timeout, NULL);
+    return TRUE;
+}
+
+// replace just one match with text from replace_with_entry
+// the edit shifts the remaining matches, so there's no need to search again
+void on_replace_one_clicked(GtkButton *button, gpointer user_data) {
+    TRACE("on_replace_one_clicked");
+
+    gint start_offset, end_offset;
+    if (viewer_doc || tab->file_load) return;
+    if (!search_matches || !match_index_get(search_matches, current_match_index, &start_offset, &end_offset)) return;
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    GtkTextIter start, end;
+
+    const gchar *replacement = gtk_entry_get_text(GTK_ENTRY(replace_with_entry));
+    const gchar *search_text = gtk_entry_get_text(GTK_ENTRY(replace_find_entry));
+    if (!search_text || !*search_text || !search_job) return;
+    if (!check_replacement(search_job->pattern, replacement)) return;
+
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, start_offset);
+    gtk_text_buffer_get_iter_at_offset(buffer, &end, end_offset);
+
+    // capture groups are filled in from the lines the match is on,
+    // using the pattern the search already compiled
+    gchar *expanded;
+    if (search_job->pattern->regex) {
+        GtkTextIter line_start = start, line_end = end;
+        gtk_text_iter_set_line_offset(&line_start, 0);
+        if (!gtk_text_iter_ends_line(&line_end))
+            gtk_text_iter_forward_to_line_end(&line_end);
+
+        gchar *before = gtk_text_iter_get_slice(&line_start, &start);
+        gchar *match = gtk_text_iter_get_slice(&start, &end);
+        gchar *lines = gtk_text_iter_get_slice(&line_start, &line_end);
+        gsize match_start = strlen(before);
+
+        expanded = search_pattern_expand(search_job->pattern, lines, strlen(lines), match_start, match_start + strlen(match), replacement);
+
+        g_free(before);
+        g_free(match);
+        g_free(lines);
+    } else {
+        expanded = g_strdup(replacement);
+    }
+
+    gtk_text_buffer_begin_user_action(buffer);
+    gtk_text_buffer_delete(buffer, &start, &end);
+    gtk_text_buffer_insert(buffer, &start, expanded, -1);
+    gtk_text_buffer_end_user_action(buffer);
+
+    g_free(expanded);
+
+    // the replaced match is gone now, move on to the one after it
+    if (search_matches->count > 0) {
+        select_match(next_match_slot());
+    } else {
+        current_match_index = -1;
+        update_match_label();
+    }
+}
+
+// replace all matches with text from replace_with_entry
+void on_replace_all_clicked(GtkButton *button, gpointer user_data) {
+    TRACE("on_replace_all_clicked");
+
+    if (viewer_doc || tab->file_load) return;
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+
+    const gchar *replacement = gtk_entry_get_text(GTK_ENTRY(replace_with_entry));
+    const gchar *search_text = gtk_entry_get_text(GTK_ENTRY(replace_find_entry));
+    if (!search_text || !*search_text || !replacement) return;
+
+    SearchPattern *pattern = create_search_pattern(search_text);
+    if (!pattern) return;
+
+    if (!check_replacement(pattern, replacement)) {
+        search_pattern_free(pattern);
+        return;
+    }
+
+    clear_search_highlights();
+    gtk_entry_set_text(GTK_ENTRY(search_entry), search_text);
+
+    gchar *text = document_get_text(tab->document, 0, document_get_chars(tab->document));
+    gsize text_len = document_get_length(tab->document);
+
+    GArray *ranges = g_array_new(FALSE, FALSE, sizeof(gsize));
+    GError *error = NULL;
+    search_pattern_find_all(pattern, text, text_len, ranges, &error);
+
+    // replacing only the matches before whatever the regex engine gave up on would be worse than none
+    if (error) {
+        set_match_labels("regex failed ");
+        gtk_widget_set_tooltip_text(match_label, error->message);
+        gtk_widget_set_tooltip_text(replace_match_label, error->message);
+        g_error_free(error);
+        g_array_set_size(ranges, 0);
+    }
+
+    if (ranges->len == 0) {
+        search_pattern_free(pattern);
+        g_array_free(ranges, TRUE);
+        g_free(text);
+        return;
+    }
+
+    // character offsets of the same matches, for the undo journal
+    GArray *offsets = g_array_sized_new(FALSE, FALSE, sizeof(gsize), ranges->len);
+    SearchOffsetCursor cursor = { 0, 0 };
+    g_array_append_vals(offsets, ranges->data, ranges->len);
+    search_ranges_to_char_offsets(text, offsets, 0, &cursor);
+
+    // where each replacement ended up in the new text, they differ per match for regexes
+    GArray *replaced = g_array_sized_new(FALSE, FALSE, sizeof(gsize), ranges->len);
+    GString *result = search_replace_ranges(pattern, text, text_len, ranges, replacement, replaced);
+    gboolean regex = pattern->regex != NULL;
+    search_pattern_free(pattern);
+
+    GtkWidget *scrolled_window = gtk_widget_get_parent(tab->text_view);
+    ScrollState *scroll = g_new(ScrollState, 1);
+    scroll->vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scrolled_window));
+    scroll->hadj = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(scrolled_window));
+    scroll->vscroll = gtk_adjustment_get_value(scroll->vadj);
+    scroll->hscroll = gtk_adjustment_get_value(scroll->hadj);
+
+    // swap the whole text in one go, recorded as a single undo step
+    // made of a delete & insert per match at its position in the new text
+    gtk_text_buffer_begin_user_action(buffer);
+
+    replacing_all = TRUE;
+    gtk_text_buffer_set_text(buffer, result->str, result->len);
+    replacing_all = FALSE;
+
+    gint shift = 0;
+
+    for (guint i = 0; i + 1 < offsets->len; i += 2) {
+        gint start_offset = g_array_index(offsets, gsize, i) + shift;
+        gint end_offset = g_array_index(offsets, gsize, i + 1) + shift;
+        gsize start_byte = g_array_index(ranges, gsize, i);
+        gsize end_byte = g_array_index(ranges, gsize, i + 1);
+        const gchar *inserted = result->str + g_array_index(replaced, gsize, i);
+        gsize inserted_len = g_array_index(replaced, gsize, i + 1) - g_array_index(replaced, gsize, i);
+
+        undo_journal_record_delete(tab->undo_journal, start_offset, text + start_byte, end_byte - start_byte);
+        undo_journal_record_insert(tab->undo_journal, start_offset, inserted, inserted_len);
+
+        shift += g_utf8_strlen(inserted, inserted_len) - (end_offset - start_offset);
+    }
+
+    gtk_text_buffer_end_user_action(buffer);
+    g_idle_add(restore_scroll_position, scroll);
+
+    g_string_free(result, TRUE);
+    g_array_free(ranges, TRUE);
+    g_array_free(replaced, TRUE);
+    g_array_free(offsets, TRUE);
+    g_free(text);
+
+    // a regex replacement isn't something to search for
+    if (!regex)
+        gtk_entry_set_text(GTK_ENTRY(replace_find_entry), gtk_entry_get_text(GTK_ENTRY(replace_with_entry)));
+
+    gtk_entry_set_text(GTK_ENTRY(replace_with_entry), "");
+    on_search_activate(NULL, NULL);
+}
+
+void file_load_free(FileLoad *load) {
+    if (load->stream) g_object_unref(load->stream);
+    g_checksum_free(load->checksum);
+    g_object_unref(load->cancellable);
+    g_object_unref(load->file);
+    g_free(load);
+}
+
+// the load bar follows the tab in front, hidden when it isn't loading
+void show_load_progress(FileLoad *load) {
+    if (!load) {
+        gtk_widget_hide(load_bar);
+        return;
+    }
+
+    gchar *basename = g_file_get_basename(load->file);
+    gchar *progress_text = g_strdup_printf("Loading %s", basename);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(load_progress), progress_text);
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(load_progress),
+        load->size > 0 ? MIN(1.0, (gdouble)load->loaded / load->size) : 0.0);
+    gtk_widget_show(load_bar);
+
+    g_free(progress_text);
+    g_free(basename);
+}
+
+// put the ui back after loading, on failure or cancel the half loaded text goes too
+void end_file_load(FileLoad *load, gboolean loaded) {
+    Tab *t = load->tab;
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(t->text_view));
+    GtkTextIter start;
+
+    t->file_load = NULL;
+
+    if (!loaded) {
+        g_free(t->filename);
+        t->filename = NULL;
+        set_tab_title(t);
+
+        loading_file = TRUE;
+        gtk_text_buffer_set_text(buffer, "", -1);
+        loading_file = FALSE;
+    }
+
+    // a freshly opened file starts with the history it was last saved with, if any
+    undo_journal_clear(t->undo_journal);
+
+    if (loaded) {
+        gchar *path = g_file_get_path(load->file);
+        load_undo_history(t->undo_journal, path, load->checksum);
+        g_free(path);
+    }
+
+    // the journal starts from the file on disk, unless the text isn't quite what's in it
+    if (loaded && !load->decoder.converted) {
+        gchar *path = g_file_get_path(load->file);
+        reset_journal_file(t->edit_journal, path, load->loaded, load->checksum);
+        g_free(path);
+    } else if (loaded) {
+        edit_journal_checkpoint(t->edit_journal, document_snapshot(t->document));
+    } else {
+        edit_journal_reset_empty(t->edit_journal);
+    }
+
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    gtk_text_buffer_place_cursor(buffer, &start);
+
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(t->text_view), TRUE);
+
+    if (t == tab)
+        gtk_widget_hide(load_bar);
+}
+
+void cancel_file_load(Tab *t) {
+    if (!t->file_load) return;
+
+    // the pending read finishes with an error and frees the load
+    g_cancellable_cancel(t->file_load->cancellable);
+    end_file_load(t->file_load, FALSE);
+}
+
+void on_load_cancel_clicked(GtkButton *button, gpointer user_data) {
+    TRACE("on_load_cancel_clicked");
+
+    cancel_file_load(tab);
+}
+
+// the viewer over a tab's file, which can still be edited from there if it isn't too big
+void view_tab_file(Tab *t) {
+    open_large_file(t->filename);
+    if (!viewer_doc) return;
+
+    viewer_tab = t;
+    if ((goffset)viewer_doc->len < LARGE_FILE_SIZE)
+        gtk_widget_show(edit_anyway_bar);
+}
+
+// a line too long to lay out turned up while reading, so the tab stops loading & waits
+// for the viewer instead, which takes it over right away if it's in front
+void view_long_lines(FileLoad *load) {
+    Tab *t = load->tab;
+    gchar *filename = g_strdup(t->filename);
+
+    end_file_load(load, FALSE);
+    file_load_free(load);
+
+    t->filename = filename;
+    t->loaded = FALSE;
+    t->large = TRUE;
+    set_tab_title(t);
+
+    // not over a file the viewer was opened on by hand
+    if (t == tab && !viewer_doc)
+        view_tab_file(t);
+}
+
+void on_file_chunk_read(GObject *source, GAsyncResult *result, gpointer data) {
+    TRACE("on_file_chunk_read");
+
+    FileLoad *load = (FileLoad *)data;
+    GBytes *bytes = g_input_stream_read_bytes_finish(G_INPUT_STREAM(source), result, NULL);
+
+    // cancelled, another file is being opened in its tab or the tab was closed
+    if (g_cancellable_is_cancelled(load->cancellable)) {
+        if (bytes) g_bytes_unref(bytes);
+        file_load_free(load);
+        return;
+    }
+
+    if (!bytes) {
+        end_file_load(load, FALSE);
+        file_load_free(load);
+        return;
+    }
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(load->tab->text_view));
+    gsize len;
+    const gchar *chunk = (const gchar *)g_bytes_get_data(bytes, &len);
+
+    if (!load->tab->edit_anyway && has_long_line(chunk, len, &load->line_run, LONG_LINE_SIZE)) {
+        g_bytes_unref(bytes);
+        view_long_lines(load);
+        return;
+    }
+
+    loading_file = TRUE;
+
+    if (len == 0) {
+        // end of file, whatever is left over was never finished
+        text_decoder_finish(&load->decoder, append_decoded_text, buffer);
+
+        loading_file = FALSE;
+        g_bytes_unref(bytes);
+        end_file_load(load, TRUE);
+        file_load_free(load);
+        return;
+    }
+
+    text_decoder_feed(&load->decoder, chunk, len, append_decoded_text, buffer);
+    loading_file = FALSE;
+
+    g_checksum_update(load->checksum, (const guchar *)chunk, len);
+
+    load->loaded += len;
+    if (load->size > 0 && load->tab == tab)
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(load_progress), MIN(1.0, (gdouble)load->loaded / load->size));
+
+    g_bytes_unref(bytes);
+    g_input_stream_read_bytes_async(load->stream, LOAD_CHUNK_SIZE, G_PRIORITY_DEFAULT, load->cancellable, on_file_chunk_read, load);
+}
+
+void on_file_opened(GObject *source, GAsyncResult *result, gpointer data) {
+    TRACE("on_file_opened");
+
+    FileLoad *load = (FileLoad *)data;
+    GFileInputStream *stream = g_file_read_finish(G_FILE(source), result, NULL);
+
+    if (g_cancellable_is_cancelled(load->cancellable)) {
+        if (stream) g_object_unref(stream);
+        file_load_free(load);
+        return;
+    }
+
+    if (!stream) {
+        end_file_load(load, FALSE);
+        file_load_free(load);
+        return;
+    }
+
+    load->stream = G_INPUT_STREAM(stream);
+
+    GFileInfo *info = g_file_input_stream_query_info(stream,
+        G_FILE_ATTRIBUTE_STANDARD_SIZE, NULL, NULL);
+    if (info) {
+        load->size = g_file_info_get_size(info);
+        g_object_unref(info);
+    }
+
+    g_input_stream_read_bytes_async(load->stream, LOAD_CHUNK_SIZE, G_PRIORITY_DEFAULT, load->cancellable, on_file_chunk_read, load);
+}
+
+// go back to the tabs from the large file viewer
+void close_viewer() {
+    if (!viewer_doc) return;
+
+    stop_search();
+    clear_search_highlights();
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(viewer_view));
+    gtk_text_buffer_set_text(buffer, "", -1);
+
+    mapped_doc_free(viewer_doc);
+    viewer_doc = NULL;
+    buffer_generation++;
+
+    gtk_widget_hide(viewer_box);
+    gtk_widget_hide(edit_anyway_bar);
+    gtk_widget_show(notebook);
+    show_load_progress(tab->file_load);
+    update_label_text();
+
+    if (viewer_tab) {
+        Tab *t = viewer_tab;
+        viewer_tab = NULL;
+        close_tab(t);
+    }
+}
+
+// map a file instead of loading it, only the lines on screen are ever put in a buffer
+// so opening takes the same time whatever the size, but the file can't be edited
+// it covers the tabs, which are left as they were underneath
+void open_large_file(const gchar *filename) {
+    MappedDoc *doc = mapped_doc_open(filename, NULL);
+    if (!doc) return;
+
+    stop_search();
+    clear_search_highlights();
+    close_viewer();
+
+    viewer_doc = doc;
+    buffer_generation++;
+
+    viewer_scrolling = TRUE;
+    gtk_adjustment_configure(viewer_adjustment, 0, 0, doc->len, VIEWER_MAX_LINE, VIEWER_WINDOW_BYTES, 0);
+    viewer_scrolling = FALSE;
+
+    gtk_widget_hide(notebook);
+    gtk_widget_hide(load_bar);
+    gtk_widget_show(viewer_box);
+    gtk_widget_grab_focus(viewer_view);
+
+    viewer_show(0);
+}
+
+// read a file into the tab in front a chunk at a time without blocking the ui,
+// so only about one chunk is held on top of the document itself
+void load_file(const gchar *filename) {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    gchar *name = g_strdup(filename); // may be the tab's own
+
+    cancel_file_load(tab);
+    close_viewer();
+    stop_search();
+    clear_search_highlights();
+
+    g_free(tab->filename);
+    tab->filename = name;
+    tab->loaded = TRUE;
+    set_tab_title(tab);
+
+    // the history of whatever was in the tab doesn't apply to the new text
+    undo_journal_clear(tab->undo_journal);
+
+    FileLoad *load = g_new0(FileLoad, 1);
+    load->tab = tab;
+    load->file = g_file_new_for_path(name);
+    load->cancellable = g_cancellable_new();
+    text_decoder_init(&load->decoder);
+    load->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    tab->file_load = load;
+
+    loading_file = TRUE;
+    gtk_text_buffer_set_text(buffer, "", -1);
+    loading_file = FALSE;
+
+    // no typing into a half loaded file
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(tab->text_view), FALSE);
+
+    show_load_progress(load);
+
+    g_file_read_async(load->file, G_PRIORITY_DEFAULT, load->cancellable, on_file_opened, load);
 }
 
-// change max undo limit
-void on_set_undo_limit_activate(GtkWidget *widget, gpointer data) {
-    GtkWidget *dialog = gtk_dialog_new_with_buttons(
-        "Set Max Undo History",
-        GTK_WINDOW(window),
-        (GtkDialogFlags)(GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT),
-        "_Cancel", GTK_RESPONSE_CANCEL,
-        "_OK", GTK_RESPONSE_ACCEPT,
-        NULL
-    );
+gboolean insert_recovered_piece(const gchar *text, gsize len, gpointer user_data) {
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(GTK_TEXT_BUFFER(user_data), &end);
+    gtk_text_buffer_insert(GTK_TEXT_BUFFER(user_data), &end, text, len);
+    return TRUE;
+}
 
-    GtkWidget *content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-    GtkWidget *spin = gtk_spin_button_new_with_range(1, 1000, 1);
-    gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin), max_undo_history);
-    gtk_container_add(GTK_CONTAINER(content_area), spin);
-    gtk_widget_show_all(dialog);
+// fill a buffer from a document, already in the journal so it's not recorded again
+void insert_document(GtkTextBuffer *buffer, Document *doc) {
+    DocSnapshot *snapshot = document_snapshot(doc);
 
-    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
-        max_undo_history = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(spin));
+    loading_file = TRUE;
+    doc_snapshot_foreach(snapshot, insert_recovered_piece, buffer);
+    loading_file = FALSE;
 
-        if (g_list_length(undo_stack) > max_undo_history) {
-            GList *last_allowed = g_list_nth(undo_stack, max_undo_history - 1);
-            GList *excess = last_allowed->next;
-            last_allowed->next = NULL;
-            g_list_free_full(excess, (GDestroyNotify)g_free);
-        }
+    doc_snapshot_free(snapshot);
+}
+
+// a new tab at the end, for a file that gets read in once the tab is first shown,
+// or with the text already in journal, or empty
+Tab *add_tab(const gchar *filename, EditJournal *journal) {
+    Tab *t = g_new0(Tab, 1);
+    t->filename = g_strdup(filename);
+    t->loaded = !filename || journal;
+    t->last_active = g_get_monotonic_time();
+    t->document = document_new();
+    t->undo_journal = undo_journal_new((gsize)max_undo_memory * 1024 * 1024);
+    doc_stats_reset(&t->doc_stats);
+
+    if (!journal) {
+        gchar *path = NULL;
+
+        do {
+            gchar *name = g_strdup_printf("journal-%d-%u", (int)getpid(), next_journal_id++);
+            g_free(path);
+            path = g_build_filename(journal_dir, name, NULL);
+            g_free(name);
+        } while (g_file_test(path, G_FILE_TEST_EXISTS));
+
+        journal = edit_journal_open(path);
+        edit_journal_reset_empty(journal);
+        g_free(path);
     }
 
-    gtk_widget_destroy(dialog);
+    t->edit_journal = journal;
+    t->journal_path = g_strdup(journal->path);
+
+    // scrolling for text view
+    t->scrolled_window = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(t->scrolled_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+
+    // text view, every buffer shares the tags so matches highlight the same
+    GtkTextBuffer *buffer = gtk_text_buffer_new(tag_table);
+    t->text_view = gtk_text_view_new_with_buffer(buffer);
+    g_object_unref(buffer);
+
+    // font, set on the view rather than tagged onto the text
+    gtk_style_context_add_provider(gtk_widget_get_style_context(t->text_view),
+        GTK_STYLE_PROVIDER(font_provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+
+    GtkTextIter buffer_start;
+    gtk_text_buffer_get_start_iter(buffer, &buffer_start);
+    t->highlight_start_mark = gtk_text_buffer_create_mark(buffer, NULL, &buffer_start, TRUE);
+    t->highlight_end_mark = gtk_text_buffer_create_mark(buffer, NULL, &buffer_start, FALSE);
+
+    g_signal_connect(buffer, "insert-text", G_CALLBACK(on_insert_text), t);
+    g_signal_connect(buffer, "delete-range", G_CALLBACK(on_delete_range), t);
+    g_signal_connect(buffer, "begin-user-action", G_CALLBACK(on_begin_user_action), t);
+    g_signal_connect(buffer, "end-user-action", G_CALLBACK(on_end_user_action), t);
+    g_signal_connect(buffer, "changed", G_CALLBACK(on_text_changed), t);
+    g_signal_connect(buffer, "notify::cursor-position", G_CALLBACK(on_cursor_moved), t);
+    gtk_container_add(GTK_CONTAINER(t->scrolled_window), t->text_view);
+
+    // keep the highlighted matches following the view
+    g_signal_connect(gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(t->scrolled_window)), "value-changed", G_CALLBACK(on_view_scrolled), t);
+    g_signal_connect(t->text_view, "size-allocate", G_CALLBACK(on_view_size_allocate), t);
+
+    t->label = gtk_label_new(NULL);
+    set_tab_title(t);
+
+    g_object_set_data(G_OBJECT(t->scrolled_window), "tab", t);
+    gtk_widget_show_all(t->scrolled_window);
+    g_ptr_array_add(tabs, t);
+
+    gtk_notebook_append_page(GTK_NOTEBOOK(notebook), t->scrolled_window, t->label);
+    gtk_notebook_set_tab_reorderable(GTK_NOTEBOOK(notebook), t->scrolled_window, TRUE);
+
+    return t;
 }
 
-// update search colors
-void on_search_activate(GtkEntry *entry, gpointer user_data) {
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-    GtkTextIter start, match_start, match_end;
+void free_tab(Tab *t) {
+    document_free(t->document);
+    undo_journal_free(t->undo_journal);
+    g_free(t->journal_path);
+    g_free(t->filename);
+    g_free(t);
+}
 
-    // get the search text
-    const gchar *search_text = NULL;
-    if (gtk_widget_is_visible(replace_bar)) {
-        search_text = gtk_entry_get_text(GTK_ENTRY(replace_find_entry));
+// nothing left to recover once a tab is closed on purpose
+void discard_tab_journal(Tab *t) {
+    if (t->edit_journal) {
+        edit_journal_close(t->edit_journal, TRUE);
+        t->edit_journal = NULL;
     } else {
-        search_text = gtk_entry_get_text(GTK_ENTRY(search_entry));
+        g_unlink(t->journal_path);
     }
+}
 
-    gboolean case_sensitive = get_case_sensitive_setting();
+void select_tab(Tab *t) {
+    close_viewer();
+    gtk_notebook_set_current_page(GTK_NOTEBOOK(notebook), gtk_notebook_page_num(GTK_NOTEBOOK(notebook), t->scrolled_window));
+    gtk_widget_grab_focus(t->text_view);
+}
 
-    clear_search_highlights();
-    if (!search_text || !*search_text) {
-        gtk_label_set_text(GTK_LABEL(match_label), "0 matches ");
-        gtk_label_set_text(GTK_LABEL(replace_match_label), " 0 matches ");
-        return;
-    }
+// the tab the viewer took its file from loads it after all, long lines & all
+void on_edit_anyway_clicked(GtkButton *button, gpointer user_data) {
+    TRACE("on_edit_anyway_clicked");
 
-    gtk_text_buffer_get_start_iter(buffer, &start);
-    search_matches = g_array_new(FALSE, FALSE, sizeof(GtkTextIter));
+    Tab *t = viewer_tab;
+    if (!t) return;
 
-    // get text start & end and color it
-    while (!gtk_text_iter_is_end(&start)) {
-        GtkTextIter tmp = start;
-        GtkTextIter end;
-        gunichar *buffer_text = NULL;
+    // the tab stays when the viewer closes, & loads once it's back in front
+    viewer_tab = NULL;
+    t->large = FALSE;
+    t->edit_anyway = TRUE;
+    select_tab(t);
 
-        gtk_text_buffer_get_end_iter(buffer, &end);
-        gchar *text = gtk_text_iter_get_text(&tmp, &end);
-        gchar *pos = NULL;
+    if (!t->loaded)
+        load_file(t->filename);
+}
 
-        if (case_sensitive) {
-            pos = g_strstr_len(text, -1, search_text);
-        } else {
-            gchar *lower_text = g_utf8_strdown(text, -1);
-            gchar *lower_search = g_utf8_strdown(search_text, -1);
-            gchar *match = g_strstr_len(lower_text, -1, lower_search);
+// unsaved changes go the same way as when quitting
+void close_tab(Tab *t) {
+    if (t == viewer_tab) viewer_tab = NULL;
 
-            if (match) {
-                pos = text + (match - lower_text);
-            }
+    // there's always a tab to type in
+    if (tabs->len == 1)
+        select_tab(add_tab(NULL, NULL));
 
-            g_free(lower_text);
-            g_free(lower_search);
-        }
+    cancel_file_load(t);
+    g_ptr_array_remove(tabs, t);
 
-        if (!pos) {
-            g_free(text);
-            break;
-        }
+    // the tab after it comes to the front first if it was in front
+    gtk_notebook_remove_page(GTK_NOTEBOOK(notebook), gtk_notebook_page_num(GTK_NOTEBOOK(notebook), t->scrolled_window));
+    discard_tab_journal(t);
 
-        int offset = g_utf8_pointer_to_offset(text, pos);
-        gtk_text_iter_set_offset(&start, gtk_text_iter_get_offset(&start) + offset);
+    if (t->saving || t->unloading) {
+        t->closed = TRUE;
+        return;
+    }
 
-        match_start = start;
-        match_end = match_start;
-        gtk_text_iter_forward_chars(&match_end, g_utf8_strlen(search_text, -1));
+    free_tab(t);
+}
 
-        g_array_append_val(search_matches, match_start);
-        g_array_append_val(search_matches, match_end);
+// the journal has all of the text on disk now, so the buffer can let it go
+// unless the tab was picked, edited or closed in the meantime
+void on_unload_written(gboolean intact, gpointer user_data) {
+    TRACE("on_unload_written");
 
-        gtk_text_buffer_apply_tag(buffer, highlight_tag, &match_start, &match_end);
+    Tab *t = (Tab *)user_data;
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(t->text_view));
+    GtkTextIter cursor;
 
-        start = match_end;
+    t->unloading = FALSE;
 
-        g_free(text);
+    if (t->closed) {
+        if (!t->saving) free_tab(t);
+        return;
     }
 
-    update_match_label();
+    if (t == tab || t->edit_journal->logged > 0 || t->file_load || t->saving) return;
 
-    if (search_matches->len > 0) {
-        select_match(0);
-    } else {
-        gtk_label_set_text(GTK_LABEL(match_label), "0 matches ");
-        gtk_label_set_text(GTK_LABEL(replace_match_label), " 0 matches ");
+    // a journal that failed to write along the way isn't trusted with the only copy
+    if (!intact) {
+        edit_journal_close(t->edit_journal, FALSE);
+        t->edit_journal = edit_journal_open(t->journal_path);
+        edit_journal_checkpoint(t->edit_journal, document_snapshot(t->document));
+        return;
     }
-}
 
-void on_find_next_clicked(GtkButton *button, gpointer user_data) {
-    if (!search_matches || search_matches->len == 0) return;
-    int total = search_matches->len / 2;
-    select_match((current_match_index + 1) % total);
-}
+    // nothing left for the writer to do, so this doesn't wait
+    edit_journal_close(t->edit_journal, FALSE);
+    t->edit_journal = NULL;
 
-void on_find_prev_clicked(GtkButton *button, gpointer user_data) {
-    if (!search_matches || search_matches->len == 0) return;
-    int total = search_matches->len / 2;
-    select_match((current_match_index - 1 + total) % total);
-}
+    gtk_text_buffer_get_iter_at_mark(buffer, &cursor, gtk_text_buffer_get_insert(buffer));
+    t->cursor = gtk_text_iter_get_offset(&cursor);
 
-void show_search_bar() {
-    gtk_widget_hide(replace_bar);
-    gtk_widget_show(search_bar);
+    loading_file = TRUE;
+    gtk_text_buffer_set_text(buffer, "", -1);
+    loading_file = FALSE;
 
-    gtk_widget_grab_focus(search_entry);
-    on_search_activate(NULL, NULL);
+    t->unloaded = TRUE;
 }
 
-void show_replace_bar() {
-    gtk_widget_hide(search_bar);
-    gtk_widget_show(replace_bar);
+// drop the text of a tab in the background, its journal keeps it on disk
+// the undo history stays, it lines up with the same text once it's back
+// the checkpoint is written on the journal's own thread, the text goes once it's done
+void unload_tab(Tab *t) {
+    // a checkpoint has all of the text, so it comes back even if the file it was opened from changes
+    if (t->edit_journal->logged > 0)
+        edit_journal_checkpoint(t->edit_journal, document_snapshot(t->document));
 
-    gtk_widget_grab_focus(replace_find_entry);
-    on_search_activate(NULL, NULL);
+    t->unloading = TRUE;
+    edit_journal_when_written(t->edit_journal, on_unload_written, t);
 }
 
-// keybinds
-gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data) {
+// read the text of the tab in front back out of its journal
+void restore_tab() {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
+    GtkTextIter cursor;
+    Document *restored = document_new();
 
-    // non-ctrl keybinds
-    switch (event->keyval) {
-        case GDK_KEY_Escape:
-            gtk_widget_hide(search_bar);
-            gtk_widget_hide(replace_bar);
-            clear_search_highlights();
-            gtk_widget_grab_focus(text_view);
-            return TRUE;
-    }
+    tab->edit_journal = edit_journal_open(tab->journal_path);
+    tab->unloaded = FALSE;
 
-    // ctrl keybinds
-    if (event->state & GDK_CONTROL_MASK) {
-        switch (event->keyval) {
-            case GDK_KEY_plus:
-            case GDK_KEY_equal:
-                if (current_font_size < max_font_size) {
-                    current_font_size += 1;
-                    update_font_size();
-                }
-                return TRUE;
+    // only an unedited file base can go stale, so the file itself is the text now
+    if (!edit_journal_restore(tab->edit_journal, restored)) {
+        document_free(restored);
+        undo_journal_clear(tab->undo_journal);
 
-            case GDK_KEY_minus:
-                if (current_font_size > min_font_size) {
-                    current_font_size -= 1;
-                    update_font_size();
-                }
-                return TRUE;
+        if (tab->filename) {
+            load_file(tab->filename);
+        } else {
+            edit_journal_reset_empty(tab->edit_journal);
+        }
 
-            case GDK_KEY_0:
-            case GDK_KEY_KP_0:
-                current_font_size = 12;
-                update_font_size();
-                return TRUE;
+        return;
+    }
 
-            case GDK_KEY_z:
-                undo();
-                return TRUE;
+    insert_document(buffer, restored);
+    document_free(restored);
 
-            case GDK_KEY_y:
-                redo();
-                return TRUE;
+    gtk_text_buffer_get_iter_at_offset(buffer, &cursor, tab->cursor);
+    gtk_text_buffer_place_cursor(buffer, &cursor);
+    gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(tab->text_view), gtk_text_buffer_get_insert(buffer), 0.0, TRUE, 0.0, 0.5);
+}
 
-            case GDK_KEY_f:
-                show_search_bar();
-                return TRUE;
+// matches belong to the buffer they were found in, so searching starts over in the new tab
+void on_switch_page(GtkNotebook *book, GtkWidget *page, guint page_num, gpointer user_data) {
+    TRACE("on_switch_page");
 
-            case GDK_KEY_g:
-                show_replace_bar();
-                return TRUE;
+    Tab *next = (Tab *)g_object_get_data(G_OBJECT(page), "tab");
+    if (next == tab) return;
 
-        }
-    }
+    stop_search();
 
-    // moving match index based on enter key press
-    // and whether or not shift is held
-    if (gtk_widget_has_focus(search_entry)) {
-        if (event->keyval == GDK_KEY_Return || event->keyval == GDK_KEY_KP_Enter) {
-            if (search_matches && search_matches->len > 0) {
-                int total_matches = search_matches->len / 2;
+    if (tab) {
+        clear_search_highlights();
+        tab->last_active = g_get_monotonic_time();
+    }
 
-                if (event->state & GDK_SHIFT_MASK) {
-                    on_find_next_clicked(NULL, NULL);
-                } else {
-                    on_find_prev_clicked(NULL, NULL);
-                }
+    tab = next;
+    buffer_generation++;
 
-                return TRUE;
-            }
-        }
+    if (!tab->loaded && tab->large) {
+        view_tab_file(tab);
+    } else if (!tab->loaded) {
+        load_file(tab->filename);
+    } else if (tab->unloaded) {
+        restore_tab();
     }
 
-    return FALSE;
+    show_load_progress(tab->file_load);
+    update_label_text();
+
+    if (gtk_widget_is_visible(search_bar) || gtk_widget_is_visible(replace_bar))
+        on_search_activate(NULL, NULL);
 }
 
-// both for find & replace
-gboolean on_search_entry_text_changed() {
-    clear_search_highlights();
-    on_search_activate(NULL, NULL);
-    return TRUE;
+// tabs in the background left alone for a while give their text back, all of them when it's critical
+void on_low_memory_warning(GMemoryMonitor *monitor, GMemoryMonitorWarningLevel level, gpointer user_data) {
+    TRACE("on_low_memory_warning");
+
+    gint64 idle_since = g_get_monotonic_time();
+    if (level < G_MEMORY_MONITOR_WARNING_LEVEL_CRITICAL)
+        idle_since -= TAB_UNLOAD_IDLE_SECONDS * G_USEC_PER_SEC;
+
+    for (guint i = 0; i < tabs->len; i++) {
+        Tab *t = (Tab *)g_ptr_array_index(tabs, i);
+
+        if (t == tab || !t->loaded || t->unloading || t->unloaded || t->file_load || t->saving) continue;
+        if (t->last_active > idle_since || document_get_length(t->document) < TAB_UNLOAD_MIN_SIZE) continue;
+
+        unload_tab(t);
+    }
 }
 
-// replace just one match with text from replace_with_entry
-void on_replace_one_clicked(GtkButton *button, gpointer user_data) {
-    if (!search_matches || search_matches->len == 0 || current_match_index < 0) return;
+// create new file, in a tab of its own
+void new_file(GtkWidget *widget, gpointer data) {
+    TRACE("new_file");
 
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-    GtkTextIter *start = &g_array_index(search_matches, GtkTextIter, current_match_index * 2);
-    GtkTextIter *end = &g_array_index(search_matches, GtkTextIter, current_match_index * 2 + 1);
+    select_tab(add_tab(NULL, NULL));
+}
 
-    const gchar *replacement = gtk_entry_get_text(GTK_ENTRY(replace_with_entry));
-    const gchar *search_text = gtk_entry_get_text(GTK_ENTRY(replace_find_entry));
-    if (!search_text || !*search_text) return;
+void on_close_tab_activate(GtkWidget *widget, gpointer data) {
+    TRACE("on_close_tab_activate");
 
-    gtk_text_buffer_delete(buffer, start, end);
-    gtk_text_buffer_insert(buffer, start, replacement, -1);
+    if (viewer_doc) {
+        close_viewer();
+    } else {
+        close_tab(tab);
+    }
+}
 
-    on_search_activate(NULL, NULL);
+gboolean is_large_file(const gchar *filename) {
+    GFile *file = g_file_new_for_path(filename);
+    GFileInfo *info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    gboolean large = info && g_file_info_get_size(info) >= LARGE_FILE_SIZE;
+
+    if (info) g_object_unref(info);
+    g_object_unref(file);
+    return large;
 }
 
-// replace all matches with text from replace_with_entry
-void on_replace_all_clicked(GtkButton *button, gpointer user_data) {
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+// the first file is shown, the rest wait in tabs until they're picked
+// an untouched empty tab gets used instead of being left behind
+void open_files(GSList *filenames) {
+    gboolean shown = FALSE;
+
+    for (GSList *item = filenames; item; item = item->next) {
+        const gchar *filename = (const gchar *)item->data;
+
+        // files too big to edit comfortably open in the viewer, which holds just one,
+        // the ones that wait in tabs take its place once they're picked
+        // (files with long lines get there too, once reading them finds one)
+        if (is_large_file(filename)) {
+            if (shown) {
+                add_tab(filename, NULL)->large = TRUE;
+            } else {
+                open_large_file(filename);
+            }
 
-    const gchar *replacement = gtk_entry_get_text(GTK_ENTRY(replace_with_entry));
-    const gchar *search_text = gtk_entry_get_text(GTK_ENTRY(replace_find_entry));
-    if (!search_text || !*search_text || !replacement) return;
+            shown = TRUE;
+        } else if (shown) {
+            add_tab(filename, NULL);
+        } else if (!tab->filename && !tab->file_load && document_get_chars(tab->document) == 0) {
+            load_file(filename);
+            shown = TRUE;
+        } else {
+            select_tab(add_tab(filename, NULL));
+            shown = TRUE;
+        }
+    }
+}
 
-    clear_search_highlights();
-    gtk_entry_set_text(GTK_ENTRY(search_entry), search_text);
-    on_search_activate(NULL, NULL);
+// prompt user to open new files
+void open_file(GtkWidget *widget, gpointer data) {
+    TRACE("open_file");
+
+    GtkWidget *dialog;
 
-    if (!search_matches || search_matches->len == 0) return;
+    dialog = gtk_file_chooser_dialog_new(
+        "Open File",
+        GTK_WINDOW(data),
+        GTK_FILE_CHOOSER_ACTION_OPEN,
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_Open", GTK_RESPONSE_ACCEPT,
+        NULL
+    );
 
-    GArray *offsets = g_array_new(FALSE, FALSE, sizeof(int));
+    gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
 
-    for (int i = 0; i < search_matches->len; i++) {
-        GtkTextIter iter = g_array_index(search_matches, GtkTextIter, i);
-        int offset = gtk_text_iter_get_offset(&iter);
-        g_array_append_val(offsets, offset);
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        GSList *filenames = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(dialog));
+        open_files(filenames);
+        g_slist_free_full(filenames, g_free);
     }
 
-    for (int i = offsets->len - 2; i >= 0; i -= 2) {
-        int start_offset = g_array_index(offsets, int, i);
-        int end_offset = g_array_index(offsets, int, i + 1);
+    gtk_widget_destroy(dialog);
+}
+
+// open any file in the read only viewer
+void open_large_file_activate(GtkWidget *widget, gpointer data) {
+    TRACE("open_large_file_activate");
 
-        GtkTextIter start_iter, end_iter;
-        gtk_text_buffer_get_iter_at_offset(buffer, &start_iter, start_offset);
-        gtk_text_buffer_get_iter_at_offset(buffer, &end_iter, end_offset);
+    GtkWidget *dialog = gtk_file_chooser_dialog_new(
+        "Open Large File",
+        GTK_WINDOW(data),
+        GTK_FILE_CHOOSER_ACTION_OPEN,
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_Open", GTK_RESPONSE_ACCEPT,
+        NULL
+    );
 
-        gtk_text_buffer_delete(buffer, &start_iter, &end_iter);
-        gtk_text_buffer_insert(buffer, &start_iter, replacement, -1);
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        char *filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        open_large_file(filename);
+        g_free(filename);
     }
 
-    g_array_free(offsets, TRUE);
-    gtk_entry_set_text(GTK_ENTRY(replace_find_entry), gtk_entry_get_text(GTK_ENTRY(replace_with_entry)));
-    gtk_entry_set_text(GTK_ENTRY(replace_with_entry), "");
-    on_search_activate(NULL, NULL);
+    gtk_widget_destroy(dialog);
 }
 
 // prompt user to select a file where then
 // itll insert the name of said file (including file extension) to where the cursor position is
 void on_insert_file_name_activate(GtkWidget *widget, gpointer data) {
+    TRACE("on_insert_file_name_activate");
+
     GtkWidget *dialog = gtk_file_chooser_dialog_new(
         "Insert File Name",
         GTK_WINDOW(window),
@@ -682,7 +2971,7 @@ void on_insert_file_name_activate(GtkWidget *widget, gpointer data) {
         char *filepath = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
         char *basename = g_path_get_basename(filepath);
 
-        GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+        GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
         GtkTextIter cursor;
         gtk_text_buffer_get_iter_at_mark(buffer, &cursor,
             gtk_text_buffer_get_insert(buffer));
@@ -698,6 +2987,8 @@ void on_insert_file_name_activate(GtkWidget *widget, gpointer data) {
 // prompt user to select a file where then
 // itll insert the path to the file (including name & file extension)
 void on_insert_file_path_activate(GtkWidget *widget, gpointer data) {
+    TRACE("on_insert_file_path_activate");
+
     GtkWidget *dialog = gtk_file_chooser_dialog_new(
         "Select File",
         GTK_WINDOW(window),
@@ -711,7 +3002,7 @@ void on_insert_file_path_activate(GtkWidget *widget, gpointer data) {
         char *filepath = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
 
         if (filepath) {
-            GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+            GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
             GtkTextIter cursor;
             gtk_text_buffer_get_iter_at_mark(buffer, &cursor,
                 gtk_text_buffer_get_insert(buffer));
@@ -726,6 +3017,8 @@ void on_insert_file_path_activate(GtkWidget *widget, gpointer data) {
 // prompts the user to pick a specific date format
 // then gets the current time, formats it, and inserts it
 void on_insert_current_date_activated(GtkWidget *widget, gpointer data) {
+    TRACE("on_insert_current_date_activated");
+
     GtkWidget *dialog = gtk_dialog_new_with_buttons(
         "Insert Current Date",
         GTK_WINDOW(window),
@@ -761,7 +3054,7 @@ void on_insert_current_date_activated(GtkWidget *widget, gpointer data) {
             gchar buffer[256];
             strftime(buffer, sizeof(buffer), format, local);
 
-            GtkTextBuffer *text_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+            GtkTextBuffer *text_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(tab->text_view));
             GtkTextIter cursor;
             gtk_text_buffer_get_iter_at_mark(text_buffer, &cursor,
                 gtk_text_buffer_get_insert(text_buffer));
@@ -772,7 +3065,86 @@ void on_insert_current_date_activated(GtkWidget *widget, gpointer data) {
     gtk_widget_destroy(dialog);
 }
 
+typedef struct {
+    EditJournal *journal;
+    Document *doc;
+    gchar *base_path;
+} RecoveredJournal;
+
+// journals are named journal-<pid>-<n>, ones of a notebook that's still running are left alone
+gboolean journal_in_use(const gchar *name) {
+    int pid;
+    return sscanf(name, "journal-%d-", &pid) == 1 && pid != getpid() && kill(pid, 0) == 0;
+}
+
+// offer back whatever the journals hold from sessions that never got to quit
+void recover_unsaved_work() {
+    GDir *dir = g_dir_open(journal_dir, 0, NULL);
+    if (!dir) return;
+
+    GArray *found = g_array_new(FALSE, FALSE, sizeof(RecoveredJournal));
+    const gchar *name;
+
+    while ((name = g_dir_read_name(dir))) {
+        if (!g_str_has_prefix(name, "journal") || g_str_has_suffix(name, ".new") || journal_in_use(name)) continue;
+
+        gchar *path = g_build_filename(journal_dir, name, NULL);
+        RecoveredJournal recovered = { edit_journal_open(path), document_new(), NULL };
+        g_free(path);
+
+        if (edit_journal_replay(recovered.journal, recovered.doc, &recovered.base_path)) {
+            g_array_append_val(found, recovered);
+        } else {
+            edit_journal_close(recovered.journal, TRUE);
+            document_free(recovered.doc);
+        }
+    }
+
+    g_dir_close(dir);
+
+    if (found->len == 0) {
+        g_array_free(found, TRUE);
+        return;
+    }
+
+    RecoveredJournal *first = &g_array_index(found, RecoveredJournal, 0);
+    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_MODAL,
+        GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO, "Recover unsaved changes?");
+
+    if (found->len == 1) {
+        gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog),
+            "Notebook didn't close properly last time, there were unsaved changes to %s.",
+            first->base_path ? first->base_path : "a new document");
+    } else {
+        gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog),
+            "Notebook didn't close properly last time, there were unsaved changes to %u documents.", found->len);
+    }
+
+    gboolean recover = gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_YES;
+    gtk_widget_destroy(dialog);
+
+    for (guint i = 0; i < found->len; i++) {
+        RecoveredJournal *recovered = &g_array_index(found, RecoveredJournal, i);
+
+        // each gets a tab that carries on with the same journal
+        if (recover) {
+            Tab *t = add_tab(recovered->base_path, recovered->journal);
+            insert_document(gtk_text_view_get_buffer(GTK_TEXT_VIEW(t->text_view)), recovered->doc);
+        } else {
+            edit_journal_close(recovered->journal, TRUE);
+        }
+
+        document_free(recovered->doc);
+        g_free(recovered->base_path);
+    }
+
+    g_array_free(found, TRUE);
+}
+
 int main(int argc, char *argv[]) {
+    // find & replace from the command line, no window at all
+    if (batch_requested(argc, argv)) return batch_main(argc, argv);
+
     gtk_init(&argc, &argv);
 
     window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -790,19 +3162,28 @@ int main(int argc, char *argv[]) {
     GtkWidget *file_menu = gtk_menu_new();
     GtkWidget *file_item = gtk_menu_item_new_with_label("File");
 
-    GtkWidget *new_item = gtk_menu_item_new_with_label("New");
+    GtkWidget *new_item = gtk_menu_item_new_with_label("New Tab");
     GtkWidget *open_item = gtk_menu_item_new_with_label("Open");
+    GtkWidget *open_large_item = gtk_menu_item_new_with_label("Open Large File (Read Only)");
     GtkWidget *save_item = gtk_menu_item_new_with_label("Save");
+    GtkWidget *save_as_item = gtk_menu_item_new_with_label("Save As");
+    GtkWidget *close_tab_item = gtk_menu_item_new_with_label("Close Tab");
     GtkWidget *quit_item = gtk_menu_item_new_with_label("Quit");
 
     g_signal_connect(new_item, "activate", G_CALLBACK(new_file), NULL);
     g_signal_connect(open_item, "activate", G_CALLBACK(open_file), window);
+    g_signal_connect(open_large_item, "activate", G_CALLBACK(open_large_file_activate), window);
     g_signal_connect(save_item, "activate", G_CALLBACK(save_file), window);
+    g_signal_connect(save_as_item, "activate", G_CALLBACK(save_file_as), window);
+    g_signal_connect(close_tab_item, "activate", G_CALLBACK(on_close_tab_activate), NULL);
     g_signal_connect(quit_item, "activate", G_CALLBACK(quit_app), NULL);
 
     gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), new_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), open_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), open_large_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), save_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), save_as_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), close_tab_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), quit_item);
     gtk_menu_item_set_submenu(GTK_MENU_ITEM(file_item), file_menu);
     gtk_menu_shell_append(GTK_MENU_SHELL(menu_bar), file_item);
@@ -816,6 +3197,7 @@ int main(int argc, char *argv[]) {
     GtkWidget *edit_separator_1 = gtk_separator_menu_item_new();
     GtkWidget *search_button = gtk_menu_item_new_with_label("Find");
     GtkWidget *replace_button = gtk_menu_item_new_with_label("Replace");
+    GtkWidget *go_to_line_item = gtk_menu_item_new_with_label("Go to Line");
     GtkWidget *edit_separator_2 = gtk_separator_menu_item_new();
     GtkWidget *insert_file_name_item = gtk_menu_item_new_with_label("Insert File Name");
     GtkWidget *insert_file_path_item = gtk_menu_item_new_with_label("Insert File Path");
@@ -825,6 +3207,7 @@ int main(int argc, char *argv[]) {
     g_signal_connect(redo_item, "activate", G_CALLBACK(redo), NULL);
     g_signal_connect(search_button, "activate", G_CALLBACK(show_search_bar), NULL);
     g_signal_connect(replace_button, "activate", G_CALLBACK(show_replace_bar), NULL);
+    g_signal_connect(go_to_line_item, "activate", G_CALLBACK(on_go_to_line_activate), NULL);
     g_signal_connect(insert_file_name_item, "activate", G_CALLBACK(on_insert_file_name_activate), NULL);
     g_signal_connect(insert_file_path_item, "activate", G_CALLBACK(on_insert_file_path_activate), NULL);
     g_signal_connect(insert_current_date, "activate", G_CALLBACK(on_insert_current_date_activated), NULL);
@@ -834,6 +3217,7 @@ int main(int argc, char *argv[]) {
     gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), edit_separator_1);
     gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), search_button);
     gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), replace_button);
+    gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), go_to_line_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), edit_separator_2);
     gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), insert_file_name_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), insert_file_path_item);
@@ -859,50 +3243,77 @@ int main(int argc, char *argv[]) {
     GtkWidget *settings_menu = gtk_menu_new();
     GtkWidget *settings_item = gtk_menu_item_new_with_label("Settings");
 
-    GtkWidget *set_undo_limit_item = gtk_menu_item_new_with_label("Set Max Undo History");
+    GtkWidget *set_undo_limit_item = gtk_menu_item_new_with_label("Set Max Undo Memory");
+    GtkWidget *sync_on_save_item = gtk_check_menu_item_new_with_label("Sync To Disk On Save");
+    GtkWidget *record_trace_item = gtk_check_menu_item_new_with_label("Record Latency Trace");
+    GtkWidget *export_trace_item = gtk_menu_item_new_with_label("Export Latency Trace");
+
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(sync_on_save_item), sync_on_save);
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(record_trace_item), g_getenv("NOTEBOOK_TRACE") != NULL);
 
     g_signal_connect(set_undo_limit_item, "activate", G_CALLBACK(on_set_undo_limit_activate), NULL);
+    g_signal_connect(sync_on_save_item, "toggled", G_CALLBACK(on_sync_on_save_toggled), NULL);
+    g_signal_connect(record_trace_item, "toggled", G_CALLBACK(on_record_trace_toggled), NULL);
+    g_signal_connect(export_trace_item, "activate", G_CALLBACK(export_trace), NULL);
 
     gtk_menu_shell_append(GTK_MENU_SHELL(settings_menu), set_undo_limit_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(settings_menu), sync_on_save_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(settings_menu), record_trace_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(settings_menu), export_trace_item);
     gtk_menu_item_set_submenu(GTK_MENU_ITEM(settings_item), settings_menu);
     gtk_menu_shell_append(GTK_MENU_SHELL(menu_bar), settings_item);
 
     // bottom info text
-    info_text = gtk_label_new(" Characters: 0  Lines: 1  Text Size: 12");
+    info_text = gtk_label_new(" Characters: 0  Words: 0  Lines: 1  Text Size: 12");
     gtk_label_set_xalign(GTK_LABEL(info_text), 0.0);
 
-    // scrolling for text view
-    GtkWidget *scrolled_window = gtk_scrolled_window_new(NULL, NULL);
-    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
-
-    // text view
-    text_view = gtk_text_view_new();
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-
-    GtkTextIter start, end;
-    gtk_text_buffer_get_start_iter(buffer, &start);
-    gtk_text_buffer_get_end_iter(buffer, &end);
-    gtk_text_buffer_apply_tag(buffer, font_tag, &start, &end);
+    // font, set on the views rather than tagged onto the text
+    font_provider = gtk_css_provider_new();
 
-    // font tag
-    GtkTextTagTable *tag_table = gtk_text_buffer_get_tag_table(buffer);
-    font_tag = gtk_text_tag_new("font_tag");
-    gtk_text_tag_table_add(tag_table, font_tag);
-
-    // highlight tag
+    // highlight tag, in the one table every buffer shares
+    tag_table = gtk_text_tag_table_new();
     highlight_tag = gtk_text_tag_new("highlight");
     g_object_set(highlight_tag, "background", "#DFAF36", NULL);
     gtk_text_tag_table_add(tag_table, highlight_tag);
 
-    g_signal_connect(buffer, "changed", G_CALLBACK(on_text_changed), NULL);
+    // tabs
+    notebook = gtk_notebook_new();
+    tabs = g_ptr_array_new();
+
+    gtk_notebook_set_scrollable(GTK_NOTEBOOK(notebook), TRUE);
+    g_signal_connect(notebook, "switch-page", G_CALLBACK(on_switch_page), NULL);
     g_signal_connect(window, "key-press-event", G_CALLBACK(on_key_press), NULL);
-    gtk_container_add(GTK_CONTAINER(scrolled_window), text_view);
+
+    // large file viewer, shares the tags so matches highlight the same
+    viewer_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    viewer_view = gtk_text_view_new_with_buffer(gtk_text_buffer_new(tag_table));
+    viewer_adjustment = gtk_adjustment_new(0, 0, 0, 0, 0, 0);
+    viewer_breaks = g_array_new(FALSE, FALSE, sizeof(gsize));
+    viewer_strays = g_array_new(FALSE, FALSE, sizeof(gsize));
+
+    GtkWidget *viewer_window = gtk_scrolled_window_new(NULL, NULL);
+    GtkWidget *viewer_scrollbar = gtk_scrollbar_new(GTK_ORIENTATION_VERTICAL, viewer_adjustment);
+
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(viewer_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_EXTERNAL);
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(viewer_view), FALSE);
+    gtk_style_context_add_provider(gtk_widget_get_style_context(viewer_view),
+        GTK_STYLE_PROVIDER(font_provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+    gtk_widget_add_events(viewer_view, GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK);
+
+    g_signal_connect(viewer_adjustment, "value-changed", G_CALLBACK(on_viewer_adjustment_changed), NULL);
+    g_signal_connect(viewer_view, "scroll-event", G_CALLBACK(on_viewer_scroll_event), NULL);
+    g_signal_connect(viewer_view, "key-press-event", G_CALLBACK(on_viewer_key_press), NULL);
+
+    gtk_container_add(GTK_CONTAINER(viewer_window), viewer_view);
+    gtk_box_pack_start(GTK_BOX(viewer_box), viewer_window, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(viewer_box), viewer_scrollbar, FALSE, FALSE, 0);
 
     // ctrl + f search
     search_bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
     search_entry = gtk_entry_new();
 
     case_checkbox = gtk_check_button_new_with_label("Case Sensitive");
+    regex_checkbox = gtk_check_button_new_with_label("Regex");
 
     match_label = gtk_label_new("0 matches ");
     find_prev_button = gtk_button_new_with_label("←");
@@ -914,6 +3325,7 @@ int main(int argc, char *argv[]) {
     g_signal_connect(search_entry, "activate", G_CALLBACK(on_search_activate), NULL);
     g_signal_connect(search_entry, "changed", G_CALLBACK(on_search_entry_text_changed), NULL);
     g_signal_connect(case_checkbox, "toggled", G_CALLBACK(on_search_activate), NULL);
+    g_signal_connect(regex_checkbox, "toggled", G_CALLBACK(on_search_activate), NULL);
     g_signal_connect(find_prev_button, "clicked", G_CALLBACK(on_find_prev_clicked), NULL);
     g_signal_connect(find_next_button, "clicked", G_CALLBACK(on_find_next_clicked), NULL);
 
@@ -921,6 +3333,7 @@ int main(int argc, char *argv[]) {
     gtk_box_pack_start(GTK_BOX(search_bar), find_prev_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(search_bar), find_next_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(search_bar), case_checkbox, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(search_bar), regex_checkbox, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(search_bar), match_label, FALSE, FALSE, 0);
 
     gtk_box_set_spacing(GTK_BOX(search_bar), 4);
@@ -935,6 +3348,7 @@ int main(int argc, char *argv[]) {
     replace_find_prev_button = gtk_button_new_with_label("←");
     replace_find_next_button = gtk_button_new_with_label("→");
     replace_case_checkbox = gtk_check_button_new_with_label("Case Sensitive");
+    replace_regex_checkbox = gtk_check_button_new_with_label("Regex");
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(replace_case_checkbox), TRUE);
 
     gtk_entry_set_placeholder_text(GTK_ENTRY(replace_find_entry), "Find...");
@@ -947,33 +3361,101 @@ int main(int argc, char *argv[]) {
     g_signal_connect(replace_find_prev_button, "clicked", G_CALLBACK(on_find_prev_clicked), NULL);
     g_signal_connect(replace_find_next_button, "clicked", G_CALLBACK(on_find_next_clicked), NULL);
     g_signal_connect(replace_case_checkbox, "toggled", G_CALLBACK(on_search_activate), NULL);
+    g_signal_connect(replace_regex_checkbox, "toggled", G_CALLBACK(on_search_activate), NULL);
 
     gtk_box_pack_start(GTK_BOX(replace_bar), replace_find_entry, TRUE, TRUE, 2);
     gtk_box_pack_start(GTK_BOX(replace_bar), replace_with_entry, TRUE, TRUE, 2);
     gtk_box_pack_start(GTK_BOX(replace_bar), replace_case_checkbox, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(replace_bar), replace_regex_checkbox, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(replace_bar), replace_match_label, FALSE, FALSE, 5);
     gtk_box_pack_start(GTK_BOX(replace_bar), replace_one_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(replace_bar), replace_all_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(replace_bar), replace_find_prev_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(replace_bar), replace_find_next_button, FALSE, FALSE, 0);
 
+    // file loading progress
+    load_bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    load_progress = gtk_progress_bar_new();
+    GtkWidget *load_cancel_button = gtk_button_new_with_label("Cancel");
+
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(load_progress), TRUE);
+    g_signal_connect(load_cancel_button, "clicked", G_CALLBACK(on_load_cancel_clicked), NULL);
+
+    gtk_box_pack_start(GTK_BOX(load_bar), load_progress, TRUE, TRUE, 5);
+    gtk_box_pack_start(GTK_BOX(load_bar), load_cancel_button, FALSE, FALSE, 0);
+
+    // a file the viewer took for its long lines can still be edited
+    edit_anyway_bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    GtkWidget *edit_anyway_label = gtk_label_new("This file has lines too long to edit smoothly, so it's open read only");
+    GtkWidget *edit_anyway_button = gtk_button_new_with_label("Edit Anyway");
+
+    gtk_label_set_xalign(GTK_LABEL(edit_anyway_label), 0.0);
+    g_signal_connect(edit_anyway_button, "clicked", G_CALLBACK(on_edit_anyway_clicked), NULL);
+
+    gtk_box_pack_start(GTK_BOX(edit_anyway_bar), edit_anyway_label, TRUE, TRUE, 5);
+    gtk_box_pack_start(GTK_BOX(edit_anyway_bar), edit_anyway_button, FALSE, FALSE, 0);
+
     // assemble gui
     gtk_box_pack_start(GTK_BOX(vbox), menu_bar, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(vbox), search_bar, FALSE, FALSE, 4);
     gtk_box_pack_start(GTK_BOX(vbox), replace_bar, FALSE, FALSE, 4);
-    gtk_box_pack_start(GTK_BOX(vbox), scrolled_window, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), notebook, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), edit_anyway_bar, FALSE, FALSE, 2);
+    gtk_box_pack_start(GTK_BOX(vbox), viewer_box, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), load_bar, FALSE, FALSE, 2);
     gtk_box_pack_start(GTK_BOX(vbox), info_text, FALSE, FALSE, 2);
 
     // setup
-    update_label_text();
     gtk_widget_show_all(window);
 
     // not a fan of this, but it's necessary
     gtk_widget_hide(search_bar);
     gtk_widget_hide(replace_bar);
+    gtk_widget_hide(load_bar);
+    gtk_widget_hide(viewer_box);
+    gtk_widget_hide(edit_anyway_bar);
+
+    // crash recovery, any journals left behind come back as tabs
+    journal_dir = g_build_filename(g_get_user_cache_dir(), "notebook", NULL);
+    undo_dir = g_build_filename(journal_dir, "undo", NULL);
+    recover_unsaved_work();
+
+    GTask *prune = g_task_new(NULL, NULL, NULL, NULL);
+    g_task_run_in_thread(prune, prune_undo_histories);
+    g_object_unref(prune);
+
+    if (tabs->len == 0)
+        add_tab(NULL, NULL);
+
+    // files named on the command line
+    GSList *filenames = NULL;
+    for (int i = argc - 1; i > 0; i--)
+        filenames = g_slist_prepend(filenames, argv[i]);
+
+    open_files(filenames);
+    g_slist_free(filenames);
+
+    update_font_size();
+    gtk_widget_grab_focus(tab->text_view);
+
+    // tracing
+    GdkFrameClock *frame_clock = gtk_widget_get_frame_clock(window);
+    g_signal_connect(frame_clock, "before-paint", G_CALLBACK(on_frame_before_paint), NULL);
+    g_signal_connect(frame_clock, "after-paint", G_CALLBACK(on_frame_after_paint), NULL);
+
+    if (g_getenv("NOTEBOOK_TRACE")) set_tracing(TRUE);
+
+    // unloading idle tabs
+    memory_monitor = g_memory_monitor_dup_default();
+    g_signal_connect(memory_monitor, "low-memory-warning", G_CALLBACK(on_low_memory_warning), NULL);
 
-    push_undo_state();
     gtk_main();
 
+    // quitting on purpose leaves nothing to recover
+    for (guint i = 0; i < tabs->len; i++)
+        discard_tab_journal((Tab *)g_ptr_array_index(tabs, i));
+
+    g_object_unref(memory_monitor);
+
     return 0;
 }
@@ -0,0 +1,185 @@
+#include "matches.h"
+
+// fenwick trees are 1-based, element 0 is never used
+
+static void fenwick_add(GArray *tree, guint slot, gint delta) {
+    for (guint i = slot + 1; i < tree->len; i += i & -i)
+        g_array_index(tree, gint, i) += delta;
+}
+
+// sum of the first count elements
+static gint fenwick_sum(GArray *tree, guint count) {
+    gint sum = 0;
+
+    for (guint i = count; i > 0; i -= i & -i)
+        sum += g_array_index(tree, gint, i);
+
+    return sum;
+}
+
+static void fenwick_append(GArray *tree, gint value) {
+    guint i = tree->len;
+    gint node = value + fenwick_sum(tree, i - 1) - fenwick_sum(tree, i - (i & -i));
+    g_array_append_val(tree, node);
+}
+
+// how many leading elements sum to less than value, the elements can't be negative
+static guint fenwick_lower_bound(GArray *tree, gint value) {
+    guint n = tree->len - 1;
+    guint step = 1;
+    guint pos = 0;
+    gint sum = 0;
+
+    while (step * 2 <= n)
+        step *= 2;
+
+    for (; step > 0; step /= 2) {
+        if (pos + step <= n && sum + g_array_index(tree, gint, pos + step) < value) {
+            pos += step;
+            sum += g_array_index(tree, gint, pos);
+        }
+    }
+
+    return pos;
+}
+
+static gint match_start(MatchIndex *index, guint slot) {
+    return fenwick_sum(index->gaps, slot + 1);
+}
+
+static gint match_length(MatchIndex *index, guint slot) {
+    return g_array_index(index->lengths, gint, slot);
+}
+
+static gboolean match_is_dead(MatchIndex *index, guint slot) {
+    return g_array_index(index->dead, guint8, slot);
+}
+
+static void kill_match(MatchIndex *index, guint slot) {
+    if (match_is_dead(index, slot)) return;
+
+    g_array_index(index->dead, guint8, slot) = TRUE;
+    fenwick_add(index->live, slot, -1);
+    index->count--;
+}
+
+// move a match's start without moving the ones after it
+static void move_match(MatchIndex *index, guint slot, gint delta) {
+    fenwick_add(index->gaps, slot, delta);
+
+    if (slot + 1 < index->size)
+        fenwick_add(index->gaps, slot + 1, -delta);
+}
+
+MatchIndex *match_index_new() {
+    MatchIndex *index = g_new0(MatchIndex, 1);
+    index->gaps = g_array_new(FALSE, TRUE, sizeof(gint));
+    index->live = g_array_new(FALSE, TRUE, sizeof(gint));
+    index->lengths = g_array_new(FALSE, FALSE, sizeof(gint));
+    index->dead = g_array_new(FALSE, FALSE, sizeof(guint8));
+    match_index_clear(index);
+    return index;
+}
+
+void match_index_free(MatchIndex *index) {
+    g_array_free(index->gaps, TRUE);
+    g_array_free(index->live, TRUE);
+    g_array_free(index->lengths, TRUE);
+    g_array_free(index->dead, TRUE);
+    g_free(index);
+}
+
+void match_index_clear(MatchIndex *index) {
+    g_array_set_size(index->gaps, 1);
+    g_array_set_size(index->live, 1);
+    g_array_set_size(index->lengths, 0);
+    g_array_set_size(index->dead, 0);
+    index->size = 0;
+    index->count = 0;
+}
+
+void match_index_append(MatchIndex *index, gint start, gint end) {
+    gint gap = index->size > 0 ? start - match_start(index, index->size - 1) : start;
+    gint length = end - start;
+    guint8 dead = FALSE;
+
+    fenwick_append(index->gaps, gap);
+    fenwick_append(index->live, 1);
+    g_array_append_val(index->lengths, length);
+    g_array_append_val(index->dead, dead);
+
+    index->size++;
+    index->count++;
+}
+
+gboolean match_index_get(MatchIndex *index, guint slot, gint *start, gint *end) {
+    if (slot >= index->size || match_is_dead(index, slot)) return FALSE;
+
+    *start = match_start(index, slot);
+    *end = *start + match_length(index, slot);
+    return TRUE;
+}
+
+guint match_index_find(MatchIndex *index, gint offset) {
+    return fenwick_lower_bound(index->gaps, offset);
+}
+
+guint match_index_rank(MatchIndex *index, guint slot) {
+    return fenwick_sum(index->live, MIN(slot, index->size));
+}
+
+guint match_index_select(MatchIndex *index, guint n) {
+    return fenwick_lower_bound(index->live, n + 1);
+}
+
+// text typed into the middle of a match breaks it, text right before it pushes it along
+gboolean match_index_insert(MatchIndex *index, gint offset, gint length) {
+    if (length <= 0) return FALSE;
+
+    guint slot = match_index_find(index, offset);
+    gboolean killed = FALSE;
+
+    if (slot > 0 && !match_is_dead(index, slot - 1)
+        && match_start(index, slot - 1) + match_length(index, slot - 1) > offset) {
+        kill_match(index, slot - 1);
+        killed = TRUE;
+    }
+
+    if (slot < index->size)
+        fenwick_add(index->gaps, slot, length);
+
+    return killed;
+}
+
+// matches overlapping the deleted text die, the ones after it move back
+gboolean match_index_delete(MatchIndex *index, gint offset, gint length) {
+    if (length <= 0) return FALSE;
+
+    guint slot = match_index_find(index, offset);
+    gint end = offset + length;
+    gboolean killed = FALSE;
+
+    if (slot > 0 && !match_is_dead(index, slot - 1)
+        && match_start(index, slot - 1) + match_length(index, slot - 1) > offset) {
+        kill_match(index, slot - 1);
+        killed = TRUE;
+    }
+
+    // anything starting inside the deleted text collapses onto its start
+    for (; slot < index->size; slot++) {
+        gint start = match_start(index, slot);
+        if (start >= end) break;
+
+        if (!match_is_dead(index, slot)) {
+            kill_match(index, slot);
+            killed = TRUE;
+        }
+
+        move_match(index, slot, offset - start);
+    }
+
+    if (slot < index->size)
+        fenwick_add(index->gaps, slot, -length);
+
+    return killed;
+}
@@ -0,0 +1,43 @@
+#ifndef NOTEBOOK_MATCHES_H
+#define NOTEBOOK_MATCHES_H
+
+#include <glib.h>
+
+// search matches as character offsets that follow edits to the buffer
+// instead of going stale, so replacing one match or moving between them
+// doesn't need the whole document searched again
+//
+// every match keeps a slot for as long as the index lives, an edit that
+// touches a match kills it rather than removing the slot, and the positions
+// & live counts are fenwick trees so shifting, ranking & lookups are O(log n)
+typedef struct {
+    GArray *gaps;    // gint, fenwick tree over the distance from the previous match's start
+    GArray *live;    // gint, fenwick tree over 1 for a live match & 0 for a dead one
+    GArray *lengths; // gint, match length in characters
+    GArray *dead;    // guint8
+    guint size;      // slots, live & dead
+    guint count;     // live matches
+} MatchIndex;
+
+MatchIndex *match_index_new();
+void match_index_free(MatchIndex *index);
+void match_index_clear(MatchIndex *index);
+
+// matches have to be added in order & must not overlap
+void match_index_append(MatchIndex *index, gint start, gint end);
+
+// FALSE if the match in this slot was killed by an edit
+gboolean match_index_get(MatchIndex *index, guint slot, gint *start, gint *end);
+
+// first slot starting at or after offset
+guint match_index_find(MatchIndex *index, gint offset);
+
+// live matches before a slot, and the slot of the nth live match
+guint match_index_rank(MatchIndex *index, guint slot);
+guint match_index_select(MatchIndex *index, guint n);
+
+// shift the matches after an edit, both return TRUE if any match was killed
+gboolean match_index_insert(MatchIndex *index, gint offset, gint length);
+gboolean match_index_delete(MatchIndex *index, gint offset, gint length);
+
+#endif
@@ -0,0 +1,112 @@
+#include "savefile.h"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void set_file_error(GError **error) {
+    int saved_errno = errno;
+    g_set_error_literal(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno), g_strerror(saved_errno));
+}
+
+static void save_file_clear(SaveFile *file) {
+    g_free(file->target);
+    g_free(file->temp);
+    file->target = NULL;
+    file->temp = NULL;
+    file->fd = -1;
+}
+
+gboolean save_file_open(SaveFile *file, const gchar *filename, GError **error) {
+    gchar *target = realpath(filename, NULL);
+    GStatBuf info;
+
+    // a file that doesn't exist yet is made where it was asked for
+    file->target = target ? g_strdup(target) : g_strdup(filename);
+    free(target);
+
+    gboolean exists = g_stat(file->target, &info) == 0;
+
+    // only readable by us until it has the old file's permissions
+    file->temp = g_strdup_printf("%s.XXXXXX", file->target);
+    file->fd = g_mkstemp_full(file->temp, O_WRONLY, exists ? 0600 : 0666);
+
+    if (file->fd < 0) {
+        set_file_error(error);
+        save_file_clear(file);
+        return FALSE;
+    }
+
+    if (!exists) return TRUE;
+
+    fchmod(file->fd, info.st_mode & 07777);
+
+    // only root can give a file away, anyone else can at least keep a group they're in
+    if (fchown(file->fd, info.st_uid, info.st_gid) != 0 && fchown(file->fd, (uid_t)-1, info.st_gid) != 0)
+        g_debug("%s: owner not kept", file->target);
+
+    return TRUE;
+}
+
+gboolean save_file_write(SaveFile *file, const gchar *text, gsize len, GError **error) {
+    while (len > 0) {
+        gssize n = write(file->fd, text, len);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+
+            set_file_error(error);
+            return FALSE;
+        }
+
+        text += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+gboolean save_file_commit(SaveFile *file, gboolean sync, GError **error) {
+    gboolean ok = TRUE;
+
+    if (sync && fsync(file->fd) != 0) {
+        set_file_error(error);
+        ok = FALSE;
+    }
+
+    if (close(file->fd) != 0 && ok) {
+        set_file_error(error);
+        ok = FALSE;
+    }
+
+    if (ok && g_rename(file->temp, file->target) != 0) {
+        set_file_error(error);
+        ok = FALSE;
+    }
+
+    if (!ok) g_unlink(file->temp);
+
+    // the rename itself is only durable once the directory is synced too
+    if (ok && sync) {
+        gchar *dir = g_path_get_dirname(file->target);
+        int dir_fd = g_open(dir, O_RDONLY, 0);
+
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+
+        g_free(dir);
+    }
+
+    save_file_clear(file);
+    return ok;
+}
+
+void save_file_abort(SaveFile *file) {
+    close(file->fd);
+    g_unlink(file->temp);
+    save_file_clear(file);
+}
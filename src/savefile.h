@@ -0,0 +1,29 @@
+#ifndef NOTEBOOK_SAVEFILE_H
+#define NOTEBOOK_SAVEFILE_H
+
+#include <glib.h>
+
+// replacing a file on disk without ever leaving it half written, independent from GTK
+// the text goes into a temp file next to the file, which is renamed over it once it's
+// all there, so the file is always either the old or the new version
+// links are followed so the file they point to is replaced & the link stays a link,
+// & the new file keeps the old one's permissions & owner, as far as we're allowed to
+
+typedef struct {
+    gchar *target;   // the file that gets replaced, links resolved
+    gchar *temp;
+    gint fd;
+} SaveFile;
+
+// a new file is made with the default permissions
+gboolean save_file_open(SaveFile *file, const gchar *filename, GError **error);
+gboolean save_file_write(SaveFile *file, const gchar *text, gsize len, GError **error);
+
+// rename the temp file over the target, synced first (along with the directory) if sync
+// is set, on failure the temp file is removed & the target left alone
+gboolean save_file_commit(SaveFile *file, gboolean sync, GError **error);
+
+// give up on a file that's been opened, the target is left alone
+void save_file_abort(SaveFile *file);
+
+#endif
@@ -0,0 +1,688 @@
+#include "search.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// regexes are scanned this much at a time when searching the whole text
+#define REGEX_CHUNK_SIZE (4 * 1024 * 1024)
+
+// ascii folding is enough unless the needle has non-ascii characters,
+// or an i or k (which U+0130 and the kelvin sign U+212A fold into)
+static gboolean needs_unicode_fold(const gchar *needle) {
+    for (const guchar *p = (const guchar *)needle; *p; p++) {
+        if (*p >= 0x80 || *p == 'i' || *p == 'I' || *p == 'k' || *p == 'K')
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+// fold the needle a character at a time, so every folded character still
+// lines up with exactly one character of the text
+static void compile_unicode_fold(SearchPattern *pattern) {
+    pattern->folded_len = g_utf8_strlen(pattern->needle, -1);
+    pattern->folded = g_new(gunichar, pattern->folded_len);
+
+    const gchar *p = pattern->needle;
+    for (glong i = 0; i < pattern->folded_len; i++) {
+        pattern->folded[i] = g_unichar_tolower(g_utf8_get_char(p));
+        p = g_utf8_next_char(p);
+    }
+
+    // collect the lead byte of every character that folds to the first one
+    // (e.g. k, K and U+212A for k) to quickly skip over impossible positions
+    memset(pattern->first_lead, 0, sizeof(pattern->first_lead));
+    gchar utf8[6];
+
+    for (gunichar c = 0; c < 0x20000; c++) {
+        if (g_unichar_tolower(c) != pattern->folded[0]) continue;
+        if (c >= 0xD800 && c <= 0xDFFF) continue;
+
+        g_unichar_to_utf8(c, utf8);
+        pattern->first_lead[(guchar)utf8[0]] = TRUE;
+    }
+}
+
+SearchPattern *search_pattern_new(const gchar *needle, gboolean case_sensitive) {
+    SearchPattern *pattern = g_new(SearchPattern, 1);
+    pattern->needle_len = strlen(needle);
+    pattern->needle = g_strndup(needle, pattern->needle_len);
+    pattern->case_sensitive = case_sensitive;
+    pattern->unicode_fold = !case_sensitive && needs_unicode_fold(needle);
+    pattern->folded = NULL;
+    pattern->folded_len = 0;
+    pattern->regex = NULL;
+    pattern->match_error = NULL;
+
+    if (pattern->unicode_fold) {
+        compile_unicode_fold(pattern);
+        return pattern;
+    }
+
+    // only ascii letters are folded, multi-byte characters are compared as is
+    for (int c = 0; c < 256; c++)
+        pattern->fold[c] = (!case_sensitive && c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+
+    gsize m = pattern->needle_len;
+    guchar *n = (guchar *)pattern->needle;
+
+    for (gsize i = 0; i < m; i++)
+        n[i] = pattern->fold[n[i]];
+
+    for (int c = 0; c < 256; c++)
+        pattern->shift[c] = m;
+
+    for (gsize i = 0; i + 1 < m; i++)
+        pattern->shift[n[i]] = m - 1 - i;
+
+    return pattern;
+}
+
+// the last expression compiled, searching for the same thing again reuses it
+static GRegex *cached_regex = NULL;
+static GRegexCompileFlags cached_regex_flags;
+
+SearchPattern *search_pattern_new_regex(const gchar *source, gboolean case_sensitive, GError **error) {
+    GRegexCompileFlags flags = (GRegexCompileFlags)(G_REGEX_OPTIMIZE | G_REGEX_MULTILINE | (case_sensitive ? 0 : G_REGEX_CASELESS));
+
+    if (!cached_regex || cached_regex_flags != flags || strcmp(g_regex_get_pattern(cached_regex), source) != 0) {
+        GRegex *regex = g_regex_new(source, flags, (GRegexMatchFlags)0, error);
+        if (!regex) return NULL;
+
+        if (cached_regex) g_regex_unref(cached_regex);
+        cached_regex = regex;
+        cached_regex_flags = flags;
+    }
+
+    SearchPattern *pattern = g_new0(SearchPattern, 1);
+    pattern->needle_len = strlen(source);
+    pattern->needle = g_strndup(source, pattern->needle_len);
+    pattern->case_sensitive = case_sensitive;
+    pattern->regex = g_regex_ref(cached_regex);
+    return pattern;
+}
+
+void search_pattern_free(SearchPattern *pattern) {
+    if (pattern->regex) g_regex_unref(pattern->regex);
+    if (pattern->match_error) g_error_free(pattern->match_error);
+    g_free(pattern->folded);
+    g_free(pattern->needle);
+    g_free(pattern);
+}
+
+static inline void append_range(GArray *ranges, gsize start, gsize end) {
+    g_array_append_val(ranges, start);
+    g_array_append_val(ranges, end);
+}
+
+static inline gboolean matches_at(const SearchPattern *pattern, const guchar *s) {
+    if (pattern->case_sensitive)
+        return memcmp(s, pattern->needle, pattern->needle_len) == 0;
+
+    const guchar *n = (const guchar *)pattern->needle;
+    for (gsize i = 0; i < pattern->needle_len; i++) {
+        if (pattern->fold[s[i]] != n[i])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+// plain horspool, used for the tail of the text and when there's no SSE2
+static void find_all_horspool(const SearchPattern *pattern, const guchar *text, gsize len, gsize from, GArray *ranges) {
+    gsize m = pattern->needle_len;
+    guchar last = pattern->needle[m - 1];
+    gsize i = from;
+
+    while (i + m <= len) {
+        guchar c = pattern->fold[text[i + m - 1]];
+
+        if (c == last && matches_at(pattern, text + i)) {
+            append_range(ranges, i, i + m);
+            i += m;
+        } else {
+            i += pattern->shift[c];
+        }
+    }
+}
+
+#ifdef __SSE2__
+static inline guchar upper_ascii(guchar c) {
+    return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+// 16 candidate positions at a time: a position is only verified when both
+// the first and the last byte of the needle line up
+static gsize find_all_sse2(const SearchPattern *pattern, const guchar *text, gsize len, GArray *ranges) {
+    gsize m = pattern->needle_len;
+    guchar first = pattern->needle[0];
+    guchar last = pattern->needle[m - 1];
+
+    const __m128i first_lo = _mm_set1_epi8((char)first);
+    const __m128i last_lo = _mm_set1_epi8((char)last);
+    const __m128i first_up = _mm_set1_epi8((char)(pattern->case_sensitive ? first : upper_ascii(first)));
+    const __m128i last_up = _mm_set1_epi8((char)(pattern->case_sensitive ? last : upper_ascii(last)));
+
+    gsize i = 0;
+
+    while (i + m - 1 + 16 <= len) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(text + i + m - 1));
+
+        __m128i eq_first = _mm_or_si128(_mm_cmpeq_epi8(a, first_lo), _mm_cmpeq_epi8(a, first_up));
+        __m128i eq_last = _mm_or_si128(_mm_cmpeq_epi8(b, last_lo), _mm_cmpeq_epi8(b, last_up));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(eq_first, eq_last));
+        gsize next = i + 16;
+
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            gsize pos = i + bit;
+
+            if (matches_at(pattern, text + pos)) {
+                append_range(ranges, pos, pos + m);
+
+                // matches don't overlap, skip the candidates inside this one
+                gsize skip = bit + m;
+                if (skip >= 16) {
+                    next = pos + m;
+                    break;
+                }
+
+                mask &= ~0u << skip;
+                continue;
+            }
+
+            mask &= mask - 1;
+        }
+
+        i = next;
+    }
+
+    return i;
+}
+#endif
+
+// fold the text on the fly and compare it against the folded needle
+// returns the byte length of the match in the text, which can differ from the
+// needle's since some characters change length when folded
+static gsize folded_match_at(const SearchPattern *pattern, const gchar *s, const gchar *end) {
+    const gchar *p = s;
+
+    for (glong i = 0; i < pattern->folded_len; i++) {
+        if (p >= end) return 0;
+
+        gunichar c = (guchar)*p < 0x80 ? (guchar)*p : g_utf8_get_char(p);
+        if (g_unichar_tolower(c) != pattern->folded[i]) return 0;
+
+        p = g_utf8_next_char(p);
+    }
+
+    return p <= end ? p - s : 0;
+}
+
+static void find_all_unicode_fold(const SearchPattern *pattern, const gchar *text, gsize len, GArray *ranges) {
+    const gchar *end = text + len;
+    const gchar *p = text;
+
+    while (p < end) {
+        // skip to the next character that could start a match
+        while (p < end && !pattern->first_lead[(guchar)*p])
+            p++;
+
+        if (p >= end) break;
+
+        // continuation bytes can't be a lead byte, so p is on a character
+        gsize match_len = folded_match_at(pattern, p, end);
+
+        if (match_len > 0) {
+            append_range(ranges, p - text, p - text + match_len);
+            p += match_len;
+        } else {
+            p = g_utf8_next_char(p);
+        }
+    }
+}
+
+// the regex engine only ever sees a bounded window of the text around [from, to):
+// from the start of the line from is on, at most SEARCH_REGEX_WINDOW bytes back,
+// to SEARCH_REGEX_WINDOW bytes past to so a match can run over lines from there,
+// both kept on character boundaries
+static void regex_window(const gchar *text, gsize len, gsize from, gsize to, gsize *start, gsize *end) {
+    gsize min = from > SEARCH_REGEX_WINDOW ? from - SEARCH_REGEX_WINDOW : 0;
+    gsize s = from;
+
+    while (s > min && text[s - 1] != '\n')
+        s--;
+
+    while (s < from && ((guchar)text[s] & 0xC0) == 0x80)
+        s++;
+
+    gsize e = MIN(len, to + SEARCH_REGEX_WINDOW);
+
+    while (e > to && e < len && ((guchar)text[e] & 0xC0) == 0x80)
+        e--;
+
+    *start = s;
+    *end = e;
+}
+
+// tell the engine when the window doesn't start or end on a line boundary
+static GRegexMatchFlags regex_window_flags(const gchar *text, gsize len, gsize start, gsize end) {
+    gint flags = 0;
+
+    if (start > 0 && text[start - 1] != '\n')
+        flags |= G_REGEX_MATCH_NOTBOL;
+
+    if (end < len && text[end - 1] != '\n')
+        flags |= G_REGEX_MATCH_NOTEOL;
+
+    return (GRegexMatchFlags)flags;
+}
+
+// keep the first error on the pattern for whoever shows the results, the rest are dropped
+static void record_match_error(const SearchPattern *pattern, GError *error) {
+    if (!g_atomic_pointer_compare_and_exchange(&((SearchPattern *)pattern)->match_error, NULL, error))
+        g_error_free(error);
+}
+
+const GError *search_pattern_get_match_error(const SearchPattern *pattern) {
+    return (const GError *)g_atomic_pointer_get(&pattern->match_error);
+}
+
+// every regex match starting between from & to, returns the end of the last one (at least to)
+static gsize find_range_regex(const SearchPattern *pattern, const gchar *text, gsize len, gsize from, gsize to,
+                              GArray *ranges, GError **error) {
+    gsize start, end;
+    regex_window(text, len, from, to, &start, &end);
+
+    GMatchInfo *info;
+    GError *match_error = NULL;
+    gsize resume = to;
+
+    g_regex_match_full(pattern->regex, text + start, end - start, from - start,
+        regex_window_flags(text, len, start, end), &info, &match_error);
+
+    while (!match_error && g_match_info_matches(info)) {
+        gint match_start, match_end;
+        g_match_info_fetch_pos(info, 0, &match_start, &match_end);
+        if (start + match_start >= to) break;
+
+        append_range(ranges, start + match_start, start + match_end);
+        resume = MAX(resume, start + match_end);
+        g_match_info_next(info, &match_error);
+    }
+
+    g_match_info_free(info);
+    if (match_error) g_propagate_error(error, match_error);
+    return resume;
+}
+
+// the regex for a single match at pos, NULL if there isn't one there
+static GMatchInfo *regex_match_at(const SearchPattern *pattern, const gchar *text, gsize len, gsize pos, gsize end, gsize *window_start) {
+    gsize window_end;
+    regex_window(text, len, pos, end, window_start, &window_end);
+
+    GMatchInfo *info;
+    GError *error = NULL;
+    GRegexMatchFlags flags = (GRegexMatchFlags)(regex_window_flags(text, len, *window_start, window_end) | G_REGEX_MATCH_ANCHORED);
+
+    if (g_regex_match_full(pattern->regex, text + *window_start, window_end - *window_start, pos - *window_start, flags, &info, &error))
+        return info;
+
+    if (error) record_match_error(pattern, error);
+    g_match_info_free(info);
+    return NULL;
+}
+
+void search_pattern_find_all(const SearchPattern *pattern, const gchar *text, gsize len, GArray *ranges, GError **error) {
+    if (pattern->needle_len == 0) return;
+
+    // a chunk at a time to keep the windows bounded
+    if (pattern->regex) {
+        GError *match_error = NULL;
+
+        for (gsize from = 0; from < len && !match_error;)
+            from = find_range_regex(pattern, text, len, from, MIN(len, from + REGEX_CHUNK_SIZE), ranges, &match_error);
+
+        if (match_error) g_propagate_error(error, match_error);
+        return;
+    }
+
+    if (pattern->unicode_fold) {
+        find_all_unicode_fold(pattern, text, len, ranges);
+        return;
+    }
+
+    if (pattern->needle_len > len) return;
+
+    const guchar *t = (const guchar *)text;
+    gsize from = 0;
+
+#ifdef __SSE2__
+    from = find_all_sse2(pattern, t, len, ranges);
+#endif
+
+    find_all_horspool(pattern, t, len, from, ranges);
+}
+
+gsize search_pattern_max_match_len(const SearchPattern *pattern) {
+    return pattern->unicode_fold ? pattern->folded_len * 4 : pattern->needle_len;
+}
+
+gsize search_pattern_find_range(const SearchPattern *pattern, const gchar *text, gsize len, gsize from, gsize to, GArray *ranges) {
+    if (from >= to || pattern->needle_len == 0) return to;
+
+    // chunks are scanned on worker threads, so failing ones are noted on the pattern
+    if (pattern->regex) {
+        GError *error = NULL;
+        gsize resume = find_range_regex(pattern, text, len, from, to, ranges, &error);
+
+        if (error) record_match_error(pattern, error);
+        return resume;
+    }
+
+    // look far enough past to for a match starting right before it
+    gsize window_end = MIN(len, to + search_pattern_max_match_len(pattern) - 1);
+    guint first = ranges->len;
+    search_pattern_find_all(pattern, text + from, window_end - from, ranges, NULL);
+
+    // make the offsets absolute & drop matches starting in the next range
+    gsize resume = to;
+    guint i = first;
+
+    for (; i + 1 < ranges->len; i += 2) {
+        gsize start = g_array_index(ranges, gsize, i) + from;
+        if (start >= to) break;
+
+        g_array_index(ranges, gsize, i) = start;
+        g_array_index(ranges, gsize, i + 1) += from;
+        resume = MAX(resume, g_array_index(ranges, gsize, i + 1));
+    }
+
+    g_array_set_size(ranges, i);
+    return resume;
+}
+
+// scan the window for matches starting before scan_to
+static void stream_scan(SearchStream *stream, gsize scan_to) {
+    scan_to = MIN(scan_to, stream->to);
+    if (stream->scan_pos >= scan_to) return;
+
+    gsize base = stream->window_start;
+    guint first = stream->ranges->len;
+    gsize resume = search_pattern_find_range(stream->pattern, stream->window->str, stream->window->len,
+        stream->scan_pos - base, scan_to - base, stream->ranges);
+
+    for (guint i = first; i < stream->ranges->len; i++)
+        g_array_index(stream->ranges, gsize, i) += base;
+
+    stream->scan_pos = resume + base;
+}
+
+void search_stream_init(SearchStream *stream, const SearchPattern *pattern, gsize len, gsize from, gsize to,
+                        GArray *ranges, gsize *feed_from, gsize *feed_to) {
+    stream->pattern = pattern;
+    stream->ranges = ranges;
+    stream->to = to;
+    stream->scan_pos = from;
+
+    // one byte more each way than the regex window, so it can tell whether it's at a line boundary
+    if (pattern->regex) {
+        stream->before = SEARCH_REGEX_WINDOW + 1;
+        stream->after = SEARCH_REGEX_WINDOW + 1;
+    } else {
+        stream->before = 0;
+        stream->after = MAX(search_pattern_max_match_len(pattern), 1) - 1;
+    }
+
+    stream->window = g_string_new(NULL);
+    stream->window_start = from > stream->before ? from - stream->before : 0;
+
+    *feed_from = stream->window_start;
+    *feed_to = MIN(len, to + stream->after);
+}
+
+gboolean search_stream_feed(SearchStream *stream, const gchar *text, gsize len) {
+    gsize piece_start = stream->window_start + stream->window->len;
+    gsize piece_end = piece_start + len;
+    gsize seam = MIN(len, stream->before + stream->after);
+
+    // the start of the piece is scanned stitched onto what's kept from before
+    g_string_append_len(stream->window, text, seam);
+    if (piece_start + seam >= stream->after)
+        stream_scan(stream, piece_start + seam - stream->after);
+
+    if (seam == len) {
+        // keep what a match after this could still look back at
+        gsize keep = stream->scan_pos > stream->before ? stream->scan_pos - stream->before : 0;
+        if (keep > stream->window_start) {
+            g_string_erase(stream->window, 0, keep - stream->window_start);
+            stream->window_start = keep;
+        }
+
+        return stream->scan_pos < stream->to;
+    }
+
+    if (stream->scan_pos >= stream->to) return FALSE;
+
+    // the rest has all the context it needs inside the piece, so it's scanned in place
+    if (stream->scan_pos < piece_end - stream->after) {
+        guint first = stream->ranges->len;
+        gsize resume = search_pattern_find_range(stream->pattern, text, len, stream->scan_pos - piece_start,
+            MIN(stream->to, piece_end - stream->after) - piece_start, stream->ranges);
+
+        for (guint i = first; i < stream->ranges->len; i++)
+            g_array_index(stream->ranges, gsize, i) += piece_start;
+
+        stream->scan_pos = resume + piece_start;
+    }
+
+    // & only its end is kept
+    gsize keep = stream->scan_pos - stream->before;
+    g_string_truncate(stream->window, 0);
+    g_string_append_len(stream->window, text + (keep - piece_start), piece_end - keep);
+    stream->window_start = keep;
+
+    return stream->scan_pos < stream->to;
+}
+
+gsize search_stream_finish(SearchStream *stream) {
+    stream_scan(stream, stream->to);
+    g_string_free(stream->window, TRUE);
+
+    return MAX(stream->scan_pos, stream->to);
+}
+
+// byte length of a match at pos, 0 if there isn't one
+static gsize match_len_at(const SearchPattern *pattern, const gchar *text, gsize len, gsize pos) {
+    if (pattern->regex) {
+        gsize window_start;
+        GMatchInfo *info = regex_match_at(pattern, text, len, pos, pos, &window_start);
+        if (!info) return 0;
+
+        gint match_start, match_end;
+        g_match_info_fetch_pos(info, 0, &match_start, &match_end);
+        g_match_info_free(info);
+        return match_end - match_start;
+    }
+
+    if (pattern->unicode_fold)
+        return folded_match_at(pattern, text + pos, text + len);
+
+    if (pos + pattern->needle_len > len)
+        return 0;
+
+    return matches_at(pattern, (const guchar *)text + pos) ? pattern->needle_len : 0;
+}
+
+void search_pattern_refine(const SearchPattern *pattern, const gchar *text, gsize len, GArray *candidates, GArray *ranges) {
+    gsize last_end = 0;
+
+    for (guint i = 0; i + 1 < candidates->len; i += 2) {
+        gsize start = g_array_index(candidates, gsize, i);
+        if (start < last_end) continue;
+
+        gsize match_len = match_len_at(pattern, text, len, start);
+        if (match_len == 0) continue;
+
+        append_range(ranges, start, start + match_len);
+        last_end = start + match_len;
+    }
+}
+
+// a pattern can overlap itself when some prefix of it is also a suffix
+gboolean search_pattern_is_self_overlapping(const SearchPattern *pattern) {
+    if (pattern->regex)
+        return TRUE;
+
+    if (pattern->unicode_fold) {
+        for (glong k = 1; k < pattern->folded_len; k++) {
+            if (memcmp(pattern->folded, pattern->folded + pattern->folded_len - k, k * sizeof(gunichar)) == 0)
+                return TRUE;
+        }
+
+        return FALSE;
+    }
+
+    for (gsize k = 1; k < pattern->needle_len; k++) {
+        if (memcmp(pattern->needle, pattern->needle + pattern->needle_len - k, k) == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+// every byte that isn't a utf-8 continuation byte starts a character
+static gsize count_chars(const gchar *text, gsize len) {
+    const guchar *t = (const guchar *)text;
+    gsize count = 0;
+
+    for (gsize i = 0; i < len; i++)
+        count += (t[i] & 0xC0) != 0x80;
+
+    return count;
+}
+
+void search_ranges_to_char_offsets(const gchar *text, GArray *ranges, guint from, SearchOffsetCursor *cursor) {
+    for (guint i = from; i < ranges->len; i++) {
+        gsize byte_offset = g_array_index(ranges, gsize, i);
+
+        cursor->char_pos += count_chars(text + cursor->byte_pos, byte_offset - cursor->byte_pos);
+        cursor->byte_pos = byte_offset;
+
+        g_array_index(ranges, gsize, i) = cursor->char_pos;
+    }
+}
+
+gchar *search_pattern_expand(const SearchPattern *pattern, const gchar *text, gsize len, gsize start, gsize end, const gchar *replacement) {
+    if (!pattern->regex)
+        return g_strdup(replacement);
+
+    gsize window_start;
+    GMatchInfo *info = regex_match_at(pattern, text, len, start, end, &window_start);
+    if (!info) return g_strdup(replacement);
+
+    gchar *expanded = g_match_info_expand_references(info, replacement, NULL);
+    g_match_info_free(info);
+    return expanded ? expanded : g_strdup(replacement);
+}
+
+// the regex's matches walked a window at a time the same way the find did, so a range's
+// capture groups come out of the match that found it instead of a search of its own
+typedef struct {
+    GMatchInfo *info;
+    gsize start;   // of the window
+    gsize to;      // matches starting from here on are in the next one
+} RegexWalk;
+
+static void regex_walk_open(RegexWalk *walk, const SearchPattern *pattern, const gchar *text, gsize len, gsize from) {
+    gsize end;
+
+    if (walk->info) g_match_info_free(walk->info);
+
+    walk->to = MIN(len, from + REGEX_CHUNK_SIZE);
+    regex_window(text, len, from, walk->to, &walk->start, &end);
+    g_regex_match_full(pattern->regex, text + walk->start, end - walk->start, from - walk->start,
+        regex_window_flags(text, len, walk->start, end), &walk->info, NULL);
+}
+
+// the walk's match from start to end, NULL if it isn't one of its matches
+static GMatchInfo *regex_walk_to(RegexWalk *walk, const SearchPattern *pattern, const gchar *text, gsize len, gsize start, gsize end) {
+    gboolean opened = FALSE;
+
+    while (TRUE) {
+        // on to the next window once the range is past this one
+        if (!walk->info || start >= walk->to) {
+            regex_walk_open(walk, pattern, text, len, start);
+            opened = TRUE;
+        }
+
+        gint match_start = 0, match_end = 0;
+        while (g_match_info_matches(walk->info)) {
+            g_match_info_fetch_pos(walk->info, 0, &match_start, &match_end);
+            if (walk->start + match_start >= start) break;
+
+            g_match_info_next(walk->info, NULL);
+        }
+
+        if (g_match_info_matches(walk->info) && walk->start + match_start == start && walk->start + match_end == end)
+            return walk->info;
+
+        // the walk went past it, so it wasn't found this way, one more try from the range itself
+        if (opened) return NULL;
+
+        regex_walk_open(walk, pattern, text, len, start);
+        opened = TRUE;
+    }
+}
+
+GString *search_replace_ranges(const SearchPattern *pattern, const gchar *text, gsize len, GArray *ranges, const gchar *replacement, GArray *replaced) {
+    gsize replacement_len = strlen(replacement);
+    guint count = ranges->len / 2;
+
+    // work out the final size first so the result is only allocated once,
+    // regex replacements can differ per match so that's just a guess
+    gsize removed = 0;
+    for (guint i = 0; i + 1 < ranges->len; i += 2)
+        removed += g_array_index(ranges, gsize, i + 1) - g_array_index(ranges, gsize, i);
+
+    GString *result = g_string_sized_new(len - removed + count * replacement_len);
+    gsize last = 0;
+    RegexWalk walk = { NULL, 0, 0 };
+
+    for (guint i = 0; i + 1 < ranges->len; i += 2) {
+        gsize start = g_array_index(ranges, gsize, i);
+        gsize end = g_array_index(ranges, gsize, i + 1);
+
+        g_string_append_len(result, text + last, start - last);
+        gsize replaced_start = result->len;
+
+        if (pattern->regex) {
+            GMatchInfo *info = regex_walk_to(&walk, pattern, text, len, start, end);
+            gchar *expanded = info ? g_match_info_expand_references(info, replacement, NULL) : NULL;
+
+            if (!expanded)
+                expanded = search_pattern_expand(pattern, text, len, start, end, replacement);
+
+            g_string_append(result, expanded);
+            g_free(expanded);
+        } else {
+            g_string_append_len(result, replacement, replacement_len);
+        }
+
+        if (replaced) {
+            gsize replaced_end = result->len;
+            g_array_append_val(replaced, replaced_start);
+            g_array_append_val(replaced, replaced_end);
+        }
+
+        last = end;
+    }
+
+    g_string_append_len(result, text + last, len - last);
+    if (walk.info) g_match_info_free(walk.info);
+    return result;
+}
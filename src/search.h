@@ -0,0 +1,109 @@
+#ifndef NOTEBOOK_SEARCH_H
+#define NOTEBOOK_SEARCH_H
+
+#include <glib.h>
+
+// how far past a chunk a regex match can reach, and how much of the line
+// before it anchors & lookbehinds can see
+#define SEARCH_REGEX_WINDOW (64 * 1024)
+
+// find & replace core, independent from GTK
+// ranges are stored as pairs of byte offsets (start, end) in a GArray of gsize
+
+// a compiled search string, reusable across many scans
+typedef struct {
+    gchar *needle;       // folded when case insensitive
+    gsize needle_len;
+    gboolean case_sensitive;
+    guchar fold[256];    // byte folding table, identity when case sensitive
+    gsize shift[256];    // horspool bad character shifts
+
+    // case insensitive search for needles that need more than ascii folding
+    // the needle is folded once and the text is folded on the fly while comparing
+    gboolean unicode_fold;
+    gunichar *folded;
+    glong folded_len;
+    gboolean first_lead[256]; // lead bytes of every character folding to folded[0]
+
+    // regex mode, needle is the source of the expression
+    GRegex *regex;
+
+    // the first error the regex engine ran into on a range (e.g. invalid utf-8 in a mapped
+    // file), set once from whichever thread hit it, that text counts as having no matches
+    GError *match_error;
+} SearchPattern;
+
+SearchPattern *search_pattern_new(const gchar *needle, gboolean case_sensitive);
+void search_pattern_free(SearchPattern *pattern);
+
+// compile a regular expression (jit compiled), NULL with error set when it's invalid
+// the last compiled expression is cached so searching for it again is free,
+// which means patterns have to be created from one thread only
+SearchPattern *search_pattern_new_regex(const gchar *source, gboolean case_sensitive, GError **error);
+
+// running position for turning byte offsets into character offsets
+// a piece at a time, starts zeroed
+typedef struct {
+    gsize byte_pos;
+    gsize char_pos;
+} SearchOffsetCursor;
+
+// append every non-overlapping match in text to ranges in a single pass
+// a regex stops at the first error matching, the ranges before it are kept
+void search_pattern_find_all(const SearchPattern *pattern, const gchar *text, gsize len, GArray *ranges, GError **error);
+
+// same as above, for matches starting between from & to only
+// returns where the scan of the next range should start
+// regex matches can't reach further than SEARCH_REGEX_WINDOW bytes past to
+gsize search_pattern_find_range(const SearchPattern *pattern, const gchar *text, gsize len, gsize from, gsize to, GArray *ranges);
+
+// the first error scanning ranges ran into, NULL if there hasn't been one
+const GError *search_pattern_get_match_error(const SearchPattern *pattern);
+
+// longest a match can be in bytes, folded characters can change length
+gsize search_pattern_max_match_len(const SearchPattern *pattern);
+
+// search_pattern_find_range over text handed over a piece at a time (e.g. out of a
+// piece table), only the context matches need around the piece boundaries is copied
+typedef struct {
+    const SearchPattern *pattern;
+    GArray *ranges;
+    gsize to;
+    gsize scan_pos;      // matches before this have been found
+    gsize before;        // bytes a match can look back & ahead at
+    gsize after;
+    GString *window;     // the end of what's been fed, kept for the next piece
+    gsize window_start;  // offset of window in the whole text
+} SearchStream;
+
+// matches starting between from & to, the text from feed_from to feed_to has to be fed in order
+void search_stream_init(SearchStream *stream, const SearchPattern *pattern, gsize len, gsize from, gsize to,
+                        GArray *ranges, gsize *feed_from, gsize *feed_to);
+
+// FALSE once the rest of the text isn't needed anymore
+gboolean search_stream_feed(SearchStream *stream, const gchar *text, gsize len);
+
+// scan what's left & free the stream, returns the same as search_pattern_find_range
+gsize search_stream_finish(SearchStream *stream);
+
+// keep the candidates that still match pattern, for narrowing down the
+// matches of a shorter query when more is typed
+void search_pattern_refine(const SearchPattern *pattern, const gchar *text, gsize len, GArray *candidates, GArray *ranges);
+
+// whether two matches of the pattern could overlap (e.g. "aa" in "aaa"),
+// in which case its non-overlapping matches can't be narrowed down
+// always TRUE for regexes
+gboolean search_pattern_is_self_overlapping(const SearchPattern *pattern);
+
+// turn byte offsets from index from onwards into character offsets in place
+void search_ranges_to_char_offsets(const gchar *text, GArray *ranges, guint from, SearchOffsetCursor *cursor);
+
+// the replacement for the match from start to end, with capture group references
+// (\0, \1, \g<name>) filled in for regexes
+gchar *search_pattern_expand(const SearchPattern *pattern, const gchar *text, gsize len, gsize start, gsize end, const gchar *replacement);
+
+// build the text with every range swapped for replacement in a single pass
+// if replaced isn't NULL it gets the byte range of every replacement in the result
+GString *search_replace_ranges(const SearchPattern *pattern, const gchar *text, gsize len, GArray *ranges, const gchar *replacement, GArray *replaced);
+
+#endif
@@ -0,0 +1,97 @@
+#include "stats.h"
+
+#include <string.h>
+
+typedef struct {
+    gint64 chars;
+    gint64 words;
+    gint64 lines;
+    gunichar first;
+    gunichar last;
+} TextCounts;
+
+static gboolean is_word_char(gunichar c) {
+    return c != 0 && !g_unichar_isspace(c);
+}
+
+// \n, \r, \r\n and the unicode separators each end a line, same as GtkTextBuffer
+static gboolean is_line_break(gunichar c) {
+    return c == '\n' || c == '\r' || c == 0x2028 || c == 0x2029;
+}
+
+static void count_text(const gchar *text, gsize len, TextCounts *counts) {
+    const gchar *p = text;
+    const gchar *end = text + len;
+    gunichar prev = 0;
+
+    memset(counts, 0, sizeof(TextCounts));
+
+    while (p < end) {
+        gunichar c;
+
+        // ascii fast path, most text never leaves it
+        if ((guchar)*p < 0x80) {
+            c = (guchar)*p;
+            p++;
+        } else {
+            c = g_utf8_get_char(p);
+            p = g_utf8_next_char(p);
+        }
+
+        counts->chars++;
+
+        if (is_word_char(c) && !is_word_char(prev))
+            counts->words++;
+
+        if (is_line_break(c) && !(c == '\n' && prev == '\r'))
+            counts->lines++;
+
+        if (counts->chars == 1)
+            counts->first = c;
+
+        prev = c;
+    }
+
+    counts->last = prev;
+}
+
+// how much the counts change when text is placed between before & after
+static void count_delta(gunichar before, const gchar *text, gsize len, gunichar after, TextCounts *delta) {
+    count_text(text, len, delta);
+    if (delta->chars == 0) return;
+
+    gboolean b = is_word_char(before);
+    gboolean a = is_word_char(after);
+
+    // words touching the edit merge with the neighbouring ones
+    delta->words += (b && a) - (b && is_word_char(delta->first)) - (a && is_word_char(delta->last));
+
+    // a \r followed by \n is a single line break
+    delta->lines += (before == '\r' && after == '\n')
+        - (before == '\r' && delta->first == '\n')
+        - (delta->last == '\r' && after == '\n');
+}
+
+void doc_stats_reset(DocStats *stats) {
+    memset(stats, 0, sizeof(DocStats));
+}
+
+void doc_stats_insert(DocStats *stats, gunichar before, const gchar *text, gsize len, gunichar after) {
+    TextCounts delta;
+    count_delta(before, text, len, after, &delta);
+
+    stats->chars += delta.chars;
+    stats->words += delta.words;
+    stats->lines += delta.lines;
+    stats->bytes += len;
+}
+
+void doc_stats_delete(DocStats *stats, gunichar before, const gchar *text, gsize len, gunichar after) {
+    TextCounts delta;
+    count_delta(before, text, len, after, &delta);
+
+    stats->chars -= delta.chars;
+    stats->words -= delta.words;
+    stats->lines -= delta.lines;
+    stats->bytes -= len;
+}
@@ -0,0 +1,23 @@
+#ifndef NOTEBOOK_STATS_H
+#define NOTEBOOK_STATS_H
+
+#include <glib.h>
+
+// document statistics shown in the status bar
+// kept up to date from the inserted & deleted text instead of rescanning the
+// whole document, so an edit costs O(edit size)
+typedef struct {
+    gint64 chars;
+    gint64 words;
+    gint64 lines;
+    gint64 bytes;
+} DocStats;
+
+void doc_stats_reset(DocStats *stats);
+
+// before & after are the characters around the edit (0 at the start/end of
+// the document), needed since an edit can join or split words and line breaks
+void doc_stats_insert(DocStats *stats, gunichar before, const gchar *text, gsize len, gunichar after);
+void doc_stats_delete(DocStats *stats, gunichar before, const gchar *text, gsize len, gunichar after);
+
+#endif
@@ -0,0 +1,115 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    gint sequence; // index + 1 once the slot is written, 0 while it's being written
+    const gchar *name;
+    gint64 start;
+    gint64 end;
+    gint thread;
+} TraceEvent;
+
+gboolean trace_enabled = FALSE;
+
+static TraceEvent ring[TRACE_RING_SIZE];
+static gint ring_head = 0; // next index, wraps along with the ring
+
+static gint next_thread_id = 0;
+static __thread gint thread_id = 0;
+
+// only the main thread marks input & paints
+static gint64 pending_input = 0;
+static gint64 latencies[TRACE_LATENCY_SAMPLES];
+static guint latency_count = 0;
+
+gint64 trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+void trace_set_enabled(gboolean enabled) {
+    trace_enabled = enabled;
+    pending_input = 0;
+}
+
+void trace_record(const gchar *name, gint64 start, gint64 end) {
+    if (!thread_id) thread_id = g_atomic_int_add(&next_thread_id, 1) + 1;
+
+    // claim a slot, writers only ever race for the index
+    gint index = g_atomic_int_add(&ring_head, 1);
+    TraceEvent *event = &ring[index & (TRACE_RING_SIZE - 1)];
+
+    g_atomic_int_set(&event->sequence, 0);
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    event->thread = thread_id;
+    g_atomic_int_set(&event->sequence, index + 1);
+}
+
+void trace_scope_end(TraceScope *scope) {
+    if (trace_enabled)
+        trace_record(scope->name, scope->start, trace_now());
+}
+
+void trace_mark_input() {
+    if (trace_enabled && !pending_input)
+        pending_input = trace_now();
+}
+
+void trace_mark_painted() {
+    if (!trace_enabled || !pending_input) return;
+
+    gint64 now = trace_now();
+    trace_record("input to paint", pending_input, now);
+
+    latencies[latency_count++ % TRACE_LATENCY_SAMPLES] = now - pending_input;
+    pending_input = 0;
+}
+
+static gint compare_gint64(gconstpointer a, gconstpointer b) {
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+gdouble trace_input_latency_p99_ms() {
+    guint count = MIN(latency_count, TRACE_LATENCY_SAMPLES);
+    if (count == 0) return -1;
+
+    gint64 sorted[TRACE_LATENCY_SAMPLES];
+    memcpy(sorted, latencies, count * sizeof(gint64));
+    qsort(sorted, count, sizeof(gint64), compare_gint64);
+
+    return sorted[(count - 1) * 99 / 100] / 1e6;
+}
+
+gboolean trace_export(const gchar *filename, GError **error) {
+    GString *json = g_string_new("{\"traceEvents\": [\n");
+    gint head = g_atomic_int_get(&ring_head);
+    guint count = MIN((guint)head, TRACE_RING_SIZE);
+    gboolean first = TRUE;
+
+    // oldest first, skipping slots written over while copying
+    for (gint index = head - count; index != head; index++) {
+        TraceEvent *slot = &ring[index & (TRACE_RING_SIZE - 1)];
+        gint sequence = g_atomic_int_get(&slot->sequence);
+        TraceEvent event = *slot;
+
+        if (sequence != index + 1 || g_atomic_int_get(&slot->sequence) != sequence) continue;
+
+        g_string_append_printf(json,
+            "%s  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+            first ? "" : ",\n", event.name, event.thread, event.start / 1e3, (event.end - event.start) / 1e3);
+        first = FALSE;
+    }
+
+    g_string_append(json, "\n], \"displayTimeUnit\": \"ms\"}\n");
+
+    gboolean ok = g_file_set_contents(filename, json->str, json->len, error);
+    g_string_free(json, TRUE);
+    return ok;
+}
@@ -0,0 +1,55 @@
+#ifndef NOTEBOOK_TRACE_H
+#define NOTEBOOK_TRACE_H
+
+#include <glib.h>
+
+// latency tracing, independent from GTK
+// handlers mark themselves with TRACE("name") and the time until they return
+// goes into a fixed ring of events that any thread can write to without locks,
+// the newest of which can be saved as a chrome trace (chrome://tracing, perfetto)
+// while tracing is off a probe is one branch on trace_enabled & nothing else
+
+// events kept, the oldest are overwritten, a power of two
+#define TRACE_RING_SIZE 65536
+
+// keystroke to paint latencies kept for the p99
+#define TRACE_LATENCY_SAMPLES 512
+
+extern gboolean trace_enabled;
+
+typedef struct {
+    const gchar *name; // has to outlive the trace, a string literal
+    gint64 start;      // 0 when tracing was off at the start
+} TraceScope;
+
+gint64 trace_now();
+
+void trace_set_enabled(gboolean enabled);
+
+// a finished span, start & end from trace_now()
+void trace_record(const gchar *name, gint64 start, gint64 end);
+
+void trace_scope_end(TraceScope *scope);
+
+// inline so a scope started with tracing off costs no call when it ends either
+static inline void trace_scope_close(TraceScope *scope) {
+    if (scope->start) trace_scope_end(scope);
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(TraceScope, trace_scope_close)
+
+// time from here to the end of the enclosing block
+#define TRACE(name) \
+    g_auto(TraceScope) G_PASTE(trace_scope_, __LINE__) = { name, trace_enabled ? trace_now() : 0 }
+
+// a key was pressed, the next paint gets timed against the first unpainted one
+void trace_mark_input();
+void trace_mark_painted();
+
+// recent keystroke to paint latency, -1 without any
+gdouble trace_input_latency_p99_ms();
+
+// write what's in the ring as chrome trace json
+gboolean trace_export(const gchar *filename, GError **error);
+
+#endif
@@ -0,0 +1,924 @@
+#include "undo.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// packed ops are, one after another:
+//   type (1 byte), offset (4), length (4), text size (4), text
+// little endian, since they're kept with the file between sessions
+#define PACK_HEADER_SIZE 13
+
+// stored history file: a header of
+//   magic (4), version (4), hash of the text (32), end of the records (8)
+// then records, oldest first, each the packed & compressed ops of a step
+// followed by their size (8), the size unpacked (8) & a check (4)
+// with the sizes at the end, records are read back from the newest without an
+// index & new ones are appended, the header's end being updated last
+#define STORE_MAGIC "NBU1"
+#define STORE_VERSION 1
+#define STORE_HEADER_SIZE 48
+#define STORE_TRAILER_SIZE 20
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// fast over small, cold history is rarely read back
+#define PACK_LEVEL 1
+
+// a step handed to the packer thread, which only ever touches raw & packed
+// the step lets go of it by clearing step, so a late result is just dropped
+struct UndoPack {
+    gint ref_count;
+    UndoStep *step;
+    GBytes *raw;
+    GBytes *packed; // NULL if compressing failed
+};
+
+// a step as a store has it, compressed already, still raw, or in the spill file
+typedef struct {
+    GBytes *packed;
+    GBytes *raw;
+    guint64 spill_offset;
+    gsize spill_len;
+    gsize size;     // unpacked
+} StoreRecord;
+
+// a snapshot of the undo side handed to the store thread, which owns all of it
+// so the journal can go on changing, or go away, while it's written
+struct UndoStore {
+    GAsyncQueue *done;    // where it goes once written
+    gchar *path;
+    guint8 hash[UNDO_HASH_SIZE];
+    GMappedFile *stored;  // the earlier history the records go after, if any
+    gsize stored_end;
+    gboolean append;      // stored is all that's at path, so the records can go on its end
+    gint spill_fd;        // a dup of the spill file's, -1 if nothing's spilled
+    GArray *records;      // StoreRecord, oldest first
+    guint changes;        // the journal's undo_changes when it was taken
+    GMappedFile *written; // the file as written, NULL if it couldn't be
+    guint64 end;
+};
+
+static guint32 fnv1a(const guint8 *data, gsize len) {
+    guint32 hash = FNV_OFFSET;
+
+    for (gsize i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static void put_uint(guint8 *p, guint64 value, guint size) {
+    for (guint i = 0; i < size; i++)
+        p[i] = (guint8)(value >> (8 * i));
+}
+
+static guint64 get_uint(const guint8 *p, guint size) {
+    guint64 value = 0;
+
+    for (guint i = 0; i < size; i++)
+        value |= (guint64)p[i] << (8 * i);
+
+    return value;
+}
+
+static void free_ops(GArray *ops) {
+    for (guint i = 0; i < ops->len; i++)
+        g_free(g_array_index(ops, UndoOp, i).text);
+
+    g_array_free(ops, TRUE);
+}
+
+static GBytes *pack_ops(GArray *ops) {
+    GByteArray *out = g_byte_array_new();
+
+    for (guint i = 0; i < ops->len; i++) {
+        UndoOp *op = &g_array_index(ops, UndoOp, i);
+        guint8 header[PACK_HEADER_SIZE];
+        gsize text_len = strlen(op->text);
+
+        header[0] = op->type;
+        put_uint(header + 1, (guint32)op->offset, 4);
+        put_uint(header + 5, (guint32)op->length, 4);
+        put_uint(header + 9, text_len, 4);
+
+        g_byte_array_append(out, header, PACK_HEADER_SIZE);
+        g_byte_array_append(out, (const guint8 *)op->text, text_len);
+    }
+
+    return g_byte_array_free_to_bytes(out);
+}
+
+// NULL if the data is cut short
+static GArray *unpack_ops(const guint8 *data, gsize len) {
+    GArray *ops = g_array_new(FALSE, FALSE, sizeof(UndoOp));
+
+    while (len > 0) {
+        if (len < PACK_HEADER_SIZE) break;
+
+        gsize text_len = get_uint(data + 9, 4);
+        if (len - PACK_HEADER_SIZE < text_len) break;
+
+        UndoOp op;
+        op.type = (UndoOpType)data[0];
+        op.offset = (gint32)get_uint(data + 1, 4);
+        op.length = (gint32)get_uint(data + 5, 4);
+        op.text = g_strndup((const gchar *)data + PACK_HEADER_SIZE, text_len);
+        g_array_append_val(ops, op);
+
+        data += PACK_HEADER_SIZE + text_len;
+        len -= PACK_HEADER_SIZE + text_len;
+    }
+
+    if (len > 0) {
+        free_ops(ops);
+        return NULL;
+    }
+
+    return ops;
+}
+
+// run all of data through a zlib converter, NULL if it fails
+static GBytes *convert_all(GConverter *converter, const guint8 *data, gsize len, gsize size_hint) {
+    GByteArray *out = g_byte_array_new();
+    GConverterResult result;
+
+    do {
+        gsize used = out->len, read = 0, written = 0;
+        g_byte_array_set_size(out, used + MAX(size_hint, 4096));
+
+        result = g_converter_convert(converter, data, len, out->data + used, out->len - used,
+                                     G_CONVERTER_INPUT_AT_END, &read, &written, NULL);
+
+        g_byte_array_set_size(out, used + written);
+        data += read;
+        len -= read;
+    } while (result == G_CONVERTER_CONVERTED);
+
+    g_object_unref(converter);
+
+    if (result != G_CONVERTER_FINISHED) {
+        g_byte_array_free(out, TRUE);
+        return NULL;
+    }
+
+    return g_byte_array_free_to_bytes(out);
+}
+
+static GBytes *compress_bytes(GBytes *raw) {
+    gsize len;
+    const guint8 *data = (const guint8 *)g_bytes_get_data(raw, &len);
+    return convert_all(G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, PACK_LEVEL)), data, len, len / 4);
+}
+
+static GArray *decompress_ops(const guint8 *data, gsize len, gsize size) {
+    GBytes *raw = convert_all(G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW)), data, len, size);
+    if (!raw) return NULL;
+
+    gsize raw_len;
+    const guint8 *raw_data = (const guint8 *)g_bytes_get_data(raw, &raw_len);
+    GArray *ops = unpack_ops(raw_data, raw_len);
+
+    g_bytes_unref(raw);
+    return ops;
+}
+
+static void pack_unref(UndoPack *pack) {
+    if (--pack->ref_count > 0) return;
+
+    g_bytes_unref(pack->raw);
+    if (pack->packed) g_bytes_unref(pack->packed);
+    g_free(pack);
+}
+
+static void pack_worker(gpointer data, gpointer user_data) {
+    UndoPack *pack = (UndoPack *)data;
+    UndoJournal *journal = (UndoJournal *)user_data;
+
+    pack->packed = compress_bytes(pack->raw);
+    g_async_queue_push(journal->packed, pack);
+}
+
+// the step doesn't want what's being compressed for it anymore
+static void drop_pending(UndoStep *step) {
+    if (!step->pending) return;
+
+    step->pending->step = NULL;
+    pack_unref(step->pending);
+    step->pending = NULL;
+}
+
+static UndoStep *undo_step_new() {
+    UndoStep *step = g_new0(UndoStep, 1);
+    step->ops = g_array_new(FALSE, FALSE, sizeof(UndoOp));
+    return step;
+}
+
+static void undo_step_free(gpointer data) {
+    UndoStep *step = (UndoStep *)data;
+
+    drop_pending(step);
+    if (step->ops) free_ops(step->ops);
+    if (step->packed) g_bytes_unref(step->packed);
+    g_free(step);
+}
+
+// what a step in memory takes, a spilled one is just its struct
+static gsize step_memory(UndoStep *step) {
+    if (step->ops) return step->size;
+    return step->packed ? g_bytes_get_size(step->packed) : 0;
+}
+
+static void start_pack(UndoJournal *journal, UndoStep *step) {
+    if (!step->ops || step->pending || step->size < UNDO_PACK_MIN) return;
+
+    UndoPack *pack = g_new0(UndoPack, 1);
+    pack->ref_count = 2; // the step's & the packer's, dropped on the main thread
+    pack->step = step;
+    pack->raw = pack_ops(step->ops);
+    step->pending = pack;
+
+    g_thread_pool_push(journal->packer, pack, NULL);
+}
+
+// swap in whatever the packer has finished since last time
+static void collect_packed(UndoJournal *journal) {
+    UndoPack *pack;
+
+    while ((pack = (UndoPack *)g_async_queue_try_pop(journal->packed))) {
+        UndoStep *step = pack->step;
+
+        // kept only if it came out smaller, otherwise the step just stays as it is
+        if (step && pack->packed && g_bytes_get_size(pack->packed) < step->size) {
+            journal->memory -= step_memory(step);
+            free_ops(step->ops);
+            step->ops = NULL;
+            step->packed = g_bytes_ref(pack->packed);
+            journal->memory += step_memory(step);
+        }
+
+        if (step) drop_pending(step);
+        pack_unref(pack);
+    }
+}
+
+static gboolean write_all(gint fd, const guint8 *data, gsize len, guint64 offset) {
+    while (len > 0) {
+        gssize n = pwrite(fd, data, len, offset);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+
+        data += n;
+        len -= n;
+        offset += n;
+    }
+
+    return TRUE;
+}
+
+static gboolean read_all(gint fd, guint8 *data, gsize len, guint64 offset) {
+    while (len > 0) {
+        gssize n = pread(fd, data, len, offset);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+
+        data += n;
+        len -= n;
+        offset += n;
+    }
+
+    return TRUE;
+}
+
+// give back the space past end, writes go by spill_end so a failure only costs disk space
+// & what a store is still reading stays, new steps are spilled past it
+static void shrink_spill(UndoHistory *history, guint64 end) {
+    end = MAX(end, history->spill_floor);
+    history->spill_end = end;
+
+    if (ftruncate(history->spill_fd, end) != 0)
+        g_warning("couldn't shrink the undo spill file: %s", g_strerror(errno));
+}
+
+// compress a step in memory right away instead of waiting for the packer
+static gboolean pack_step(UndoStep *step) {
+    drop_pending(step);
+    if (step->packed) return TRUE;
+
+    GBytes *raw = pack_ops(step->ops);
+    step->packed = compress_bytes(raw);
+    g_bytes_unref(raw);
+
+    if (!step->packed) return FALSE;
+
+    free_ops(step->ops);
+    step->ops = NULL;
+    return TRUE;
+}
+
+// append a step to the spill file, FALSE if that can't be done
+static gboolean spill_step(UndoHistory *history, UndoStep *step) {
+    if (!pack_step(step)) return FALSE;
+
+    // unlinked straight away, so it's gone with the process whatever happens
+    if (history->spill_fd < 0) {
+        gchar *path;
+        history->spill_fd = g_file_open_tmp("notebook-undo-XXXXXX", &path, NULL);
+        if (history->spill_fd < 0) return FALSE;
+
+        g_unlink(path);
+        g_free(path);
+    }
+
+    gsize len;
+    const guint8 *data = (const guint8 *)g_bytes_get_data(step->packed, &len);
+    if (!write_all(history->spill_fd, data, len, history->spill_end)) return FALSE;
+
+    step->spill_offset = history->spill_end;
+    step->spill_len = len;
+    history->spill_end += len;
+
+    g_bytes_unref(step->packed);
+    step->packed = NULL;
+
+    g_queue_push_head(&history->spilled, step);
+    return TRUE;
+}
+
+// the newest spilled step is at the end of the file, which shrinks back to where it started
+static gboolean unspill_step(UndoHistory *history, UndoStep *step) {
+    guint8 *data = (guint8 *)g_malloc(step->spill_len);
+    gboolean read = read_all(history->spill_fd, data, step->spill_len, step->spill_offset);
+
+    if (read) step->ops = decompress_ops(data, step->spill_len, step->size);
+
+    g_free(data);
+    shrink_spill(history, step->spill_offset);
+
+    return step->ops != NULL;
+}
+
+static void drop_stored(UndoJournal *journal) {
+    if (!journal->stored) return;
+
+    g_mapped_file_unref(journal->stored);
+    g_free(journal->stored_path);
+    journal->stored = NULL;
+    journal->stored_path = NULL;
+    journal->stored_end = 0;
+}
+
+// the newest record left in the stored history, NULL once there are none
+// a step whose record doesn't check out comes back without its ops
+static UndoStep *read_stored_step(UndoJournal *journal) {
+    if (!journal->stored || journal->stored_end < STORE_HEADER_SIZE + STORE_TRAILER_SIZE) return NULL;
+
+    const guint8 *data = (const guint8 *)g_mapped_file_get_contents(journal->stored);
+    const guint8 *trailer = data + journal->stored_end - STORE_TRAILER_SIZE;
+    guint64 len = get_uint(trailer, 8);
+    UndoStep *step = g_new0(UndoStep, 1);
+
+    step->size = get_uint(trailer + 8, 8);
+
+    if (len <= journal->stored_end - STORE_HEADER_SIZE - STORE_TRAILER_SIZE) {
+        const guint8 *packed = trailer - len;
+
+        if (fnv1a(packed, len) == get_uint(trailer + 16, 4))
+            step->ops = decompress_ops(packed, len, step->size);
+
+        journal->stored_end -= len + STORE_TRAILER_SIZE;
+    }
+
+    return step;
+}
+
+// everything older than what's in memory, the stored history too on the undo side
+static void clear_spilled(UndoJournal *journal, UndoHistory *history) {
+    g_queue_clear_full(&history->spilled, undo_step_free);
+
+    if (history->spill_end > 0)
+        shrink_spill(history, 0);
+
+    if (history == &journal->undo)
+        drop_stored(journal);
+}
+
+static void store_free(gpointer data) {
+    UndoStore *store = (UndoStore *)data;
+
+    for (guint i = 0; i < store->records->len; i++) {
+        StoreRecord *record = &g_array_index(store->records, StoreRecord, i);
+        if (record->packed) g_bytes_unref(record->packed);
+        if (record->raw) g_bytes_unref(record->raw);
+    }
+
+    if (store->stored) g_mapped_file_unref(store->stored);
+    if (store->written) g_mapped_file_unref(store->written);
+    if (store->spill_fd >= 0) close(store->spill_fd);
+    g_array_free(store->records, TRUE);
+    g_free(store->path);
+    g_free(store);
+}
+
+// the history written by a store is read back from the file from now on,
+// as long as it's still the history the journal has
+static void collect_stores(UndoJournal *journal) {
+    UndoStore *store;
+
+    while ((store = (UndoStore *)g_async_queue_try_pop(journal->stores))) {
+        if (--journal->storing == 0)
+            journal->undo.spill_floor = 0;
+
+        if (store->written && store->changes == journal->undo_changes) {
+            UndoStep *step;
+            while ((step = (UndoStep *)g_queue_pop_head(&journal->undo.steps))) {
+                journal->memory -= step_memory(step);
+                undo_step_free(step);
+            }
+
+            clear_spilled(journal, &journal->undo);
+
+            journal->stored = store->written;
+            journal->stored_path = g_strdup(store->path);
+            journal->stored_end = store->end;
+            store->written = NULL;
+        }
+
+        store_free(store);
+    }
+}
+
+static void clear_history(UndoJournal *journal, UndoHistory *history) {
+    UndoStep *step;
+
+    collect_stores(journal);
+    if (history == &journal->undo) journal->undo_changes++;
+
+    while ((step = (UndoStep *)g_queue_pop_head(&history->steps))) {
+        journal->memory -= step_memory(step);
+        undo_step_free(step);
+    }
+
+    clear_spilled(journal, history);
+}
+
+// keep what's in memory within the budget, the oldest steps go to disk first
+// & the redo side before the undo side, it's dropped by the next edit anyway
+static void trim_steps(UndoJournal *journal) {
+    collect_packed(journal);
+
+    while (journal->memory > journal->max_bytes) {
+        UndoHistory *history = g_queue_is_empty(&journal->redo.steps) ? &journal->undo : &journal->redo;
+        UndoStep *step = (UndoStep *)g_queue_pop_tail(&history->steps);
+        if (!step) break;
+
+        journal->memory -= step_memory(step);
+
+        // the older steps can't be replayed without this one
+        if (!spill_step(history, step)) {
+            undo_step_free(step);
+            clear_spilled(journal, history);
+            if (history == &journal->undo) journal->undo_changes++;
+        }
+    }
+}
+
+// the step falling out of the hot ones gets compressed
+static void push_step(UndoJournal *journal, UndoHistory *history, UndoStep *step) {
+    collect_stores(journal);
+    if (history == &journal->undo) journal->undo_changes++;
+
+    g_queue_push_head(&history->steps, step);
+    journal->memory += step_memory(step);
+
+    UndoStep *cold = (UndoStep *)g_queue_peek_nth(&history->steps, UNDO_HOT_STEPS);
+    if (cold) start_pack(journal, cold);
+
+    trim_steps(journal);
+}
+
+// the most recent step with its ops back in memory
+static UndoStep *pop_step(UndoJournal *journal, UndoHistory *history) {
+    collect_stores(journal);
+    if (history == &journal->undo) journal->undo_changes++;
+
+    UndoStep *step = (UndoStep *)g_queue_pop_head(&history->steps);
+
+    if (step) {
+        journal->memory -= step_memory(step);
+        drop_pending(step);
+
+        if (step->ops) return step;
+
+        step->ops = decompress_ops((const guint8 *)g_bytes_get_data(step->packed, NULL),
+                                   g_bytes_get_size(step->packed), step->size);
+        g_bytes_unref(step->packed);
+        step->packed = NULL;
+    } else if ((step = (UndoStep *)g_queue_pop_head(&history->spilled))) {
+        unspill_step(history, step);
+    } else if (history == &journal->undo) {
+        step = read_stored_step(journal);
+        if (!step) return NULL;
+    } else {
+        return NULL;
+    }
+
+    // history that can't be read back ends here
+    if (!step->ops) {
+        undo_step_free(step);
+        clear_history(journal, history);
+        return NULL;
+    }
+
+    return step;
+}
+
+// a record & its trailer at offset
+static gboolean write_record(gint fd, guint64 offset, const guint8 *packed, gsize len, gsize size) {
+    guint8 trailer[STORE_TRAILER_SIZE];
+
+    put_uint(trailer, len, 8);
+    put_uint(trailer + 8, size, 8);
+    put_uint(trailer + 16, fnv1a(packed, len), 4);
+
+    return write_all(fd, packed, len, offset) && write_all(fd, trailer, STORE_TRAILER_SIZE, offset + len);
+}
+
+// store thread, a record's compressed ops from wherever they are
+static GBytes *store_record_bytes(UndoStore *store, StoreRecord *record) {
+    if (record->packed) return g_bytes_ref(record->packed);
+    if (record->raw) return compress_bytes(record->raw);
+
+    guint8 *data = (guint8 *)g_malloc(record->spill_len);
+    if (!read_all(store->spill_fd, data, record->spill_len, record->spill_offset)) {
+        g_free(data);
+        return NULL;
+    }
+
+    return g_bytes_new_take(data, record->spill_len);
+}
+
+// where the newest stored records that fit in budget start, older ones are left behind
+static gsize stored_keep_from(const guint8 *data, gsize end, gsize budget) {
+    gsize pos = end;
+
+    while (pos >= STORE_HEADER_SIZE + STORE_TRAILER_SIZE) {
+        guint64 len = get_uint(data + pos - STORE_TRAILER_SIZE, 8);
+        if (len > pos - STORE_HEADER_SIZE - STORE_TRAILER_SIZE) break;
+
+        gsize start = pos - STORE_TRAILER_SIZE - len;
+        if (end - start > budget) break;
+        pos = start;
+    }
+
+    return pos;
+}
+
+// store thread, the new records after the stored ones, the newest of both that fit
+static gboolean write_store(UndoStore *store) {
+    GPtrArray *records = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+
+    for (guint i = 0; i < store->records->len; i++) {
+        GBytes *bytes = store_record_bytes(store, &g_array_index(store->records, StoreRecord, i));
+
+        if (!bytes) {
+            g_ptr_array_free(records, TRUE);
+            return FALSE;
+        }
+
+        g_ptr_array_add(records, bytes);
+    }
+
+    // history is kept from the newest step back, as far as fits
+    gsize budget = UNDO_STORE_MAX_SIZE - STORE_HEADER_SIZE;
+    guint first = records->len;
+
+    while (first > 0) {
+        gsize len = g_bytes_get_size((GBytes *)g_ptr_array_index(records, first - 1)) + STORE_TRAILER_SIZE;
+        if (len > budget) break;
+
+        budget -= len;
+        first--;
+    }
+
+    const guint8 *stored = store->stored ? (const guint8 *)g_mapped_file_get_contents(store->stored) : NULL;
+    gsize keep_from = first > 0 || !stored ? store->stored_end : stored_keep_from(stored, store->stored_end, budget);
+
+    // the history this came from only needs the newer steps on the end, unless
+    // something else has written to it since or its oldest steps no longer fit
+    gboolean append = FALSE;
+    guint64 end = STORE_HEADER_SIZE;
+    gint fd = -1;
+
+    if (store->append && keep_from == STORE_HEADER_SIZE) {
+        GStatBuf info;
+        fd = g_open(store->path, O_WRONLY, 0);
+        append = fd >= 0 && fstat(fd, &info) == 0 && (guint64)info.st_size == store->stored_end;
+
+        if (!append && fd >= 0) close(fd);
+        if (append) end = store->stored_end;
+    }
+
+    // otherwise written from scratch next to it & renamed over it, so a tab
+    // still reading the old one keeps reading what it mapped
+    gchar *temp = NULL;
+    gboolean ok = TRUE;
+
+    if (!append) {
+        gchar *dir = g_path_get_dirname(store->path);
+        g_mkdir_with_parents(dir, 0700);
+        g_free(dir);
+
+        temp = g_strconcat(store->path, ".new", NULL);
+        fd = g_open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        ok = fd >= 0;
+
+        // the records still to be undone carry over as they are
+        if (ok && keep_from < store->stored_end) {
+            ok = write_all(fd, stored + keep_from, store->stored_end - keep_from, STORE_HEADER_SIZE);
+            end += store->stored_end - keep_from;
+        }
+    }
+
+    for (guint i = first; ok && i < records->len; i++) {
+        gsize len;
+        const guint8 *data = (const guint8 *)g_bytes_get_data((GBytes *)g_ptr_array_index(records, i), &len);
+
+        ok = write_record(fd, end, data, len, g_array_index(store->records, StoreRecord, i).size);
+        end += len + STORE_TRAILER_SIZE;
+    }
+
+    if (ok) {
+        guint8 header[STORE_HEADER_SIZE];
+        memcpy(header, STORE_MAGIC, 4);
+        put_uint(header + 4, STORE_VERSION, 4);
+        memcpy(header + 8, store->hash, UNDO_HASH_SIZE);
+        put_uint(header + 40, end, 8);
+
+        ok = write_all(fd, header, STORE_HEADER_SIZE, 0);
+    }
+
+    if (fd >= 0 && close(fd) != 0) ok = FALSE;
+    if (ok && temp && g_rename(temp, store->path) != 0) ok = FALSE;
+    if (!ok && temp) g_unlink(temp);
+
+    if (ok) {
+        store->written = g_mapped_file_new(store->path, FALSE, NULL);
+        store->end = end;
+    }
+
+    g_free(temp);
+    g_ptr_array_free(records, TRUE);
+    return ok;
+}
+
+// store thread
+static void store_worker(gpointer data, gpointer user_data) {
+    UndoStore *store = (UndoStore *)data;
+    GAsyncQueue *done = store->done;
+
+    write_store(store);
+    g_async_queue_push(done, store);
+    g_async_queue_unref(done);
+}
+
+static void init_history(UndoHistory *history) {
+    g_queue_init(&history->steps);
+    g_queue_init(&history->spilled);
+    history->spill_fd = -1;
+}
+
+UndoJournal *undo_journal_new(gsize max_bytes) {
+    UndoJournal *journal = g_new0(UndoJournal, 1);
+    init_history(&journal->undo);
+    init_history(&journal->redo);
+    journal->max_bytes = max_bytes;
+    journal->packer = g_thread_pool_new(pack_worker, journal, 1, FALSE, NULL);
+    journal->packed = g_async_queue_new();
+    journal->storer = g_thread_pool_new(store_worker, NULL, 1, FALSE, NULL);
+    journal->stores = g_async_queue_new_full(store_free);
+    return journal;
+}
+
+void undo_journal_free(UndoJournal *journal) {
+    undo_journal_clear(journal);
+
+    // whatever the packer still has is for steps that are gone
+    g_thread_pool_free(journal->packer, FALSE, TRUE);
+    collect_packed(journal);
+    g_async_queue_unref(journal->packed);
+
+    // a store still being written has all it needs & finishes on its own
+    g_thread_pool_free(journal->storer, FALSE, FALSE);
+    g_async_queue_unref(journal->stores);
+
+    drop_stored(journal);
+    if (journal->undo.spill_fd >= 0) close(journal->undo.spill_fd);
+    if (journal->redo.spill_fd >= 0) close(journal->redo.spill_fd);
+    g_free(journal);
+}
+
+void undo_journal_clear(UndoJournal *journal) {
+    clear_history(journal, &journal->undo);
+    clear_history(journal, &journal->redo);
+
+    if (journal->open_step) {
+        undo_step_free(journal->open_step);
+        journal->open_step = NULL;
+    }
+}
+
+void undo_journal_set_limit(UndoJournal *journal, gsize max_bytes) {
+    journal->max_bytes = max_bytes;
+    trim_steps(journal);
+}
+
+// groups can nest, only the outermost one closes the step
+void undo_journal_begin_group(UndoJournal *journal) {
+    journal->group_depth++;
+}
+
+void undo_journal_end_group(UndoJournal *journal) {
+    if (journal->group_depth == 0) return;
+    if (--journal->group_depth > 0) return;
+
+    UndoStep *step = journal->open_step;
+    journal->open_step = NULL;
+    if (!step) return;
+
+    if (step->ops->len == 0) {
+        undo_step_free(step);
+        return;
+    }
+
+    push_step(journal, &journal->undo, step);
+}
+
+// any new edit makes the redo history invalid
+static void record_op(UndoJournal *journal, UndoOpType type, gint offset, const gchar *text, gint len) {
+    clear_history(journal, &journal->redo);
+
+    UndoOp op;
+    op.type = type;
+    op.offset = offset;
+    op.text = len < 0 ? g_strdup(text) : g_strndup(text, len);
+    op.length = g_utf8_strlen(op.text, -1);
+
+    gsize size = sizeof(UndoOp) + strlen(op.text) + 1;
+
+    if (journal->group_depth > 0) {
+        if (!journal->open_step)
+            journal->open_step = undo_step_new();
+
+        g_array_append_val(journal->open_step->ops, op);
+        journal->open_step->size += size;
+        return;
+    }
+
+    // edits made outside of a user action are a step on their own
+    UndoStep *step = undo_step_new();
+    g_array_append_val(step->ops, op);
+    step->size = size;
+    push_step(journal, &journal->undo, step);
+}
+
+void undo_journal_record_insert(UndoJournal *journal, gint offset, const gchar *text, gint len) {
+    record_op(journal, UNDO_OP_INSERT, offset, text, len);
+}
+
+void undo_journal_record_delete(UndoJournal *journal, gint offset, const gchar *text, gint len) {
+    record_op(journal, UNDO_OP_DELETE, offset, text, len);
+}
+
+// revert the most recent step by replaying the inverse of its ops backwards
+gboolean undo_journal_undo(UndoJournal *journal, UndoApplyFunc apply, gpointer user_data) {
+    UndoStep *step = pop_step(journal, &journal->undo);
+    if (!step) return FALSE;
+
+    for (guint i = step->ops->len; i > 0; i--) {
+        UndoOp *op = &g_array_index(step->ops, UndoOp, i - 1);
+        UndoOpType inverse = op->type == UNDO_OP_INSERT ? UNDO_OP_DELETE : UNDO_OP_INSERT;
+        apply(inverse, op->offset, op->text, op->length, user_data);
+    }
+
+    push_step(journal, &journal->redo, step);
+    return TRUE;
+}
+
+// reapply the most recently undone step
+gboolean undo_journal_redo(UndoJournal *journal, UndoApplyFunc apply, gpointer user_data) {
+    UndoStep *step = pop_step(journal, &journal->redo);
+    if (!step) return FALSE;
+
+    for (guint i = 0; i < step->ops->len; i++) {
+        UndoOp *op = &g_array_index(step->ops, UndoOp, i);
+        apply(op->type, op->offset, op->text, op->length, user_data);
+    }
+
+    push_step(journal, &journal->undo, step);
+    return TRUE;
+}
+
+// compressing & writing happen on the store thread, all that's done here is
+// taking references to the steps, & serialising the ones that aren't compressed
+void undo_journal_store(UndoJournal *journal, const gchar *path, const guint8 *hash) {
+    UndoHistory *history = &journal->undo;
+    UndoStore *store = g_new0(UndoStore, 1);
+
+    collect_packed(journal);
+    collect_stores(journal);
+
+    store->done = g_async_queue_ref(journal->stores);
+    store->path = g_strdup(path);
+    memcpy(store->hash, hash, UNDO_HASH_SIZE);
+    store->stored_end = STORE_HEADER_SIZE;
+    store->spill_fd = -1;
+    store->records = g_array_new(FALSE, TRUE, sizeof(StoreRecord));
+    store->changes = journal->undo_changes;
+
+    if (journal->stored) {
+        store->stored = g_mapped_file_ref(journal->stored);
+        store->stored_end = journal->stored_end;
+        store->append = g_strcmp0(journal->stored_path, path) == 0
+            && journal->stored_end == g_mapped_file_get_length(journal->stored);
+    }
+
+    // the spill file is read where the steps are now, so it isn't shrunk below that meanwhile
+    if (!g_queue_is_empty(&history->spilled)) {
+        store->spill_fd = dup(history->spill_fd);
+        history->spill_floor = MAX(history->spill_floor, history->spill_end);
+    }
+
+    for (GList *link = history->spilled.tail; link; link = link->prev) {
+        UndoStep *step = (UndoStep *)link->data;
+        StoreRecord record = { NULL, NULL, step->spill_offset, step->spill_len, step->size };
+        g_array_append_val(store->records, record);
+    }
+
+    for (GList *link = history->steps.tail; link; link = link->prev) {
+        UndoStep *step = (UndoStep *)link->data;
+        StoreRecord record = { NULL, NULL, 0, 0, step->size };
+
+        if (step->packed) {
+            record.packed = g_bytes_ref(step->packed);
+        } else {
+            record.raw = pack_ops(step->ops);
+        }
+
+        g_array_append_val(store->records, record);
+    }
+
+    journal->storing++;
+    g_thread_pool_push(journal->storer, store, NULL);
+}
+
+gboolean undo_journal_load(UndoJournal *journal, const gchar *path, const guint8 *hash) {
+    GMappedFile *stored = g_mapped_file_new(path, FALSE, NULL);
+    if (!stored) return FALSE;
+
+    const guint8 *data = (const guint8 *)g_mapped_file_get_contents(stored);
+    gsize len = g_mapped_file_get_length(stored);
+    guint64 end = len >= STORE_HEADER_SIZE ? get_uint(data + 40, 8) : 0;
+
+    if (len < STORE_HEADER_SIZE || memcmp(data, STORE_MAGIC, 4) != 0 || get_uint(data + 4, 4) != STORE_VERSION
+            || memcmp(data + 8, hash, UNDO_HASH_SIZE) != 0 || end < STORE_HEADER_SIZE || end > len) {
+        g_mapped_file_unref(stored);
+        return FALSE;
+    }
+
+    clear_history(journal, &journal->undo);
+
+    journal->stored = stored;
+    journal->stored_path = g_strdup(path);
+    journal->stored_end = end;
+    return TRUE;
+}
+
+void undo_journal_prune(const gchar *path, gint64 max_age) {
+    GDir *dir = g_dir_open(path, 0, NULL);
+    if (!dir) return;
+
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    const gchar *name;
+
+    while ((name = g_dir_read_name(dir))) {
+        gchar *file = g_build_filename(path, name, NULL);
+        GStatBuf info;
+
+        // a tab that has it mapped keeps reading it, & writes a new one on its next save
+        if (g_stat(file, &info) == 0 && S_ISREG(info.st_mode) && now - info.st_mtime > max_age)
+            g_unlink(file);
+
+        g_free(file);
+    }
+
+    g_dir_close(dir);
+}
@@ -0,0 +1,113 @@
+#ifndef NOTEBOOK_UNDO_H
+#define NOTEBOOK_UNDO_H
+
+#include <glib.h>
+
+// undo & redo journal
+// instead of snapshotting the whole buffer, every edit is recorded as the
+// range that was inserted or deleted, and undo/redo replay the inverse
+//
+// history is kept to a memory budget rather than a number of steps: the newest
+// steps are left as they are, older ones get compressed by a background thread,
+// and whatever still doesn't fit goes to a temporary file instead of being lost
+
+// newest steps of each direction that are never compressed
+#define UNDO_HOT_STEPS 16
+
+// smaller steps aren't worth compressing until they have to go to disk
+#define UNDO_PACK_MIN 4096
+
+// the text a stored history leads up to is identified by a sha-256 of it
+#define UNDO_HASH_SIZE 32
+
+// a stored history keeps only its newest steps, up to this much
+#define UNDO_STORE_MAX_SIZE (16 * 1024 * 1024)
+
+typedef enum {
+    UNDO_OP_INSERT,
+    UNDO_OP_DELETE,
+} UndoOpType;
+
+// a single edit, offsets & lengths are in characters (same as GtkTextIter offsets)
+typedef struct {
+    UndoOpType type;
+    gint offset;
+    gint length;
+    gchar *text;
+} UndoOp;
+
+typedef struct UndoPack UndoPack;
+typedef struct UndoStore UndoStore;
+
+// every edit made during one user action, undone & redone together
+// a step's ops are in one of three places, put back in ops before replaying
+typedef struct {
+    GArray *ops;          // UndoOp, NULL while packed or spilled
+    gsize size;           // bytes the ops take unpacked
+    GBytes *packed;       // the ops compressed, in memory
+    UndoPack *pending;    // being compressed in the background
+    guint64 spill_offset; // where the compressed ops are in the spill file
+    gsize spill_len;
+} UndoStep;
+
+// one direction of history, the most recent step at the head
+// spilled steps are all older than the ones in memory & are written in that
+// order, so the spill file works as a stack, the newest always at its end
+typedef struct {
+    GQueue steps;       // UndoStep * in memory
+    GQueue spilled;     // UndoStep * in the spill file
+    gint spill_fd;      // -1 until something is spilled
+    guint64 spill_end;
+    guint64 spill_floor; // a store is still reading the file below this
+} UndoHistory;
+
+typedef struct {
+    UndoHistory undo;
+    UndoHistory redo;
+    UndoStep *open_step;
+    gint group_depth;
+    gsize max_bytes;
+    gsize memory;         // what the steps in memory take, packed or not
+    GThreadPool *packer;  // one thread compressing cold steps
+    GAsyncQueue *packed;  // UndoPack * done compressing, picked up on the main thread
+    GMappedFile *stored;  // undo history kept from an earlier session, older than anything spilled
+    gchar *stored_path;
+    gsize stored_end;     // its records past this have been undone already
+    GThreadPool *storer;  // one thread writing stored history out
+    GAsyncQueue *stores;  // UndoStore * done writing, picked up on the main thread
+    guint storing;        // stores not picked up yet
+    guint undo_changes;   // bumped by every change to the undo side, a store is only
+                          // swapped in if it wrote the history as it still is
+} UndoJournal;
+
+// called while replaying a step to actually change the document
+typedef void (*UndoApplyFunc)(UndoOpType type, gint offset, const gchar *text, gint length, gpointer user_data);
+
+// max_bytes is the memory budget, anything past it is spilled to disk
+UndoJournal *undo_journal_new(gsize max_bytes);
+void undo_journal_free(UndoJournal *journal);
+void undo_journal_clear(UndoJournal *journal);
+void undo_journal_set_limit(UndoJournal *journal, gsize max_bytes);
+
+void undo_journal_begin_group(UndoJournal *journal);
+void undo_journal_end_group(UndoJournal *journal);
+
+void undo_journal_record_insert(UndoJournal *journal, gint offset, const gchar *text, gint len);
+void undo_journal_record_delete(UndoJournal *journal, gint offset, const gchar *text, gint len);
+
+gboolean undo_journal_undo(UndoJournal *journal, UndoApplyFunc apply, gpointer user_data);
+gboolean undo_journal_redo(UndoJournal *journal, UndoApplyFunc apply, gpointer user_data);
+
+// undo history kept between sessions, in a file of its own along with the hash
+// of the text it leads up to, so it's only picked up again for that same text
+// storing takes a snapshot of the undo side & has the store thread compress it &
+// write it out (appending when it can), the history is read back from the file
+// once that's done unless it's changed since. loading only maps the file and
+// steps are read from it as undo gets to them, FALSE if it isn't for this text
+void undo_journal_store(UndoJournal *journal, const gchar *path, const guint8 *hash);
+gboolean undo_journal_load(UndoJournal *journal, const gchar *path, const guint8 *hash);
+
+// delete the stored histories in dir that haven't been written in max_age seconds
+void undo_journal_prune(const gchar *dir, gint64 max_age);
+
+#endif
@@ -0,0 +1,118 @@
+#include "viewer.h"
+
+#include <string.h>
+
+MappedDoc *mapped_doc_open(const gchar *filename, GError **error) {
+    GMappedFile *file = g_mapped_file_new(filename, FALSE, error);
+    if (!file) return NULL;
+
+    MappedDoc *doc = g_new(MappedDoc, 1);
+    doc->file = file;
+    doc->data = g_mapped_file_get_contents(file);
+    doc->len = g_mapped_file_get_length(file);
+    return doc;
+}
+
+void mapped_doc_free(MappedDoc *doc) {
+    g_mapped_file_unref(doc->file);
+    g_free(doc);
+}
+
+GBytes *mapped_doc_get_bytes(MappedDoc *doc) {
+    return g_mapped_file_get_bytes(doc->file);
+}
+
+// back up to the first byte of the character pos is in
+static gsize char_start(MappedDoc *doc, gsize pos) {
+    while (pos > 0 && pos < doc->len && ((guchar)doc->data[pos] & 0xC0) == 0x80)
+        pos--;
+
+    return pos;
+}
+
+// last newline in [from, to), or -1
+static gssize find_newline_before(MappedDoc *doc, gsize from, gsize to) {
+    for (gsize i = to; i > from; i--) {
+        if (doc->data[i - 1] == '\n')
+            return i - 1;
+    }
+
+    return -1;
+}
+
+// lines are split at every multiple of VIEWER_MAX_LINE that has no newline in
+// the VIEWER_MAX_LINE bytes before it, so segments are the same no matter
+// where the walking started and none is longer than twice that
+gsize mapped_doc_line_start(MappedDoc *doc, gsize pos) {
+    pos = MIN(pos, doc->len);
+
+    gsize from = pos > 2 * VIEWER_MAX_LINE ? pos - 2 * VIEWER_MAX_LINE : 0;
+    gssize newline = find_newline_before(doc, from, pos);
+
+    // a split point backs up to the start of the character it lands in,
+    // which can put it up to 3 bytes before the multiple
+    gsize aligned = (pos + 3) / VIEWER_MAX_LINE * VIEWER_MAX_LINE;
+    if (aligned > 0 && char_start(doc, aligned) > pos)
+        aligned -= VIEWER_MAX_LINE;
+
+    if (newline < 0 && from == 0)
+        return aligned >= VIEWER_MAX_LINE ? char_start(doc, aligned) : 0;
+
+    if (newline < 0)
+        return char_start(doc, aligned);
+
+    gsize start = newline + 1;
+    if (aligned >= start + VIEWER_MAX_LINE)
+        return char_start(doc, aligned);
+
+    return start;
+}
+
+gsize mapped_doc_next_line(MappedDoc *doc, gsize pos) {
+    if (pos >= doc->len) return doc->len;
+
+    gsize limit = MIN(doc->len, pos + 2 * VIEWER_MAX_LINE);
+    const gchar *newline = (const gchar *)memchr(doc->data + pos, '\n', limit - pos);
+    gsize next = newline ? newline - doc->data + 1 : limit;
+
+    // a long line can be split before the newline
+    for (gsize aligned = (pos / VIEWER_MAX_LINE + 1) * VIEWER_MAX_LINE; aligned < next; aligned += VIEWER_MAX_LINE) {
+        gsize start = mapped_doc_line_start(doc, aligned);
+        if (start > pos)
+            return start;
+    }
+
+    return next;
+}
+
+gsize mapped_doc_prev_line(MappedDoc *doc, gsize pos) {
+    return pos > 0 ? mapped_doc_line_start(doc, pos - 1) : 0;
+}
+
+gsize mapped_doc_window_end(MappedDoc *doc, gsize pos, guint lines, gsize max_bytes) {
+    gsize end = pos;
+
+    for (guint i = 0; i < lines && end < doc->len; i++) {
+        gsize next = mapped_doc_next_line(doc, end);
+        if (i > 0 && next - pos > max_bytes) break;
+
+        end = next;
+    }
+
+    return end;
+}
+
+gboolean has_long_line(const gchar *text, gsize len, gsize *run, gsize limit) {
+    const gchar *end = text + len;
+    const gchar *newline;
+
+    while ((newline = (const gchar *)memchr(text, '\n', end - text))) {
+        if (*run + (newline - text) > limit) return TRUE;
+
+        *run = 0;
+        text = newline + 1;
+    }
+
+    *run += end - text;
+    return *run > limit;
+}
@@ -0,0 +1,40 @@
+#ifndef NOTEBOOK_VIEWER_H
+#define NOTEBOOK_VIEWER_H
+
+#include <glib.h>
+
+// read only large file viewer core, independent from GTK
+// the file is memory mapped and only ever walked a line at a time around the
+// position being looked at, so nothing is proportional to the file size
+
+// lines longer than this are cut into segments of about this size,
+// so no single line can make the view materialize a huge amount of text
+#define VIEWER_MAX_LINE (64 * 1024)
+
+typedef struct {
+    GMappedFile *file;
+    const gchar *data;
+    gsize len;
+} MappedDoc;
+
+MappedDoc *mapped_doc_open(const gchar *filename, GError **error);
+void mapped_doc_free(MappedDoc *doc);
+
+// the whole mapping as bytes without copying, e.g. as a search snapshot
+GBytes *mapped_doc_get_bytes(MappedDoc *doc);
+
+// start of the line (or segment of a long line) pos is on
+gsize mapped_doc_line_start(MappedDoc *doc, gsize pos);
+
+// start of the line after & before the one starting at pos
+gsize mapped_doc_next_line(MappedDoc *doc, gsize pos);
+gsize mapped_doc_prev_line(MappedDoc *doc, gsize pos);
+
+// end of up to lines lines from pos, stopping early after max_bytes
+gsize mapped_doc_window_end(MappedDoc *doc, gsize pos, guint lines, gsize max_bytes);
+
+// whether text has a line longer than limit bytes, run carries the length of the
+// line it's in from one piece of text to the next, so a file can be read in chunks
+gboolean has_long_line(const gchar *text, gsize len, gsize *run, gsize limit);
+
+#endif
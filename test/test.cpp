@@ -0,0 +1,284 @@
+// tests for the editing core, without GTK, run with
+//   make test
+// the simd paths are checked against byte at a time answers, around the 16 byte
+// blocks they work in & the pieces the document is made of
+
+#include "document.h"
+#include "encoding.h"
+
+#include <string.h>
+
+// a sequence starting this far into text is tried at every offset up to here,
+// which is a few 16 byte blocks & every position inside them
+#define TEST_EDGE_OFFSETS 48
+#define TEST_TEXT_SIZE 80
+
+// random texts checked against the reference
+#define TEST_RANDOM_TEXTS 20000
+
+// documents up to this long have the line of every character checked
+#define TEST_CHECK_ALL_SIZE 4096
+
+// length of the valid utf-8 at the start of text, by glib's own validator,
+// which doesn't take nul bytes either
+static gsize reference_valid_len(const gchar *text, gsize len) {
+    const gchar *end;
+    g_utf8_validate_len(text, len, &end);
+    return end - text;
+}
+
+// ascii around seq, with seq at offset
+static gsize place_sequence(gchar *text, gsize offset, const gchar *seq) {
+    gsize seq_len = strlen(seq);
+    memset(text, 'a', TEST_TEXT_SIZE);
+    memcpy(text + offset, seq, seq_len);
+    return seq_len;
+}
+
+static void test_utf8_invalid(void) {
+    static const gchar *invalid[] = {
+        // overlong
+        "\xC0\x80", "\xC1\xBF", "\xE0\x80\x80", "\xE0\x9F\xBF", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF",
+        // surrogates
+        "\xED\xA0\x80", "\xED\xAF\xBF", "\xED\xBF\xBF",
+        // past U+10FFFF
+        "\xF4\x90\x80\x80", "\xF4\xBF\xBF\xBF", "\xF5\x80\x80\x80", "\xF7\xBF\xBF\xBF", "\xF8\x88\x80\x80\x80", "\xFF",
+        // continuations without a lead, & one too many
+        "\x80", "\xBF", "\xC3\xA9\x80", "\xE2\x82\xAC\x80",
+    };
+    gchar text[TEST_TEXT_SIZE];
+
+    for (gsize i = 0; i < G_N_ELEMENTS(invalid); i++) {
+        for (gsize offset = 0; offset < TEST_EDGE_OFFSETS; offset++) {
+            place_sequence(text, offset, invalid[i]);
+
+            gsize valid = utf8_valid_len(text, TEST_TEXT_SIZE);
+            g_assert_cmpuint(valid, ==, reference_valid_len(text, TEST_TEXT_SIZE));
+            g_assert_cmpuint(valid, <, offset + strlen(invalid[i]));
+        }
+    }
+}
+
+static void test_utf8_valid(void) {
+    static const gchar *valid[] = {
+        "\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80", "\xED\x9F\xBF", "\xEE\x80\x80", "\xEF\xBF\xBF",
+        "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF",
+    };
+    gchar text[TEST_TEXT_SIZE];
+
+    for (gsize i = 0; i < G_N_ELEMENTS(valid); i++) {
+        for (gsize offset = 0; offset < TEST_EDGE_OFFSETS; offset++) {
+            place_sequence(text, offset, valid[i]);
+            g_assert_cmpuint(utf8_valid_len(text, TEST_TEXT_SIZE), ==, TEST_TEXT_SIZE);
+        }
+    }
+
+    // nul is valid utf-8, but not for a text buffer
+    memset(text, 'a', TEST_TEXT_SIZE);
+    text[17] = '\0';
+    g_assert_cmpuint(utf8_valid_len(text, TEST_TEXT_SIZE), ==, 17);
+}
+
+// sequences cut short where a block ends, either by ascii or by the end of the text
+static void test_utf8_truncated(void) {
+    static const gchar *sequences[] = {
+        "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80",
+    };
+    gchar text[TEST_TEXT_SIZE];
+
+    for (gsize i = 0; i < G_N_ELEMENTS(sequences); i++) {
+        gsize seq_len = strlen(sequences[i]);
+
+        for (gsize edge = 16; edge <= TEST_EDGE_OFFSETS; edge += 16) {
+            for (gsize kept = 1; kept < seq_len; kept++) {
+                gsize offset = edge - kept;
+                place_sequence(text, offset, sequences[i]);
+                memset(text + edge, 'a', seq_len - kept);
+
+                g_assert_cmpuint(utf8_valid_len(text, TEST_TEXT_SIZE), ==, offset);
+                g_assert_cmpuint(utf8_valid_len(text, edge), ==, offset);
+                g_assert_cmpuint(reference_valid_len(text, edge), ==, offset);
+            }
+        }
+    }
+}
+
+static void test_utf8_random(void) {
+    static const gchar *alphabet[] = {
+        "a", "\n", "\xC3\xA9", "\xE2\x82\xAC", "\xED\x9F\xBF", "\xF0\x9F\x98\x80", "\xF4\x8F\xBF\xBF",
+    };
+    gchar text[4 * TEST_TEXT_SIZE];
+
+    for (guint n = 0; n < TEST_RANDOM_TEXTS; n++) {
+        gsize len = 0;
+        gsize want = g_test_rand_int_range(0, sizeof(text) - 4);
+
+        while (len < want) {
+            const gchar *seq = alphabet[g_test_rand_int_range(0, G_N_ELEMENTS(alphabet))];
+            memcpy(text + len, seq, strlen(seq));
+            len += strlen(seq);
+        }
+
+        // then break it, with a random byte or by cutting it short
+        if (len > 0 && g_test_rand_bit())
+            text[g_test_rand_int_range(0, len)] = (gchar)g_test_rand_int_range(0, 256);
+        if (len > 0 && g_test_rand_bit())
+            len = g_test_rand_int_range(0, len);
+
+        g_assert_cmpuint(utf8_valid_len(text, len), ==, reference_valid_len(text, len));
+    }
+}
+
+// whether a line break is counted at byte i, a \r\n at its \r
+static gboolean reference_break_at(const gchar *text, gsize len, gsize i) {
+    if (text[i] == '\r') return TRUE;
+    if (text[i] == '\n') return i == 0 || text[i - 1] != '\r';
+
+    return i + 2 < len && memcmp(text + i, "\xE2\x80", 2) == 0 && (text[i + 2] == '\xA8' || text[i + 2] == '\xA9');
+}
+
+static void check_lines(Document *doc) {
+    gchar *text = document_get_text(doc, 0, document_get_chars(doc));
+    gsize len = strlen(text);
+    gsize line = 0;
+    gint offset = 0;
+    gboolean after_break = FALSE;
+
+    // every character is on the line after the breaks before it, & a line starts
+    // at the first character after a break (both halves of a \r\n are before it)
+    // a lookup scans inside its piece, so long texts only check around the breaks
+    for (gsize i = 0; i < len; i++) {
+        if ((text[i] & 0xC0) == 0x80) continue;
+
+        gboolean is_break = reference_break_at(text, len, i);
+        if (len <= TEST_CHECK_ALL_SIZE || is_break || after_break)
+            g_assert_cmpuint(document_line_at(doc, offset), ==, line);
+
+        after_break = is_break;
+
+        if (is_break) {
+            line++;
+
+            gsize end = i + g_utf8_skip[(guchar)text[i]];
+            if (text[i] == '\r' && end < len && text[end] == '\n') end++;
+
+            g_assert_cmpint(document_line_start(doc, line), ==, g_utf8_pointer_to_offset(text, text + end));
+        }
+
+        offset++;
+    }
+
+    g_assert_cmpuint(document_get_lines(doc), ==, line + 1);
+    g_free(text);
+}
+
+// \r\n inside one piece, across every spot of the blocks the breaks are counted in
+static void test_lines_crlf_blocks(void) {
+    gchar text[TEST_TEXT_SIZE];
+
+    for (gsize offset = 0; offset + 2 <= TEST_TEXT_SIZE; offset++) {
+        Document *doc = document_new();
+
+        memset(text, 'a', TEST_TEXT_SIZE);
+        memcpy(text + offset, "\r\n", 2);
+        document_insert(doc, 0, text, TEST_TEXT_SIZE);
+
+        g_assert_cmpuint(document_get_lines(doc), ==, 2);
+        g_assert_cmpint(document_line_start(doc, 1), ==, offset + 2);
+        g_assert_cmpuint(document_line_at(doc, offset), ==, 0);
+        check_lines(doc);
+
+        document_free(doc);
+    }
+}
+
+// \r\n with the \r ending one piece & the \n starting the next
+static void test_lines_crlf_pieces(void) {
+    gchar *text = (gchar *)g_malloc(DOC_PIECE_SIZE);
+    memset(text, 'a', DOC_PIECE_SIZE);
+    text[DOC_PIECE_SIZE - 1] = '\r';
+
+    // typed after, the \n lands in the next storage block
+    Document *doc = document_new();
+    document_insert(doc, 0, text, DOC_PIECE_SIZE);
+    document_insert(doc, DOC_PIECE_SIZE, "\nb", 2);
+
+    g_assert_cmpuint(document_get_lines(doc), ==, 2);
+    g_assert_cmpint(document_line_start(doc, 1), ==, DOC_PIECE_SIZE + 1);
+    check_lines(doc);
+
+    // broken apart & joined again by an edit in between
+    document_insert(doc, DOC_PIECE_SIZE, "x", 1);
+    g_assert_cmpuint(document_get_lines(doc), ==, 3);
+    check_lines(doc);
+
+    document_delete(doc, DOC_PIECE_SIZE, 1);
+    g_assert_cmpuint(document_get_lines(doc), ==, 2);
+    check_lines(doc);
+
+    // & the \n typed first, the \r in front of it later
+    document_delete(doc, DOC_PIECE_SIZE - 1, 1);
+    g_assert_cmpuint(document_get_lines(doc), ==, 2);
+    document_insert(doc, DOC_PIECE_SIZE - 1, "\r", 1);
+    g_assert_cmpuint(document_get_lines(doc), ==, 2);
+    check_lines(doc);
+
+    document_free(doc);
+
+    // a \n typed in front of a \r doesn't make a \r\n
+    doc = document_new();
+    document_insert(doc, 0, "a\rb", 3);
+    document_insert(doc, 1, "\n", 1);
+    g_assert_cmpuint(document_get_lines(doc), ==, 3);
+    check_lines(doc);
+
+    document_free(doc);
+    g_free(text);
+}
+
+// random edits of text full of breaks, so pieces start & end all over them
+static void test_lines_random_edits(void) {
+    static const gchar *alphabet[] = {
+        "a", "\r", "\n", "\r\n", "\xE2\x80\xA8", "\xE2\x80\xA9", "\xC3\xA9",
+    };
+
+    for (guint n = 0; n < 200; n++) {
+        Document *doc = document_new();
+
+        for (guint edit = 0; edit < 40; edit++) {
+            gsize chars = document_get_chars(doc);
+
+            if (chars > 0 && g_test_rand_int_range(0, 4) == 0) {
+                gint at = g_test_rand_int_range(0, chars);
+                gint length = MIN(g_test_rand_int_range(1, 4), (gint)(chars - at));
+                document_delete(doc, at, length);
+            } else {
+                GString *text = g_string_new(NULL);
+                gint count = g_test_rand_int_range(1, g_test_rand_bit() ? 8 : 200);
+
+                for (gint i = 0; i < count; i++)
+                    g_string_append(text, alphabet[g_test_rand_int_range(0, G_N_ELEMENTS(alphabet))]);
+
+                document_insert(doc, g_test_rand_int_range(0, chars + 1), text->str, text->len);
+                g_string_free(text, TRUE);
+            }
+        }
+
+        check_lines(doc);
+        document_free(doc);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/utf8/invalid", test_utf8_invalid);
+    g_test_add_func("/utf8/valid", test_utf8_valid);
+    g_test_add_func("/utf8/truncated", test_utf8_truncated);
+    g_test_add_func("/utf8/random", test_utf8_random);
+    g_test_add_func("/lines/crlf-blocks", test_lines_crlf_blocks);
+    g_test_add_func("/lines/crlf-pieces", test_lines_crlf_pieces);
+    g_test_add_func("/lines/random-edits", test_lines_random_edits);
+
+    return g_test_run();
+}